@@ -0,0 +1,367 @@
+#include "Decimal.h"
+
+#include <cstring>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+namespace Kiff
+{
+	struct U128
+	{
+		uint64_t lo;
+		uint64_t hi;
+	};
+
+	static inline bool Less(const U128 &a, const U128 &b)
+	{
+		return (a.hi < b.hi) || ((a.hi == b.hi) && (a.lo < b.lo));
+	}
+
+	static inline U128 Add(const U128 &a, const U128 &b)
+	{
+		U128 r;
+		r.lo = a.lo + b.lo;
+		r.hi = a.hi + b.hi + (r.lo < a.lo);
+		return r;
+	}
+
+	// a >= b
+	static inline U128 Sub(const U128 &a, const U128 &b)
+	{
+		U128 r;
+		r.lo = a.lo - b.lo;
+		r.hi = a.hi - b.hi - (a.lo < b.lo);
+		return r;
+	}
+
+	static inline U128 Mul64(uint64_t a, uint64_t b)
+	{
+		U128 r;
+#if defined(__SIZEOF_INT128__)
+		unsigned __int128 p = static_cast<unsigned __int128>(a) * b;
+		r.lo = static_cast<uint64_t>(p);
+		r.hi = static_cast<uint64_t>(p >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+		r.lo = _umul128(a, b, &r.hi);
+#else
+		uint64_t a0 = a & 0xffffffff, a1 = a >> 32, b0 = b & 0xffffffff, b1 = b >> 32;
+		uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+		uint64_t mid = (p00 >> 32) + (p01 & 0xffffffff) + (p10 & 0xffffffff);
+		r.lo = (mid << 32) | (p00 & 0xffffffff);
+		r.hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+#endif
+		return r;
+	}
+
+	// false on 128-bit overflow; r may alias a or b
+	static bool Mul(U128 a, U128 b, U128 &r)
+	{
+		if ((a.hi != 0) && (b.hi != 0)) return false;
+		r = Mul64(a.lo, b.lo);
+		U128 c1 = Mul64(a.hi, b.lo), c2 = Mul64(a.lo, b.hi);
+		if ((c1.hi != 0) || (c2.hi != 0)) return false;
+		uint64_t cross = c1.lo + c2.lo;
+		if (cross < c1.lo) return false;
+		r.hi += cross;
+		return r.hi >= cross;
+	}
+
+	// a /= d, returns the remainder
+	static uint32_t DivMod32(U128 &a, uint32_t d)
+	{
+		uint64_t r = 0;
+		uint32_t w[4] = { static_cast<uint32_t>(a.hi >> 32), static_cast<uint32_t>(a.hi), static_cast<uint32_t>(a.lo >> 32), static_cast<uint32_t>(a.lo) };
+		for (uint32_t &x : w)
+		{
+			uint64_t cur = (r << 32) | x;
+			x = static_cast<uint32_t>(cur / d);
+			r = cur % d;
+		}
+		a.hi = (static_cast<uint64_t>(w[0]) << 32) | w[1];
+		a.lo = (static_cast<uint64_t>(w[2]) << 32) | w[3];
+		return static_cast<uint32_t>(r);
+	}
+
+	// shift-subtract division, d < 2^127
+	static void DivMod(const U128 &n, const U128 &d, U128 &q, U128 &r)
+	{
+		if ((n.hi == 0) && (d.hi == 0))
+		{
+			q.hi = r.hi = 0;
+			q.lo = n.lo / d.lo;
+			r.lo = n.lo % d.lo;
+			return;
+		}
+		q.lo = q.hi = r.lo = r.hi = 0;
+		for (int i = 127; i >= 0; i--)
+		{
+			r.hi = (r.hi << 1) | (r.lo >> 63);
+			r.lo = (r.lo << 1) | (((i >= 64 ? n.hi >> (i - 64) : n.lo >> i)) & 1);
+			if (!Less(r, d))
+			{
+				r = Sub(r, d);
+				if (i >= 64) q.hi |= 1ULL << (i - 64);
+				else q.lo |= 1ULL << i;
+			}
+		}
+	}
+
+	static const U128 &Pow10(uint32_t n)
+	{
+		struct Table
+		{
+			U128 p[Decimal::MaxDigits + 1];
+			Table()
+			{
+				p[0].lo = 1;
+				p[0].hi = 0;
+				for (uint32_t i = 1; i <= Decimal::MaxDigits; i++)
+				{
+					U128 ten = { 10, 0 };
+					Mul(p[i - 1], ten, p[i]);
+				}
+			}
+		};
+		static const Table table;
+		return table.p[n];
+	}
+
+	static inline bool Fits(const U128 &a)
+	{
+		return Less(a, Pow10(Decimal::MaxDigits));
+	}
+
+	// a * 10^n, false if the result has more than MaxDigits digits
+	static bool ScaleUp(U128 &a, uint32_t n)
+	{
+		if (n > Decimal::MaxDigits) return (a.lo | a.hi) == 0;
+		return Mul(a, Pow10(n), a) && Fits(a);
+	}
+
+	// a / 10^n rounded half away from zero
+	static void ScaleDown(U128 &a, uint32_t n)
+	{
+		if (n == 0) return;
+		if (n > Decimal::MaxDigits)
+		{
+			a.lo = a.hi = 0;
+			return;
+		}
+		for (n--; n > 0; )
+		{
+			uint32_t k = (n > 9) ? 9 : n;
+			DivMod32(a, static_cast<uint32_t>(Pow10(k).lo));
+			n -= k;
+		}
+		if (DivMod32(a, 10) >= 5) a = Add(a, U128{ 1, 0 });
+	}
+
+	////////////////////////////////////////////////
+	Decimal::Decimal(int64_t unscaled, uint32_t iscale)
+		:lo(unscaled < 0 ? 0 - static_cast<uint64_t>(unscaled) : static_cast<uint64_t>(unscaled)), scale(iscale), negative(unscaled < 0)
+	{
+		if (scale > MaxDigits) throw std::overflow_error("Decimal : scale is out of range");
+	}
+
+	bool Decimal::Parse(const char *str, size_t len, Decimal *decptr)
+	{
+		const char *p = str, *end = str + len;
+		bool neg = false;
+		if ((p != end) && ((*p == '-') || (*p == '+'))) neg = (*p++ == '-');
+
+		U128 mag = { 0, 0 };
+		uint64_t chunk = 0;
+		uint32_t chunkDigits = 0, digits = 0, fraction = 0;
+		bool point = false, any = false;
+		for (; p != end; p++)
+		{
+			char c = *p;
+			if ((c == '.') && !point)
+			{
+				point = true;
+				continue;
+			}
+			if ((c < '0') || (c > '9')) return false;
+			any = true;
+			if (point) fraction++;
+			if ((digits == 0) && (c == '0')) continue;		// leading zeros
+
+			if (++digits > MaxDigits) return false;
+			chunk = chunk * 10 + static_cast<uint64_t>(c - '0');
+			if (++chunkDigits == 19)
+			{
+				Mul(mag, Pow10(19), mag);
+				mag = Add(mag, U128{ chunk, 0 });
+				chunk = 0;
+				chunkDigits = 0;
+			}
+		}
+		if (!any || (fraction > MaxDigits)) return false;
+		if (chunkDigits != 0)
+		{
+			Mul(mag, Pow10(chunkDigits), mag);
+			mag = Add(mag, U128{ chunk, 0 });
+		}
+		*decptr = Decimal(mag.lo, mag.hi, fraction, neg);
+		return true;
+	}
+
+	size_t Decimal::Format(char *buf) const
+	{
+		// digits backwards, 9 at a time
+		char tmp[MaxChars];
+		char *end = tmp + sizeof(tmp), *p = end;
+		U128 v = { lo, hi };
+		while ((v.hi != 0) || (v.lo >= 1000000000ULL))
+		{
+			uint32_t r = DivMod32(v, 1000000000);
+			for (int i = 0; i < 9; i++, r /= 10) *--p = char('0' + r % 10);
+		}
+		uint64_t r = v.lo;
+		do
+		{
+			*--p = char('0' + r % 10);
+			r /= 10;
+		} while (r != 0);
+
+		size_t ndigits = static_cast<size_t>(end - p);
+		char *o = buf;
+		if (negative) *o++ = '-';
+		if (ndigits <= scale)
+		{
+			*o++ = '0';
+			if (scale != 0)
+			{
+				*o++ = '.';
+				memset(o, '0', scale - ndigits);
+				o += scale - ndigits;
+				memcpy(o, p, ndigits);
+				o += ndigits;
+			}
+		}
+		else
+		{
+			size_t whole = ndigits - scale;
+			memcpy(o, p, whole);
+			o += whole;
+			if (scale != 0)
+			{
+				*o++ = '.';
+				memcpy(o, p + whole, scale);
+				o += scale;
+			}
+		}
+		return static_cast<size_t>(o - buf);
+	}
+
+	std::string Decimal::ToString() const
+	{
+		char buf[MaxChars];
+		return std::string(buf, Format(buf));
+	}
+
+	double Decimal::ToDouble() const
+	{
+		double v = static_cast<double>(hi) * 18446744073709551616.0 + static_cast<double>(lo);
+		U128 p = Pow10(scale);
+		v /= static_cast<double>(p.hi) * 18446744073709551616.0 + static_cast<double>(p.lo);
+		return negative ? -v : v;
+	}
+
+	void Decimal::Unscaled(uint64_t &olo, int64_t &ohi) const
+	{
+		U128 v = { lo, hi };
+		if (negative) v = Sub(U128{ 0, 0 }, v);
+		olo = v.lo;
+		ohi = static_cast<int64_t>(v.hi);
+	}
+
+	Decimal Decimal::Rescale(uint32_t newScale) const
+	{
+		if (newScale > MaxDigits) throw std::overflow_error("Decimal : scale is out of range");
+		U128 v = { lo, hi };
+		if (newScale > scale)
+		{
+			if (!ScaleUp(v, newScale - scale)) throw std::overflow_error("Decimal : overflow in Rescale");
+		}
+		else ScaleDown(v, scale - newScale);
+		return Decimal(v.lo, v.hi, newScale, negative);
+	}
+
+	int Decimal::CompareMagnitude(const Decimal &other) const
+	{
+		U128 a = { lo, hi }, b = { other.lo, other.hi };
+		// a value that can't be scaled up is larger than any that fits
+		if (scale < other.scale)
+		{
+			if (!ScaleUp(a, other.scale - scale)) return 1;
+		}
+		else if (other.scale < scale)
+		{
+			if (!ScaleUp(b, scale - other.scale)) return -1;
+		}
+		if (Less(a, b)) return -1;
+		return Less(b, a) ? 1 : 0;
+	}
+
+	int Decimal::Compare(const Decimal &other) const
+	{
+		if (negative != other.negative) return negative ? -1 : 1;
+		int cmp = CompareMagnitude(other);
+		return negative ? -cmp : cmp;
+	}
+
+	Decimal Decimal::AddMagnitude(const Decimal &other, bool subtract) const
+	{
+		uint32_t rs = (scale > other.scale) ? scale : other.scale;
+		U128 a = { lo, hi }, b = { other.lo, other.hi };
+		if (!ScaleUp(a, rs - scale) || !ScaleUp(b, rs - other.scale))
+			throw std::overflow_error("Decimal : overflow in addition");
+
+		bool bneg = other.negative != subtract;
+		if (negative == bneg)
+		{
+			U128 s = Add(a, b);
+			if (!Fits(s)) throw std::overflow_error("Decimal : overflow in addition");
+			return Decimal(s.lo, s.hi, rs, negative);
+		}
+		if (Less(a, b))
+		{
+			U128 d = Sub(b, a);
+			return Decimal(d.lo, d.hi, rs, bneg);
+		}
+		U128 d = Sub(a, b);
+		return Decimal(d.lo, d.hi, rs, negative);
+	}
+
+	Decimal Decimal::operator * (const Decimal &other) const
+	{
+		U128 p;
+		if (!Mul(U128{ lo, hi }, U128{ other.lo, other.hi }, p)) throw std::overflow_error("Decimal : overflow in multiplication");
+		uint32_t rs = scale + other.scale;
+		if (rs > MaxDigits)
+		{
+			ScaleDown(p, rs - MaxDigits);
+			rs = MaxDigits;
+		}
+		if (!Fits(p)) throw std::overflow_error("Decimal : overflow in multiplication");
+		return Decimal(p.lo, p.hi, rs, negative != other.negative);
+	}
+
+	Decimal Decimal::operator / (const Decimal &other) const
+	{
+		if (other.IsZero()) throw std::domain_error("Decimal : division by zero");
+
+		// this * 10^(rs - scale + other.scale) / other, rounded
+		uint32_t rs = (scale > other.scale) ? scale : other.scale;
+		U128 n = { lo, hi }, d = { other.lo, other.hi }, q, r;
+		uint32_t shift = rs - scale + other.scale;
+		if ((shift > MaxDigits) || !Mul(n, Pow10(shift), n)) throw std::overflow_error("Decimal : overflow in division");
+		DivMod(n, d, q, r);
+		if (!Less(r, Sub(d, r))) q = Add(q, U128{ 1, 0 });
+		if (!Fits(q)) throw std::overflow_error("Decimal : overflow in division");
+		return Decimal(q.lo, q.hi, rs, negative != other.negative);
+	}
+}
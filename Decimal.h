@@ -0,0 +1,87 @@
+/*
+Site:		http://hlspx.ocry.com/mysqlconnestion/
+
+History:
+			VERSION
+			1.0.0.0
+Author:
+		Alexey Tretyakov	hlspx@mail.ru
+*/
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <stdexcept>
+
+namespace Kiff
+{
+	/////////////////////////////////////////////
+	// Fixed-point number for DECIMAL columns: 128-bit unscaled magnitude, sign and scale.
+	// Up to 38 significant digits; results that don't fit throw std::overflow_error.
+	class Decimal
+	{
+		uint64_t lo = 0;			// magnitude
+		uint64_t hi = 0;
+		uint32_t scale = 0;			// digits after the point
+		bool negative = false;
+
+		Decimal(uint64_t ilo, uint64_t ihi, uint32_t iscale, bool ineg)
+			:lo(ilo), hi(ihi), scale(iscale), negative(ineg && (ilo | ihi) != 0) {}
+
+		int CompareMagnitude(const Decimal &other) const;
+		Decimal AddMagnitude(const Decimal &other, bool subtract) const;
+	public:
+		static const uint32_t MaxDigits = 38;
+		static const size_t MaxChars = MaxDigits + 3;		// sign, leading zero, point
+
+		Decimal() {}
+
+		// unscaled / 10^scale: Decimal(12345, 2) == 123.45
+		Decimal(int64_t unscaled, uint32_t scale = 0);
+
+		explicit Decimal(const std::string &str)
+		{
+			if (!Parse(str.data(), str.length(), this)) throw std::runtime_error("Decimal : can't parse '" + str + "'");
+		}
+
+		// [+-]digits[.digits] as sent by the server; false on bad syntax or more than 38 digits
+		static bool Parse(const char *str, size_t len, Decimal *decptr);
+		static bool Parse(const std::string &str, Decimal *decptr) { return Parse(str.data(), str.length(), decptr); }
+
+		// writes at most MaxChars, returns the length (no terminating zero)
+		size_t Format(char *buf) const;
+		std::string ToString() const;
+		double ToDouble() const;
+
+		uint32_t Scale() const { return scale; }
+		bool IsNegative() const { return negative; }
+		bool IsZero() const { return (lo | hi) == 0; }
+
+		// 128-bit two's complement of the unscaled value
+		void Unscaled(uint64_t &olo, int64_t &ohi) const;
+
+		// round half away from zero when digits are dropped
+		Decimal Rescale(uint32_t newScale) const;
+
+		Decimal operator - () const { return Decimal(lo, hi, scale, !negative); }
+		Decimal operator + (const Decimal &other) const { return AddMagnitude(other, false); }
+		Decimal operator - (const Decimal &other) const { return AddMagnitude(other, true); }
+		Decimal operator * (const Decimal &other) const;
+		Decimal operator / (const Decimal &other) const;		// scale of the more precise operand
+
+		Decimal& operator += (const Decimal &other) { return *this = *this + other; }
+		Decimal& operator -= (const Decimal &other) { return *this = *this - other; }
+		Decimal& operator *= (const Decimal &other) { return *this = *this * other; }
+		Decimal& operator /= (const Decimal &other) { return *this = *this / other; }
+
+		// numeric comparison: 1.50 == 1.5
+		int Compare(const Decimal &other) const;
+		inline bool operator < (const Decimal &other) const { return Compare(other) < 0; }
+		inline bool operator > (const Decimal &other) const { return Compare(other) > 0; }
+		inline bool operator >= (const Decimal &other) const { return Compare(other) >= 0; }
+		inline bool operator <= (const Decimal &other) const { return Compare(other) <= 0; }
+		inline bool operator == (const Decimal &other) const { return Compare(other) == 0; }
+		inline bool operator != (const Decimal &other) const { return Compare(other) != 0; }
+	};
+}
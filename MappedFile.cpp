@@ -0,0 +1,117 @@
+#include "MappedFile.h"
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Kiff {
+
+	// the mapping keeps the data after the file is closed
+	MappedFile::MappedFile(const std::string &path)
+	{
+#ifdef _WIN32
+#pragma warning (disable:4996)
+#endif
+		FILE *file = fopen(path.c_str(), "rb");
+#ifdef _WIN32
+#pragma warning (default:4996)
+#endif
+		if (file == nullptr) throw std::runtime_error("MappedFile : can't open '" + path + "'");
+		try
+		{
+#ifdef _WIN32
+			Map(_fileno(file));
+#else
+			Map(fileno(file));
+#endif
+		}
+		catch (...)
+		{
+			fclose(file);
+			throw;
+		}
+		fclose(file);
+	}
+
+	MappedFile::MappedFile(FILE *file)
+	{
+		if (fflush(file) != 0) throw std::runtime_error("MappedFile : fflush failed");
+#ifdef _WIN32
+		Map(_fileno(file));
+#else
+		Map(fileno(file));
+#endif
+	}
+
+	void MappedFile::Map(int fd)
+	{
+#ifdef _WIN32
+		HANDLE handle = reinterpret_cast<HANDLE>(_get_osfhandle(fd));
+		LARGE_INTEGER len;
+		if (!GetFileSizeEx(handle, &len)) throw std::runtime_error("MappedFile : GetFileSizeEx failed");
+		if (len.QuadPart == 0) return;
+		mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL) throw std::runtime_error("MappedFile : CreateFileMapping failed");
+		base = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		if (base == nullptr)
+		{
+			CloseHandle(mapping);
+			mapping = nullptr;
+			throw std::runtime_error("MappedFile : MapViewOfFile failed");
+		}
+		size = static_cast<size_t>(len.QuadPart);
+#else
+		struct stat st;
+		if (fstat(fd, &st) != 0) throw std::runtime_error("MappedFile : fstat failed");
+		if (st.st_size == 0) return;
+		void *p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED) throw std::runtime_error("MappedFile : mmap failed");
+		base = static_cast<const char*>(p);
+		size = static_cast<size_t>(st.st_size);
+#endif
+	}
+
+	void MappedFile::Unmap()
+	{
+		if (base == nullptr) return;
+#ifdef _WIN32
+		UnmapViewOfFile(base);
+		CloseHandle(mapping);
+		mapping = nullptr;
+#else
+		munmap(const_cast<char*>(base), size);
+#endif
+		base = nullptr;
+		size = 0;
+	}
+
+	MappedFile::MappedFile(MappedFile &&other) noexcept
+		:base(other.base), size(other.size)
+	{
+#ifdef _WIN32
+		mapping = other.mapping;
+		other.mapping = nullptr;
+#endif
+		other.base = nullptr;
+		other.size = 0;
+	}
+
+	MappedFile& MappedFile::operator=(MappedFile &&other) noexcept
+	{
+		if (this != &other)
+		{
+			std::swap(base, other.base);
+			std::swap(size, other.size);
+#ifdef _WIN32
+			std::swap(mapping, other.mapping);
+#endif
+		}
+		return *this;
+	}
+}
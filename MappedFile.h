@@ -0,0 +1,49 @@
+/*
+Site:		http://hlspx.ocry.com/mysqlconnestion/
+
+History:
+			VERSION
+			1.0.0.0
+Author:
+		Alexey Tretyakov	hlspx@mail.ru
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <cstddef>
+#include <string>
+#include <stdexcept>
+
+namespace Kiff
+{
+	/////////////////////////////////////////////
+	// Read-only memory mapping of a whole file. An empty file maps to Data() == nullptr.
+	class MappedFile
+	{
+		const char *base = nullptr;
+		size_t size = 0;
+#ifdef _WIN32
+		void *mapping = nullptr;
+#endif
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		void Map(int fd);
+		void Unmap();
+	public:
+		MappedFile() {}
+
+		explicit MappedFile(const std::string &path);
+
+		// the FILE stays owned by the caller and must outlive the mapping
+		explicit MappedFile(FILE *file);
+
+		MappedFile(MappedFile &&other) noexcept;
+		MappedFile& operator=(MappedFile &&other) noexcept;
+		~MappedFile() { Unmap(); }
+
+		const char *Data() const { return base; }
+		size_t Size() const { return size; }
+	};
+}
@@ -0,0 +1,165 @@
+/*
+Site:		http://hlspx.ocry.com/mysqlconnestion/
+
+History:
+			VERSION
+			1.0.0.0
+Author:
+		Alexey Tretyakov	hlspx@mail.ru
+*/
+
+#pragma once
+
+#include "MySqlConnection.h"
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+
+namespace Kiff {
+
+	//////////////////////////////////////////////////////////////
+	// Coalesces point lookups from many threads into one "... WHERE id IN (?, ?, ...)" on the
+	// loader's own connection: keys asked for within the window after the oldest waiting one,
+	// up to maxBatch distinct keys, go out together. A key asked for twice in a batch is sent once.
+	//
+	// The query has a single '?' for the IN list. It is expanded to 1, 2, 4 ... maxBatch
+	// placeholders, one prepared statement per size; unused slots repeat the last key.
+	// makeRow builds a Row from the reader's current row, column keyPos holds its Key
+	// (compared as returned, so a case-insensitive collation does not match "A" to "a").
+	// Keys without a row get an empty Nullable; a failed batch fails all its futures.
+	template<typename Key, typename Row>
+	class BatchLoader
+	{
+	public:
+		typedef std::function<Row(const MySqlDataReader&)> RowFn;
+	private:
+		typedef std::vector<std::promise<Nullable<Row>>> Waiters;
+
+		MySqlConnection conn;
+		std::string head, tail;				// query around the '?'
+		RowFn makeRow;
+		uint32_t keyPos;
+		size_t maxBatch;
+		std::chrono::microseconds window;
+		std::map<size_t, std::unique_ptr<MySqlCommand>> commands;		// by IN list size, loader thread only
+
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::map<Key, Waiters> waiting;
+		std::deque<std::pair<Key, std::chrono::steady_clock::time_point>> order;		// waiting keys by first request
+		bool stop = false;
+		std::thread thr;
+
+		BatchLoader(const BatchLoader&) = delete;
+
+		MySqlCommand &Command(size_t arity)
+		{
+			auto it = commands.find(arity);
+			if (it != commands.end()) return *it->second;
+			std::string marks;
+			for (size_t i = 0; i < arity; i++) marks.append((i == 0) ? "?" : ", ?");
+			std::unique_ptr<MySqlCommand> &cmd = commands[arity];
+			cmd.reset(new MySqlCommand(conn.CreateCommand(head + marks + tail)));
+			return *cmd;
+		}
+
+		void Fetch(const std::vector<Key> &batch, std::vector<Waiters> &waiters)
+		{
+			std::vector<Nullable<Row>> rows(batch.size());
+			try
+			{
+				size_t arity = 1;
+				while (arity < batch.size()) arity *= 2;
+				if (arity > maxBatch) arity = maxBatch;
+
+				MySqlCommand &cmd = Command(arity);
+				for (size_t i = 0; i < arity; i++) cmd.SetValue(static_cast<uint32_t>(i), batch[(i < batch.size()) ? i : batch.size() - 1]);
+
+				std::map<Key, size_t> index;
+				for (size_t i = 0; i < batch.size(); i++) index.emplace(batch[i], i);
+				MySqlDataReader rd = cmd.ExecuteReader();
+				while (rd.Read())
+				{
+					auto it = index.find(rd.GetFieldValue<Key>(keyPos));
+					if (it != index.end()) rows[it->second] = makeRow(rd);
+				}
+			}
+			catch (...)
+			{
+				std::exception_ptr e = std::current_exception();
+				for (Waiters &ws : waiters)
+					for (std::promise<Nullable<Row>> &w : ws) w.set_exception(e);
+				return;
+			}
+
+			for (size_t i = 0; i < batch.size(); i++)
+				for (std::promise<Nullable<Row>> &w : waiters[i]) w.set_value(rows[i]);
+		}
+
+		void Run()
+		{
+			std::unique_lock<std::mutex> lk(mtx);
+			for (;;)
+			{
+				cv.wait(lk, [this] { return stop || !order.empty(); });
+				if (order.empty()) return;
+				if (!stop) cv.wait_until(lk, order.front().second + window, [this] { return stop || (order.size() >= maxBatch); });
+
+				std::vector<Key> batch;
+				std::vector<Waiters> waiters;
+				while (!order.empty() && (batch.size() < maxBatch))
+				{
+					auto it = waiting.find(order.front().first);
+					batch.push_back(std::move(order.front().first));
+					waiters.push_back(std::move(it->second));
+					waiting.erase(it);
+					order.pop_front();
+				}
+
+				lk.unlock();
+				Fetch(batch, waiters);
+				lk.lock();
+			}
+		}
+	public:
+		BatchLoader(const std::string &connStr, const std::string &query, RowFn imakeRow, uint32_t ikeyPos = 0,
+			size_t imaxBatch = 64, std::chrono::microseconds iwindow = std::chrono::microseconds(500))
+			:conn(connStr), makeRow(std::move(imakeRow)), keyPos(ikeyPos), maxBatch(imaxBatch == 0 ? 1 : imaxBatch), window(iwindow)
+		{
+			size_t mark = query.find('?');
+			if ((mark == std::string::npos) || (query.find('?', mark + 1) != std::string::npos))
+				throw std::runtime_error("BatchLoader : query must have one '?' for the IN list");
+			head = query.substr(0, mark);
+			tail = query.substr(mark + 1);
+			thr = std::thread(&BatchLoader::Run, this);
+		}
+
+		// waits for the lookups already asked for
+		~BatchLoader()
+		{
+			{
+				std::lock_guard<std::mutex> lk(mtx);
+				stop = true;
+			}
+			cv.notify_all();
+			thr.join();
+		}
+
+		// from any thread
+		std::future<Nullable<Row>> Load(const Key &key)
+		{
+			std::promise<Nullable<Row>> w;
+			std::future<Nullable<Row>> result = w.get_future();
+			std::lock_guard<std::mutex> lk(mtx);
+			if (stop) throw std::runtime_error("BatchLoader : stopped");
+			Waiters &ws = waiting[key];
+			if (ws.empty()) order.emplace_back(key, std::chrono::steady_clock::now());
+			ws.push_back(std::move(w));
+			if ((order.size() == 1) || (order.size() >= maxBatch)) cv.notify_one();
+			return result;
+		}
+	};
+}
@@ -0,0 +1,719 @@
+#include "MySqlBinlog.h"
+#include <cctype>
+#include <cstdio>
+
+namespace Kiff {
+
+	static const char *Truncated = "BinlogStream : truncated row event";
+
+	static void Need(const uint8_t *p, const uint8_t *end, size_t n)
+	{
+		if (static_cast<size_t>(end - p) < n) throw std::runtime_error(Truncated);
+	}
+
+	static uint64_t LittleEndian(const uint8_t *p, size_t n)
+	{
+		uint64_t v = 0;
+		for (size_t i = n; i > 0; i--) v = (v << 8) | p[i - 1];
+		return v;
+	}
+
+	static uint64_t BigEndian(const uint8_t *p, size_t n)
+	{
+		uint64_t v = 0;
+		for (size_t i = 0; i < n; i++) v = (v << 8) | p[i];
+		return v;
+	}
+
+	template<typename T>
+	static void Append(std::string &data, const T &value)
+	{
+		data.append(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	static MYSQL_TIME MakeTime(enum_mysql_timestamp_type type)
+	{
+		MYSQL_TIME mtim;
+		std::memset(&mtim, 0, sizeof(mtim));
+		mtim.time_type = type;
+		return mtim;
+	}
+
+	// fractional part of TIME2/DATETIME2/TIMESTAMP2: (fsp + 1) / 2 big-endian bytes
+	static unsigned long Fraction(const uint8_t *&p, const uint8_t *end, uint16_t fsp)
+	{
+		size_t n = (fsp + 1) / 2;
+		Need(p, end, n);
+		unsigned long frac = static_cast<unsigned long>(BigEndian(p, n));
+		p += n;
+		static const unsigned long scale[] = { 0, 10000, 100, 1 };
+		return frac * scale[n];
+	}
+
+	static void CivilFromUnix(int64_t secs, MYSQL_TIME &mtim)
+	{
+		int64_t days = secs / 86400, rem = secs % 86400;
+		if (rem < 0)
+		{
+			rem += 86400;
+			days--;
+		}
+		// days since 1970-01-01 to y/m/d (proleptic Gregorian)
+		days += 719468;
+		int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+		int64_t doe = days - era * 146097;
+		int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+		int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+		int64_t mp = (5 * doy + 2) / 153;
+		mtim.day = static_cast<unsigned int>(doy - (153 * mp + 2) / 5 + 1);
+		mtim.month = static_cast<unsigned int>(mp < 10 ? mp + 3 : mp - 9);
+		mtim.year = static_cast<unsigned int>(yoe + era * 400 + (mtim.month <= 2));
+		mtim.hour = static_cast<unsigned int>(rem / 3600);
+		mtim.minute = static_cast<unsigned int>(rem / 60 % 60);
+		mtim.second = static_cast<unsigned int>(rem % 60);
+	}
+
+	// packed binary DECIMAL(precision, scale) to the text the server sends over the wire
+	static void DecimalText(const uint8_t *&p, const uint8_t *end, uint16_t meta, std::string &data)
+	{
+		static const size_t dig2bytes[] = { 0, 1, 1, 2, 2, 3, 3, 4, 4, 4 };
+		uint32_t precision = meta & 0xff, scale = meta >> 8;
+		if ((precision > 65) || (scale > precision)) throw std::runtime_error("BinlogStream : bad DECIMAL metadata");
+		uint32_t intg = precision - scale;
+		size_t intg0 = intg / 9, intg0x = intg % 9, frac0 = scale / 9, frac0x = scale % 9;
+		size_t size = intg0 * 4 + dig2bytes[intg0x] + frac0 * 4 + dig2bytes[frac0x];
+		Need(p, end, size);
+
+		uint8_t buf[32];
+		std::memcpy(buf, p, size);
+		p += size;
+		bool negative = (buf[0] & 0x80) == 0;
+		buf[0] ^= 0x80;
+		if (negative) for (size_t i = 0; i < size; i++) buf[i] = ~buf[i];
+
+		char digits[96];
+		size_t len = 0, at = 0;
+		if (intg0x != 0)
+		{
+			len += sprintf(digits + len, "%u", static_cast<unsigned>(BigEndian(buf, dig2bytes[intg0x])));
+			at += dig2bytes[intg0x];
+		}
+		for (size_t i = 0; i < intg0; i++, at += 4) len += sprintf(digits + len, (len == 0) ? "%u" : "%09u", static_cast<unsigned>(BigEndian(buf + at, 4)));
+		if (len == 0 || (len == 1 && digits[0] == '0')) len = sprintf(digits, "0");
+		else
+		{
+			size_t lead = 0;
+			while (lead + 1 < len && digits[lead] == '0') lead++;
+			std::memmove(digits, digits + lead, len - lead);
+			len -= lead;
+		}
+		if (scale != 0)
+		{
+			digits[len++] = '.';
+			for (size_t i = 0; i < frac0; i++, at += 4) len += sprintf(digits + len, "%09u", static_cast<unsigned>(BigEndian(buf + at, 4)));
+			if (frac0x != 0) len += sprintf(digits + len, "%0*u", static_cast<int>(frac0x), static_cast<unsigned>(BigEndian(buf + at, dig2bytes[frac0x])));
+		}
+		if (negative) data.push_back('-');
+		data.append(digits, len);
+	}
+
+	// one column value, appended to data in the layout of MySqlDataReader buffers
+	static MySqlDbType DecodeValue(uint8_t type, uint16_t meta, const uint8_t *&p, const uint8_t *end, std::string &data)
+	{
+		switch (type)
+		{
+		case MYSQL_TYPE_TINY:
+			Need(p, end, 1);
+			Append(data, static_cast<int8_t>(*p++));
+			return MySqlDbType::Byte;
+		case MYSQL_TYPE_SHORT:
+			Need(p, end, 2);
+			Append(data, static_cast<int16_t>(LittleEndian(p, 2)));
+			p += 2;
+			return MySqlDbType::Int16;
+		case MYSQL_TYPE_INT24:
+		{
+			Need(p, end, 3);
+			int32_t v = static_cast<int32_t>(LittleEndian(p, 3));
+			if (v & 0x800000) v -= 0x1000000;
+			Append(data, v);
+			p += 3;
+			return MySqlDbType::Int32;
+		}
+		case MYSQL_TYPE_LONG:
+			Need(p, end, 4);
+			Append(data, static_cast<int32_t>(LittleEndian(p, 4)));
+			p += 4;
+			return MySqlDbType::Int32;
+		case MYSQL_TYPE_LONGLONG:
+			Need(p, end, 8);
+			Append(data, static_cast<int64_t>(LittleEndian(p, 8)));
+			p += 8;
+			return MySqlDbType::Int64;
+		case MYSQL_TYPE_FLOAT:
+		{
+			Need(p, end, 4);
+			float v;
+			std::memcpy(&v, p, 4);
+			Append(data, v);
+			p += 4;
+			return MySqlDbType::Float;
+		}
+		case MYSQL_TYPE_DOUBLE:
+		{
+			Need(p, end, 8);
+			double v;
+			std::memcpy(&v, p, 8);
+			Append(data, v);
+			p += 8;
+			return MySqlDbType::Double;
+		}
+		case MYSQL_TYPE_YEAR:
+		{
+			Need(p, end, 1);
+			MYSQL_TIME mtim = MakeTime(MYSQL_TIMESTAMP_DATE);
+			mtim.year = (*p == 0) ? 0 : 1900 + *p;
+			p++;
+			Append(data, mtim);
+			return MySqlDbType::DateTime;
+		}
+		case MYSQL_TYPE_DATE:
+		case MYSQL_TYPE_NEWDATE:
+		{
+			Need(p, end, 3);
+			uint32_t v = static_cast<uint32_t>(LittleEndian(p, 3));
+			p += 3;
+			MYSQL_TIME mtim = MakeTime(MYSQL_TIMESTAMP_DATE);
+			mtim.day = v & 31;
+			mtim.month = (v >> 5) & 15;
+			mtim.year = v >> 9;
+			Append(data, mtim);
+			return MySqlDbType::DateTime;
+		}
+		case MYSQL_TYPE_TIME:
+		{
+			Need(p, end, 3);
+			int32_t v = static_cast<int32_t>(LittleEndian(p, 3));
+			if (v & 0x800000) v -= 0x1000000;
+			p += 3;
+			MYSQL_TIME mtim = MakeTime(MYSQL_TIMESTAMP_TIME);
+			mtim.neg = v < 0;
+			if (v < 0) v = -v;
+			mtim.hour = v / 10000;
+			mtim.minute = v / 100 % 100;
+			mtim.second = v % 100;
+			Append(data, mtim);
+			return MySqlDbType::DateTime;
+		}
+		case MYSQL_TYPE_TIME2:
+		{
+			// 3 bytes of hour:10 minute:6 second:6 offset by 0x800000, then the fraction
+			Need(p, end, 3);
+			int64_t intpart = static_cast<int64_t>(BigEndian(p, 3)) - 0x800000;
+			p += 3;
+			size_t n = (meta + 1) / 2;
+			Need(p, end, n);
+			int64_t frac = static_cast<int64_t>(BigEndian(p, n));
+			p += n;
+			int64_t packed;
+			if (n == 0 || n == 3) packed = intpart * (1 << 24) + frac;
+			else
+			{
+				int64_t unit = (n == 1) ? 0x100 : 0x10000;
+				if (intpart < 0 && frac != 0)
+				{
+					intpart++;
+					frac -= unit;
+				}
+				packed = intpart * (1 << 24) + frac * ((n == 1) ? 10000 : 100);
+			}
+			MYSQL_TIME mtim = MakeTime(MYSQL_TIMESTAMP_TIME);
+			mtim.neg = packed < 0;
+			if (packed < 0) packed = -packed;
+			int64_t hms = packed >> 24;
+			mtim.hour = static_cast<unsigned int>((hms >> 12) % (1 << 10));
+			mtim.minute = static_cast<unsigned int>((hms >> 6) % (1 << 6));
+			mtim.second = static_cast<unsigned int>(hms % (1 << 6));
+			mtim.second_part = static_cast<unsigned long>(packed % (1 << 24));
+			Append(data, mtim);
+			return MySqlDbType::DateTime;
+		}
+		case MYSQL_TYPE_DATETIME:
+		{
+			Need(p, end, 8);
+			uint64_t v = LittleEndian(p, 8);		// YYYYMMDDhhmmss
+			p += 8;
+			MYSQL_TIME mtim = MakeTime(MYSQL_TIMESTAMP_DATETIME);
+			uint64_t d = v / 1000000, t = v % 1000000;
+			mtim.year = static_cast<unsigned int>(d / 10000);
+			mtim.month = static_cast<unsigned int>(d / 100 % 100);
+			mtim.day = static_cast<unsigned int>(d % 100);
+			mtim.hour = static_cast<unsigned int>(t / 10000);
+			mtim.minute = static_cast<unsigned int>(t / 100 % 100);
+			mtim.second = static_cast<unsigned int>(t % 100);
+			Append(data, mtim);
+			return MySqlDbType::DateTime;
+		}
+		case MYSQL_TYPE_DATETIME2:
+		{
+			// 5 bytes: sign, year*13+month:17, day:5, hour:5, minute:6, second:6
+			Need(p, end, 5);
+			uint64_t intpart = BigEndian(p, 5) - 0x8000000000ULL;
+			p += 5;
+			MYSQL_TIME mtim = MakeTime(MYSQL_TIMESTAMP_DATETIME);
+			uint64_t ymd = intpart >> 17, ym = ymd >> 5, hms = intpart % (1 << 17);
+			mtim.day = static_cast<unsigned int>(ymd % (1 << 5));
+			mtim.month = static_cast<unsigned int>(ym % 13);
+			mtim.year = static_cast<unsigned int>(ym / 13);
+			mtim.second = static_cast<unsigned int>(hms % (1 << 6));
+			mtim.minute = static_cast<unsigned int>((hms >> 6) % (1 << 6));
+			mtim.hour = static_cast<unsigned int>(hms >> 12);
+			mtim.second_part = Fraction(p, end, meta);
+			Append(data, mtim);
+			return MySqlDbType::DateTime;
+		}
+		case MYSQL_TYPE_TIMESTAMP:
+		{
+			Need(p, end, 4);
+			MYSQL_TIME mtim = MakeTime(MYSQL_TIMESTAMP_DATETIME);
+			CivilFromUnix(static_cast<int64_t>(LittleEndian(p, 4)), mtim);
+			p += 4;
+			Append(data, mtim);
+			return MySqlDbType::DateTime;
+		}
+		case MYSQL_TYPE_TIMESTAMP2:
+		{
+			Need(p, end, 4);
+			MYSQL_TIME mtim = MakeTime(MYSQL_TIMESTAMP_DATETIME);
+			CivilFromUnix(static_cast<int64_t>(BigEndian(p, 4)), mtim);
+			p += 4;
+			mtim.second_part = Fraction(p, end, meta);
+			Append(data, mtim);
+			return MySqlDbType::DateTime;
+		}
+		case MYSQL_TYPE_NEWDECIMAL:
+			DecimalText(p, end, meta, data);
+			return MySqlDbType::NewDecimal;
+		case MYSQL_TYPE_VARCHAR:
+		case MYSQL_TYPE_VAR_STRING:
+		case MYSQL_TYPE_STRING:
+		{
+			size_t prefix = (meta < 256) ? 1 : 2;
+			Need(p, end, prefix);
+			size_t len = static_cast<size_t>(LittleEndian(p, prefix));
+			p += prefix;
+			Need(p, end, len);
+			data.append(reinterpret_cast<const char*>(p), len);
+			p += len;
+			return (type == MYSQL_TYPE_STRING) ? MySqlDbType::String : MySqlDbType::VarChar;
+		}
+		case MYSQL_TYPE_ENUM:
+			if (meta < 1 || meta > 2) throw std::runtime_error("BinlogStream : bad ENUM metadata");
+			Need(p, end, meta);
+			Append(data, static_cast<uint16_t>(LittleEndian(p, meta)));		// 1-based index
+			p += meta;
+			return MySqlDbType::UInt16;
+		case MYSQL_TYPE_SET:
+			if (meta < 1 || meta > 8) throw std::runtime_error("BinlogStream : bad SET metadata");
+			Need(p, end, meta);
+			Append(data, LittleEndian(p, meta));								// member bitmask
+			p += meta;
+			return MySqlDbType::UInt64;
+		case MYSQL_TYPE_BIT:
+		{
+			size_t len = (meta >> 8) + ((meta & 0xff) != 0 ? 1 : 0);
+			if (len > 8) throw std::runtime_error("BinlogStream : bad BIT metadata");
+			Need(p, end, len);
+			Append(data, BigEndian(p, len));
+			p += len;
+			return MySqlDbType::UInt64;
+		}
+		case MYSQL_TYPE_BLOB:
+		case MYSQL_TYPE_GEOMETRY:
+		case MYSQL_TYPE_JSON:
+		{
+			if (meta < 1 || meta > 4) throw std::runtime_error("BinlogStream : bad BLOB metadata");
+			Need(p, end, meta);
+			size_t len = static_cast<size_t>(LittleEndian(p, meta));
+			p += meta;
+			Need(p, end, len);
+			data.append(reinterpret_cast<const char*>(p), len);
+			p += len;
+			return MySqlDbType::Blob;
+		}
+		case MYSQL_TYPE_NULL:
+			return MySqlDbType::Unspecified;
+		default:
+			throw std::runtime_error("BinlogStream : unsupported column type " + std::to_string(type));
+		}
+	}
+
+	static bool BitSet(const unsigned char *bitmap, uint32_t i)
+	{
+		return (bitmap[i / 8] >> (i % 8)) & 1;
+	}
+
+	///////////////////////////////////////////
+	const BinlogRow::Column &BinlogRow::Value(uint32_t pos, const char *where) const
+	{
+		if (pos >= columns.size()) throw std::runtime_error(std::string("BinlogRow:: Wrong param index '").append(std::to_string(pos)).append("' in ").append(where));
+		if (columns[pos].is_null) throw std::runtime_error(std::string("Field '").append(std::to_string(pos)).append(columns[pos].present ? "' is NULL" : "' is not in the row image"));
+		return columns[pos];
+	}
+
+	// one row image: null bitmap over the present columns, then the non-null values
+	void BinlogRow::Decode(const BinlogTable &table, const unsigned char *bitmap, const uint8_t *&p, const uint8_t *end)
+	{
+		uint32_t count = static_cast<uint32_t>(table.types.size()), present = 0;
+		for (uint32_t i = 0; i < count; i++) present += BitSet(bitmap, i);
+		size_t nullBytes = (present + 7) / 8;
+		Need(p, end, nullBytes);
+		const uint8_t *nulls = p;
+		p += nullBytes;
+
+		columns.assign(count, Column());
+		for (uint32_t i = 0, k = 0; i < count; i++)
+		{
+			if (!BitSet(bitmap, i)) continue;
+			Column &col = columns[i];
+			col.present = true;
+			col.is_null = BitSet(nulls, k++);
+			if (col.is_null) continue;
+			size_t offset = data.size();
+			col.type = DecodeValue(table.types[i], table.meta[i], p, end, data);
+			col.offset = static_cast<uint32_t>(offset);
+			col.length = static_cast<uint32_t>(data.size() - offset);
+		}
+	}
+
+	template<>
+	std::string BinlogRow::GetFieldValue<std::string>(uint32_t pos) const
+	{
+		const Column &col = Value(pos, "GetFieldValue");
+		return data.substr(col.offset, col.length);
+	}
+
+	template<>
+	std::vector<uint8_t> BinlogRow::GetFieldValue<std::vector<uint8_t>>(uint32_t pos) const
+	{
+		const Column &col = Value(pos, "GetFieldValue");
+		const uint8_t *buf = reinterpret_cast<const uint8_t*>(data.data()) + col.offset;
+		return std::vector<uint8_t>(buf, buf + col.length);
+	}
+
+	template<>
+	TmDateTime BinlogRow::GetFieldValue<TmDateTime>(uint32_t pos) const
+	{
+		MYSQL_TIME sqtm = GetFieldValue<MYSQL_TIME>(pos);
+		uint32_t mls = sqtm.second_part / 1000;
+		uint32_t mks = sqtm.second_part % 1000;
+		return TmDateTime(sqtm.year, sqtm.month, sqtm.day, sqtm.hour, sqtm.minute, sqtm.second, mls, mks, 0);
+	}
+
+	template<>
+	Decimal BinlogRow::GetFieldValue<Decimal>(uint32_t pos) const
+	{
+		const Column &col = Value(pos, "GetFieldValue");
+		Decimal dec;
+		if (!Decimal::Parse(data.data() + col.offset, col.length, &dec))
+			throw std::runtime_error(std::string("Field '").append(std::to_string(pos)).append("' is not a decimal"));
+		return dec;
+	}
+
+	///////////////////////////////////////////
+	BinlogStream::BinlogStream(const std::string &connStr, uint32_t iserverId)
+		:conn(connStr), serverId(iserverId)
+	{
+	}
+
+	void BinlogStream::StartAt(const std::string &binlogFile, uint64_t binlogPosition)
+	{
+		file = binlogFile;
+		position = (binlogPosition < 4) ? 4 : binlogPosition;
+		gtids.clear();
+		useGtid = false;
+	}
+
+	// domain-server-sequence, decimal digits only: the text goes into @slave_connect_state
+	static bool IsGtid(const std::string &gtid)
+	{
+		int parts = 0;
+		size_t i = 0;
+		while (parts < 3)
+		{
+			size_t digits = 0;
+			while ((i < gtid.length()) && isdigit(static_cast<unsigned char>(gtid[i]))) i++, digits++;
+			if ((digits == 0) || (digits > 20)) return false;
+			if (++parts < 3)
+			{
+				if ((i == gtid.length()) || (gtid[i] != '-')) return false;
+				i++;
+			}
+		}
+		return i == gtid.length();
+	}
+
+	void BinlogStream::StartAtGtid(const std::string &gtidPosition)
+	{
+		gtids.clear();
+		size_t start = 0;
+		while (start < gtidPosition.length())
+		{
+			size_t comma = gtidPosition.find(',', start);
+			if (comma == std::string::npos) comma = gtidPosition.length();
+			std::string gtid = gtidPosition.substr(start, comma - start);
+			size_t first = gtid.find_first_not_of(" \t"), last = gtid.find_last_not_of(" \t");
+			gtid = (first == std::string::npos) ? std::string() : gtid.substr(first, last - first + 1);
+			if (!IsGtid(gtid)) throw std::runtime_error("BinlogStream : bad GTID '" + gtid + "'");
+			gtids[static_cast<uint32_t>(std::stoul(gtid))] = gtid;
+			start = comma + 1;
+		}
+		file.clear();
+		position = 4;
+		useGtid = true;
+	}
+
+	std::string BinlogStream::Gtid() const
+	{
+		std::string ret;
+		for (auto &kvp : gtids)
+		{
+			if (!ret.empty()) ret += ',';
+			ret += kvp.second;
+		}
+		return ret;
+	}
+
+	void BinlogStream::Watch(const std::string &database, const std::string &table)
+	{
+		watched.emplace_back(database, table);
+	}
+
+	bool BinlogStream::Watched(const BinlogTable &table) const
+	{
+		if (watched.empty()) return true;
+		for (auto &w : watched)
+			if (w.first == table.database && w.second == table.name) return true;
+		return false;
+	}
+
+	// column types and per type metadata of a TABLE_MAP event
+	std::shared_ptr<const BinlogTable> BinlogStream::MapTable(const MARIADB_RPL_EVENT &ev)
+	{
+		const st_mariadb_rpl_table_map_event &tm = ev.event.table_map;
+		std::shared_ptr<BinlogTable> table = std::make_shared<BinlogTable>();
+		table->database.assign(tm.database.str, tm.database.length);
+		table->name.assign(tm.table.str, tm.table.length);
+		table->types.assign(tm.column_types.str, tm.column_types.str + tm.column_types.length);
+		table->meta.assign(table->types.size(), 0);
+
+		const uint8_t *p = reinterpret_cast<const uint8_t*>(tm.metadata.str), *end = p + tm.metadata.length;
+		for (size_t i = 0; i < table->types.size(); i++)
+		{
+			uint8_t &type = table->types[i];
+			uint16_t &meta = table->meta[i];
+			switch (type)
+			{
+			case MYSQL_TYPE_FLOAT:
+			case MYSQL_TYPE_DOUBLE:
+			case MYSQL_TYPE_BLOB:
+			case MYSQL_TYPE_GEOMETRY:
+			case MYSQL_TYPE_JSON:
+			case MYSQL_TYPE_TIME2:
+			case MYSQL_TYPE_DATETIME2:
+			case MYSQL_TYPE_TIMESTAMP2:
+				Need(p, end, 1);
+				meta = *p++;
+				break;
+			case MYSQL_TYPE_VARCHAR:
+			case MYSQL_TYPE_VAR_STRING:
+			case MYSQL_TYPE_BIT:
+			case MYSQL_TYPE_NEWDECIMAL:
+				Need(p, end, 2);
+				meta = static_cast<uint16_t>(LittleEndian(p, 2));
+				p += 2;
+				break;
+			case MYSQL_TYPE_STRING:
+			case MYSQL_TYPE_ENUM:
+			case MYSQL_TYPE_SET:
+			{
+				// real type and length; CHAR longer than 255 keeps the high length bits in the type byte
+				Need(p, end, 2);
+				uint8_t real = p[0], len = p[1];
+				p += 2;
+				if ((real & 0x30) != 0x30)
+				{
+					meta = static_cast<uint16_t>(len | (((real & 0x30) ^ 0x30) << 4));
+					real |= 0x30;
+				}
+				else meta = len;
+				type = real;
+				break;
+			}
+			default:
+				break;
+			}
+		}
+		tables[tm.table_id] = table;
+		return table;
+	}
+
+	void BinlogStream::DecodeRows(const MARIADB_RPL_EVENT &ev, const std::string &gtid, std::vector<BinlogChange> &out)
+	{
+		const st_mariadb_rpl_rows_event &rows = ev.event.rows;
+		auto it = tables.find(rows.table_id);
+		if (it == tables.end()) throw std::runtime_error("BinlogStream : row event for an unmapped table " + std::to_string(rows.table_id));
+		const std::shared_ptr<const BinlogTable> &table = it->second;
+		if (!Watched(*table)) return;
+		if (rows.column_count != table->types.size()) throw std::runtime_error("BinlogStream : column count mismatch for " + table->database + "." + table->name);
+
+		BinlogChange::Kind kind;
+		switch (ev.event_type)
+		{
+		case WRITE_ROWS_EVENT_V1:
+		case WRITE_ROWS_EVENT:
+			kind = BinlogChange::Kind::Insert;
+			break;
+		case UPDATE_ROWS_EVENT_V1:
+		case UPDATE_ROWS_EVENT:
+			kind = BinlogChange::Kind::Update;
+			break;
+		default:
+			kind = BinlogChange::Kind::Delete;
+			break;
+		}
+
+		TmDateTime when = TmDateTime::FromStdTime(static_cast<std::time_t>(ev.timestamp));
+		const uint8_t *p = static_cast<const uint8_t*>(rows.row_data), *end = p + rows.row_data_size;
+		while (p < end)
+		{
+			out.emplace_back();
+			BinlogChange &ch = out.back();
+			ch.kind = kind;
+			ch.table = table;
+			ch.when = when;
+			ch.gtid = gtid;
+			BinlogRow &first = (kind == BinlogChange::Kind::Insert) ? ch.after : ch.before;
+			first.Decode(*table, rows.column_bitmap, p, end);
+			if (kind == BinlogChange::Kind::Update) ch.after.Decode(*table, rows.column_update_bitmap, p, end);
+		}
+	}
+
+	void BinlogStream::Run(const std::function<bool(std::vector<BinlogChange>&)> &onBatch, size_t maxBatch, uint32_t maxDelayMilliseconds)
+	{
+		stop = false;
+		tables.clear();
+
+		// checksummed events are verified and stripped by the connector; heartbeats (in ns) wake an idle stream
+		conn.ExecuteNonQuery("SET @master_binlog_checksum = @@global.binlog_checksum");
+		conn.ExecuteNonQuery("SET @mariadb_slave_capability = 4");
+		uint64_t heartbeat = (maxDelayMilliseconds < 100 ? 100 : maxDelayMilliseconds) * 1000000ULL;
+		conn.ExecuteNonQuery("SET @master_heartbeat_period = " + std::to_string(heartbeat));
+		if (useGtid)
+		{
+			std::string state = Gtid();
+			conn.ExecuteNonQuery("SET @slave_connect_state = '" + state + "'");
+			conn.ExecuteNonQuery("SET @slave_gtid_strict_mode = 0");
+			conn.ExecuteNonQuery("SET @slave_gtid_ignore_duplicates = 0");
+		}
+
+		std::unique_ptr<MARIADB_RPL, void(*)(MARIADB_RPL*)> rpl(mariadb_rpl_init(conn.mysql), mariadb_rpl_close);
+		if (!rpl) throw std::runtime_error("BinlogStream : mariadb_rpl_init failed");
+		mariadb_rpl_optionsv(rpl.get(), MARIADB_RPL_SERVER_ID, serverId);
+		mariadb_rpl_optionsv(rpl.get(), MARIADB_RPL_FILENAME, useGtid ? "" : file.c_str(), useGtid ? static_cast<size_t>(0) : file.length());
+		mariadb_rpl_optionsv(rpl.get(), MARIADB_RPL_START, static_cast<unsigned long>(useGtid ? 4 : position));
+		mariadb_rpl_optionsv(rpl.get(), MARIADB_RPL_FLAGS, 0u);
+		if (mariadb_rpl_open(rpl.get()) != 0) throw std::runtime_error(std::string("BinlogStream : ").append(mysql_error(conn.mysql)));
+
+		std::unique_ptr<MARIADB_RPL_EVENT, void(*)(MARIADB_RPL_EVENT*)> ev(nullptr, mariadb_free_rpl_event);
+		std::string curFile = file, gtid;
+		uint64_t curPos = position;
+		uint32_t gtidDomain = 0;
+		bool standalone = false;
+
+		std::vector<BinlogChange> group, ready;		// current transaction, committed and not delivered
+		std::string readyFile;
+		uint64_t readyPos = 0;
+		std::map<uint32_t, std::string> readyGtids = gtids;
+		std::chrono::steady_clock::time_point readySince;
+		std::chrono::milliseconds maxDelay(maxDelayMilliseconds);
+
+		while (!stop)
+		{
+			MARIADB_RPL_EVENT *next = mariadb_rpl_fetch(rpl.get(), ev.get());
+			if (next == nullptr)
+			{
+				if (stop) break;
+				throw std::runtime_error(std::string("BinlogStream : ").append(mysql_error(conn.mysql)));
+			}
+			ev.release();
+			ev.reset(next);
+
+			bool groupEnd = false;
+			switch (next->event_type)
+			{
+			case ROTATE_EVENT:
+				curFile.assign(next->event.rotate.filename.str, next->event.rotate.filename.length);
+				curPos = next->event.rotate.position;
+				break;
+			case GTID_EVENT:
+				gtidDomain = next->event.gtid.domain_id;
+				gtid = std::to_string(gtidDomain) + "-" + std::to_string(next->server_id) + "-" + std::to_string(next->event.gtid.sequence_nr);
+				standalone = (next->event.gtid.flags & 1) != 0;		// FL_STANDALONE: DDL, no COMMIT follows
+				break;
+			case TABLE_MAP_EVENT:
+				MapTable(*next);
+				break;
+			case WRITE_ROWS_EVENT_V1:
+			case UPDATE_ROWS_EVENT_V1:
+			case DELETE_ROWS_EVENT_V1:
+			case WRITE_ROWS_EVENT:
+			case UPDATE_ROWS_EVENT:
+			case DELETE_ROWS_EVENT:
+				DecodeRows(*next, gtid, group);
+				break;
+			case XID_EVENT:
+				groupEnd = true;
+				break;
+			case QUERY_EVENT:
+			{
+				std::string stmt(next->event.query.statement.str, next->event.query.statement.length);
+				groupEnd = standalone || stmt == "COMMIT" || stmt == "ROLLBACK";
+				break;
+			}
+			default:
+				break;
+			}
+			if (next->event_type != ROTATE_EVENT && next->event_type != HEARTBEAT_LOG_EVENT && next->next_event_pos != 0) curPos = next->next_event_pos;
+
+			if (groupEnd)
+			{
+				if (!gtid.empty()) readyGtids[gtidDomain] = gtid;
+				readyFile = curFile;
+				readyPos = curPos;
+				if (ready.empty()) readySince = std::chrono::steady_clock::now();
+				for (auto &ch : group) ready.push_back(std::move(ch));
+				group.clear();
+				gtid.clear();
+				standalone = false;
+				if (ready.empty())
+				{
+					// nothing watched in this transaction: only the resume point moves
+					file = readyFile;
+					position = readyPos;
+					gtids = readyGtids;
+				}
+			}
+
+			if (ready.empty()) continue;
+			if (ready.size() < maxBatch && std::chrono::steady_clock::now() - readySince < maxDelay) continue;
+
+			bool more = onBatch(ready);
+			ready.clear();
+			file = readyFile;
+			position = readyPos;
+			gtids = readyGtids;
+			if (!more) break;
+		}
+	}
+}
@@ -0,0 +1,180 @@
+/*
+Site:		http://hlspx.ocry.com/mysqlconnestion/
+
+History:
+			VERSION
+			1.0.0.0
+Author:
+		Alexey Tretyakov	hlspx@mail.ru
+*/
+
+#pragma once
+
+#include "MySqlConnection.h"
+
+#include <cstring>
+#include <functional>
+#include <mariadb/mariadb_rpl.h>
+
+namespace Kiff {
+
+	// table as described by the last TABLE_MAP event; shared by the changes of a batch
+	struct BinlogTable
+	{
+		std::string database;
+		std::string name;
+		std::vector<uint8_t> types;			// enum_field_types as logged (real type for STRING columns)
+		std::vector<uint16_t> meta;			// per column metadata: length, precision/scale, fsp
+	};
+
+	//////////////////////////////////////////////////////////////
+	// Row image of a row event. Values are kept the way MySqlDataReader keeps them:
+	// integers at their native width (signedness is not logged, choose it in GetFieldValue),
+	// temporal columns as MYSQL_TIME (TIMESTAMP in UTC), DECIMAL as text, the rest as bytes.
+	class BinlogRow
+	{
+		friend class BinlogStream;
+
+		struct Column
+		{
+			MySqlDbType type = MySqlDbType::Unspecified;
+			bool present = false;		// binlog_row_image=MINIMAL leaves columns out
+			bool is_null = true;
+			uint32_t offset = 0;
+			uint32_t length = 0;
+		};
+
+		std::vector<Column> columns;
+		std::string data;
+
+		template<typename T>
+		void GetRefValue(uint32_t pos, T& value) const
+		{
+			value = GetFieldValue<T>(pos);
+		}
+
+		void GetRefValues(uint32_t) const {}
+
+		template<typename T, typename... Targs>
+		void GetRefValues(uint32_t pos, T&& val, Targs&& ... Fargs) const
+		{
+			GetRefValue(pos, val);
+			GetRefValues(++pos, Fargs...);
+		}
+
+		const Column &Value(uint32_t pos, const char *where) const;
+		void Decode(const BinlogTable &table, const unsigned char *bitmap, const uint8_t *&p, const uint8_t *end);
+	public:
+		uint32_t FieldCount() const { return static_cast<uint32_t>(columns.size()); }
+
+		bool IsPresent(uint32_t pos) const
+		{
+			if (pos >= columns.size()) throw std::runtime_error("BinlogRow:: Wrong param index '" + std::to_string(pos) + "' in IsPresent");
+			return columns[pos].present;
+		}
+
+		// columns missing from the image read as NULL
+		bool IsNull(uint32_t pos) const
+		{
+			if (pos >= columns.size()) throw std::runtime_error("BinlogRow:: Wrong param index '" + std::to_string(pos) + "' in IsNull");
+			return columns[pos].is_null;
+		}
+
+		MySqlDbType GetFieldType(uint32_t pos) const
+		{
+			if (pos >= columns.size()) throw std::runtime_error("BinlogRow:: Wrong param index '" + std::to_string(pos) + "' in GetFieldType");
+			return columns[pos].type;
+		}
+
+		template<typename T>
+		T GetFieldValue(uint32_t pos) const
+		{
+			const Column &col = Value(pos, "GetFieldValue");
+			T value = T();
+			std::memcpy(&value, data.data() + col.offset, (col.length < sizeof(T)) ? col.length : sizeof(T));
+			return value;
+		}
+
+		void GetFieldValue(uint32_t pos, const void **obuf, uint32_t *olen) const
+		{
+			const Column &col = Value(pos, "GetFieldValue");
+			*obuf = data.data() + col.offset;
+			*olen = col.length;
+		}
+
+		template<typename... Targs>
+		void GetValues(Targs&& ... Fargs) const
+		{
+			GetRefValues(0, Fargs...);
+		}
+	};
+
+	template<>
+	std::string BinlogRow::GetFieldValue<std::string>(uint32_t pos) const;
+	template<>
+	std::vector<uint8_t> BinlogRow::GetFieldValue<std::vector<uint8_t>>(uint32_t pos) const;
+	template<>
+	TmDateTime BinlogRow::GetFieldValue<TmDateTime>(uint32_t pos) const;
+	template<>
+	Decimal BinlogRow::GetFieldValue<Decimal>(uint32_t pos) const;
+
+	struct BinlogChange
+	{
+		enum class Kind { Insert, Update, Delete };
+
+		Kind kind;
+		std::shared_ptr<const BinlogTable> table;
+		BinlogRow before;				// Update, Delete
+		BinlogRow after;				// Insert, Update
+		TmDateTime when;				// event time
+		std::string gtid;				// domain-server-sequence of the transaction, empty without GTID
+	};
+
+	//////////////////////////////////////////////////////////////
+	// Change data capture: registers as a replica (COM_BINLOG_DUMP through mariadb_rpl_*),
+	// decodes ROWS events and hands them to a callback in batches of whole transactions.
+	// Needs binlog_format=ROW, REPLICATION SLAVE privilege and Connector/C 3.3 or later.
+	class BinlogStream
+	{
+		MySqlConnection conn;
+		uint32_t serverId;
+		std::string file;				// where the next Run starts; advanced at each delivered batch
+		uint64_t position = 4;
+		std::map<uint32_t, std::string> gtids;		// domain -> last GTID
+		bool useGtid = false;
+		std::vector<std::pair<std::string, std::string>> watched;
+		std::atomic<bool> stop{ false };
+
+		std::map<uint64_t, std::shared_ptr<const BinlogTable>> tables;		// table id -> map
+
+		BinlogStream(const BinlogStream&) = delete;
+		bool Watched(const BinlogTable &table) const;
+		std::shared_ptr<const BinlogTable> MapTable(const MARIADB_RPL_EVENT &ev);
+		void DecodeRows(const MARIADB_RPL_EVENT &ev, const std::string &gtid, std::vector<BinlogChange> &out);
+	public:
+		// serverId must be unique among the replicas of the server
+		BinlogStream(const std::string &connStr, uint32_t serverId);
+
+		// start from a binlog file and offset (SHOW MASTER STATUS)
+		void StartAt(const std::string &binlogFile, uint64_t binlogPosition);
+
+		// start after a GTID position, e.g. "0-1-100" (@@gtid_binlog_pos); the latest one is kept while running
+		void StartAtGtid(const std::string &gtidPosition);
+
+		// only deliver changes of these tables; everything if never called
+		void Watch(const std::string &database, const std::string &table);
+
+		// Blocks and delivers batches until onBatch returns false or Stop is called.
+		// A batch is flushed at a transaction end once it has maxBatch changes or its first
+		// change is maxDelayMilliseconds old; heartbeats keep the delay honoured when idle.
+		void Run(const std::function<bool(std::vector<BinlogChange>&)> &onBatch, size_t maxBatch = 1000, uint32_t maxDelayMilliseconds = 100);
+
+		// from any thread; Run returns at the next event or heartbeat
+		void Stop() { stop = true; }
+
+		// resume point after the last delivered batch
+		const std::string &File() const { return file; }
+		uint64_t Position() const { return position; }
+		std::string Gtid() const;
+	};
+}
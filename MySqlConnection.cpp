@@ -1,4 +1,11 @@
 #include "MySqlConnection.h"
+#include "MySqlExplain.h"
+#include "MySqlPrefetch.h"
+#include "MySqlSpill.h"
+#include "MySqlWatchdog.h"
+#include "MySqlWorkload.h"
+#include <mariadb/errmsg.h>
+#include <mariadb/mysqld_error.h>
 #include <regex>
 
 #ifdef _WIN32
@@ -55,10 +62,42 @@ namespace Kiff {
 		{"user id",			"uid"},
 		{"username",		"uid"},
 		{"user name",		"uid"},
-		{"socket",			"socket"}
+		{"socket",			"socket"},
+		{"read timeout",	"read timeout"},
+		{"write timeout",	"write timeout"},
+		{"command timeout",	"command timeout"},
+		{"default command timeout",	"command timeout"}
 	};
 
+	// error text with the reason the watchdog interrupted the statement
+	static std::string Interrupted(std::string err, MySqlWatchdog::Outcome outcome)
+	{
+		if (outcome == MySqlWatchdog::Outcome::TimedOut) err.append(" (deadline exceeded)");
+		else if (outcome == MySqlWatchdog::Outcome::Cancelled) err.append(" (cancelled)");
+		return err;
+	}
+
+	// err == nullptr - the caller wants the exception, otherwise it goes to a Try* result
+	static bool Fail(MySqlError *err, MySqlError &&failure)
+	{
+		if (err == nullptr) throw std::runtime_error(failure.message);
+		*err = std::move(failure);
+		return false;
+	}
+
+	static MySqlError StmtError(MYSQL_STMT *stmt, std::string message)
+	{
+		unsigned int code = mysql_stmt_errno(stmt);
+		return MySqlError(code, (code != 0) ? mysql_stmt_sqlstate(stmt) : "HY000", std::move(message));
+	}
+
+	static MySqlError ConnError(MYSQL *mysql, std::string message)
+	{
+		return MySqlError(mysql_errno(mysql), mysql_sqlstate(mysql), std::move(message));
+	}
+
 	MySqlConnection::MySqlConnection(const std::string & ConnStr)
+		:connStr(ConnStr)
 	{
 		if (connCnt == 0)  mysql_library_init(0, NULL, NULL);
 		connCnt++;
@@ -72,6 +111,27 @@ namespace Kiff {
 		bool recFlg = 1;
 		if (mysql_options(mysql, MYSQL_OPT_RECONNECT, &recFlg)) throw std::runtime_error("MYSQL_OPT_RECONNECT");
 
+		// network timeouts, seconds
+		if (connMap.find("read timeout") != connMap.end())
+		{
+			unsigned int sec = std::stoi(connMap["read timeout"]);
+			if (mysql_options(mysql, MYSQL_OPT_READ_TIMEOUT, &sec)) throw std::runtime_error("MYSQL_OPT_READ_TIMEOUT");
+		}
+		if (connMap.find("write timeout") != connMap.end())
+		{
+			unsigned int sec = std::stoi(connMap["write timeout"]);
+			if (mysql_options(mysql, MYSQL_OPT_WRITE_TIMEOUT, &sec)) throw std::runtime_error("MYSQL_OPT_WRITE_TIMEOUT");
+		}
+		if (connMap.find("command timeout") != connMap.end())
+			timeout = std::chrono::seconds(std::stoi(connMap["command timeout"]));
+
+		// charset goes with the handshake instead of a SET NAMES round trip
+		if (connMap.find("charset") != connMap.end())
+		{
+			charset = connMap["charset"];
+			if (mysql_options(mysql, MYSQL_SET_CHARSET_NAME, charset.c_str())) throw std::runtime_error("MYSQL_SET_CHARSET_NAME");
+		}
+
 		if (!mysql_real_connect(mysql,
 			(connMap.find("host") == connMap.end()) ? NULL : connMap["host"].c_str(),
 			(connMap.find("uid") == connMap.end()) ? NULL : connMap["uid"].c_str(),
@@ -79,13 +139,10 @@ namespace Kiff {
 			(connMap.find("database") == connMap.end()) ? NULL : connMap["database"].c_str(),
 			(connMap.find("port") == connMap.end()) ? 0 : std::stoi(connMap["port"]),
 			(connMap.find("socket") == connMap.end()) ? NULL : connMap["socket"].c_str(),
-			CLIENT_MULTI_STATEMENTS | CLIENT_MULTI_RESULTS))
+			CLIENT_MULTI_STATEMENTS | CLIENT_MULTI_RESULTS | CLIENT_SESSION_TRACKING))
 			throw std::runtime_error(std::string("mysql_real_connect : ") + mysql_error(mysql));
-		
-		if (connMap.find("charset") != connMap.end())
-		{
-			ExecuteNonQuery("SET NAMES " + connMap["charset"]);
-		}
+		threadId = mysql_thread_id(mysql);
+		if (connMap.find("database") != connMap.end()) database = connMap["database"];
 	}
 
 	std::map<std::string, std::string> MySqlConnection::ParseConnStr(const std::string & str)
@@ -121,19 +178,109 @@ namespace Kiff {
 	MySqlConnection::~MySqlConnection()
 	{
 		if (mysql == nullptr) return;
+		while (commands != nullptr)
+		{
+			MySqlCommand *cmd = commands;
+			cmd->Unlink();
+			cmd->conn = nullptr;
+		}
 		mysql_close(mysql);
 		mysql_thread_end();
 		connCnt--;
 		//if (connCnt == 0)  mysql_library_end();
 	}
 
-	size_t MySqlConnection::ExecuteNonQuery(const std::string &query)
+	// numbers as is, anything else as a string literal escaped for the session's sql_mode
+	static std::string Literal(MYSQL *mysql, const std::string &value)
 	{
-		if (mysql_query(mysql, query.c_str()))
+		size_t i = (!value.empty() && (value[0] == '-')) ? 1 : 0;
+		bool number = true, point = false, digits = false;
+		for (; number && (i < value.length()); i++)
+		{
+			if ((value[i] == '.') && !point) point = true;
+			else if (isdigit(static_cast<unsigned char>(value[i]))) digits = true;
+			else number = false;
+		}
+		if (number && digits) return value;
+
+		std::string ret(value.length() * 2 + 3, '\'');
+		unsigned long n = mysql_real_escape_string(mysql, &ret[1], value.data(), static_cast<unsigned long>(value.length()));
+		if (n == (unsigned long)-1) throw std::runtime_error("SetVariable : can't escape '" + value + "'");
+		ret.resize(n + 2);
+		ret[n + 1] = '\'';
+		return ret;
+	}
+
+	// one SET for autocommit (-1 - unchanged) and session variables, "" if there is nothing to set
+	static std::string SessionStatement(MYSQL *mysql, int autocommit, const std::map<std::string, std::string> &vars)
+	{
+		std::string query;
+		if (autocommit >= 0) query.append((autocommit != 0) ? "autocommit=1" : "autocommit=0");
+		for (const auto &v : vars)
+		{
+			if (!query.empty()) query.append(", ");
+			query.append("@@session.").append(v.first).append("=").append(Literal(mysql, v.second));
+		}
+		return query.empty() ? query : "SET " + query;
+	}
+
+	// the server session changed under the client: restore charset and database,
+	// mark prepared commands stale; true if a reconnect happened since the last check
+	bool MySqlConnection::Reconnected()
+	{
+		unsigned long tid = mysql_thread_id(mysql);
+		if (tid == threadId) return false;
+		threadId = tid;
+
+		if (!charset.empty() && (charset != mysql_character_set_name(mysql)) && mysql_set_character_set(mysql, charset.c_str()))
+			throw std::runtime_error(std::string(charset).append(" mysql_set_character_set : ").append(mysql_error(mysql)));
+		if (!database.empty() && mysql_select_db(mysql, database.c_str()))
+			throw std::runtime_error(std::string(database).append(" mysql_select_db : ").append(mysql_error(mysql)));
+
+		// in a transaction nothing commits until the transaction object ends
+		std::string query = SessionStatement(mysql, (inTransaction || !autocommit) ? 0 : -1, variables);
+		if (!query.empty() && mysql_real_query(mysql, query.data(), static_cast<unsigned long>(query.length())))
 			throw std::runtime_error(std::string(query).append(" mysql_query : ").append(mysql_error(mysql)));
 
+		for (MySqlCommand *cmd = commands; cmd != nullptr; cmd = cmd->nextCmd) cmd->stale = true;
+		return true;
+	}
+
+	size_t MySqlConnection::ExecuteNonQuery(const std::string &query)
+	{
 		size_t affRws = 0;
+		Query(query, affRws, nullptr);
+		return affRws;
+	}
+
+	MySqlResult<size_t> MySqlConnection::TryExecuteNonQuery(const std::string &query)
+	{
+		size_t affRws = 0;
+		MySqlError err;
+		if (!Query(query, affRws, &err)) return err;
+		return affRws;
+	}
+
+	bool MySqlConnection::Query(const std::string &query, size_t &affRws, MySqlError *err)
+	{
+		if (Reconnected() && inTransaction)
+			return Fail(err, MySqlError(CR_SERVER_LOST, "08S01", std::string(query).append(" : connection was reset, transaction is lost")));
+		if (SessionPending()) ApplySession();
+
+		std::chrono::steady_clock::time_point start;
+		if (explain || workload) start = std::chrono::steady_clock::now();
+
+		WatchdogTicket wd;
+		wd.Arm(running, connStr, threadId, timeout);
+		if (mysql_query(mysql, query.c_str()))
+		{
+			if (workload) workload->Record(workloadSession, query, nullptr, 0, start, true);
+			std::string msg = std::string(query).append(" mysql_query : ").append(mysql_error(mysql));
+			return Fail(err, ConnError(mysql, Interrupted(msg, wd.Disarm())));
+		}
+
 		MYSQL_RES *result = nullptr;
+		int rc;
 
 		do
 		{
@@ -148,32 +295,348 @@ namespace Kiff {
 			{
 				affRws += (size_t)mysql_affected_rows(mysql);
 			}
-		} while (!mysql_next_result(mysql));
+		} while ((rc = mysql_next_result(mysql)) == 0);
 
-		return affRws;
+		if (rc > 0)
+		{
+			if (workload) workload->Record(workloadSession, query, nullptr, 0, start, true);
+			std::string msg = std::string(query).append(" mysql_next_result : ").append(mysql_error(mysql));
+			return Fail(err, ConnError(mysql, Interrupted(msg, wd.Disarm())));
+		}
+		wd.Disarm();
+		Track();
+		if (workload) workload->Record(workloadSession, query, nullptr, 0, start, false);
+
+		if (explain)
+		{
+			std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+			if (explain->IsSlow(elapsed)) explain->Capture(query, std::vector<ExplainParam>(), elapsed);
+		}
+		return true;
 	}
 
-	MySqlDataReader *MySqlConnection::ExecuteReader(const std::string & query)
+	MySqlDataReader MySqlConnection::ExecuteReader(const std::string & query)
 	{
-		MySqlCommand *cmd = CreateCommand(query);
-		MySqlDataReader *rd = cmd->ExecuteReader();
-		rd->rdCmd = cmd;
+		MySqlCommand cmd = CreateCommand(query);
+		return DetachReader(cmd);
+	}
+
+	MySqlResult<MySqlCommand> MySqlConnection::TryCreateCommand(const std::string &query)
+	{
+		MySqlError err;
+		MySqlCommand cmd(this, query.c_str(), &err);
+		if (cmd.smnt == nullptr) return err;
+		cmd.explain = explain;
+		cmd.readerOptions = readerOptions;
+		return cmd;
+	}
+
+	MySqlResult<MySqlDataReader> MySqlConnection::TryExecuteReader(const std::string &query)
+	{
+		MySqlResult<MySqlCommand> cmd = TryCreateCommand(query);
+		if (!cmd) return cmd.Error();
+		return TryDetachReader(cmd.Value());
+	}
+
+	// execute cmd and hand its statement over to the reader; cmd keeps nothing to close
+	MySqlDataReader MySqlConnection::DetachReader(MySqlCommand &cmd)
+	{
+		MySqlDataReader rd = cmd.ExecuteReader();
+		rd.ownSmnt = true;
+		cmd.smnt = nullptr;
+		return rd;
+	}
+
+	MySqlResult<MySqlDataReader> MySqlConnection::TryDetachReader(MySqlCommand &cmd)
+	{
+		MySqlResult<MySqlDataReader> rd = cmd.TryExecuteReader();
+		if (rd)
+		{
+			rd.Value().ownSmnt = true;
+			cmd.smnt = nullptr;
+		}
 		return rd;
 	}
 
+	void MySqlConnection::SetResultBudget(uint64_t bytes)
+	{
+		if (!readerOptions.budget) readerOptions.budget = std::make_shared<ResultBudget>();
+		readerOptions.budget->SetLimit(bytes);
+	}
+
+	void MySqlConnection::SetProcessResultBudget(uint64_t bytes)
+	{
+		ResultBudget::Process().SetLimit(bytes);
+	}
+
 	void MySqlConnection::ChangeDatabase(const std::string &db)
 	{
+		if (db == database) return;
 		if (mysql_select_db(mysql, db.c_str()))
 			throw std::runtime_error(std::string(db).append(" mysql_select_db : ").append(mysql_error(mysql)));
+		database = db;
+	}
+
+	// `name` with backticks doubled
+	std::string MySqlConnection::QuoteIdentifier(const std::string &name)
+	{
+		std::string ret("`");
+		for (char c : name)
+		{
+			if (c == '`') ret += '`';
+			ret += c;
+		}
+		return ret += '`';
+	}
+
+	MySqlTransaction MySqlConnection::BeginTransaction()
+	{
+		if (inTransaction) throw std::runtime_error("BeginTransaction : transaction is already active");
+		if (SessionPending()) ApplySession();
+		if (autocommit && mysql_autocommit(mysql, 0))
+			throw std::runtime_error(std::string("mysql_autocommit : ").append(mysql_error(mysql)));
+		inTransaction = true;
+		return MySqlTransaction(mysql, &inTransaction, autocommit);
+	}
+
+	void MySqlConnection::SetCharset(const std::string &name)
+	{
+		if (name == (pendingCharset.empty() ? charset : pendingCharset)) return;
+		pendingCharset = (name == charset) ? std::string() : name;
+	}
+
+	void MySqlConnection::SetAutocommit(bool on)
+	{
+		if (inTransaction) throw std::runtime_error("SetAutocommit : transaction is active");
+		pendingAutocommit = (on == autocommit) ? -1 : (on ? 1 : 0);
+	}
+
+	void MySqlConnection::SetVariable(const std::string &name, const std::string &value)
+	{
+		std::string key(name);
+		for (char &c : key)
+		{
+			if (!isalnum(static_cast<unsigned char>(c)) && (c != '_')) throw std::runtime_error("SetVariable : bad variable name '" + name + "'");
+			c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+		}
+		if (key.empty() || (key == "autocommit")) throw std::runtime_error("SetVariable : bad variable name '" + name + "'");
+
+		auto it = variables.find(key);
+		if ((it != variables.end()) && (it->second == value)) pending.erase(key);
+		else pending[key] = value;
+	}
+
+	const std::string &MySqlConnection::Variable(const std::string &name) const
+	{
+		static const std::string none;
+		std::string key(name);
+		std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+		auto it = variables.find(key);
+		return (it == variables.end()) ? none : it->second;
+	}
+
+	// pending changes: the charset by mysql_set_character_set (client side escaping follows it), the rest in one SET
+	void MySqlConnection::ApplySession()
+	{
+		if (!pendingCharset.empty())
+		{
+			std::string cs;
+			cs.swap(pendingCharset);
+			if (mysql_set_character_set(mysql, cs.c_str()))
+				throw std::runtime_error(std::string(cs).append(" mysql_set_character_set : ").append(mysql_error(mysql)));
+			mysql_options(mysql, MYSQL_SET_CHARSET_NAME, cs.c_str());		// handshake of a reconnect
+			charset = cs;
+		}
+		if ((pendingAutocommit < 0) && pending.empty()) return;
+
+		int ac = pendingAutocommit;
+		std::map<std::string, std::string> vars;
+		vars.swap(pending);
+		pendingAutocommit = -1;
+
+		std::string query = SessionStatement(mysql, ac, vars);
+		if (mysql_real_query(mysql, query.data(), static_cast<unsigned long>(query.length())))
+			throw std::runtime_error(std::string(query).append(" mysql_query : ").append(mysql_error(mysql)));
+		if (ac >= 0) autocommit = (ac != 0);
+		for (const auto &v : vars) variables[v.first] = v.second;
+		Track();
+	}
+
+	// session state changes reported in the last OK packet (CLIENT_SESSION_TRACKING)
+	void MySqlConnection::Track()
+	{
+		const char *data;
+		size_t len;
+		if (mysql_session_track_get_first(mysql, SESSION_TRACK_SCHEMA, &data, &len) == 0)
+			database.assign(data, len);
+		if (mysql_session_track_get_first(mysql, SESSION_TRACK_SYSTEM_VARIABLES, &data, &len) != 0) return;
+		do
+		{
+			std::string name(data, len);
+			if (mysql_session_track_get_next(mysql, SESSION_TRACK_SYSTEM_VARIABLES, &data, &len) != 0) break;
+			Tracked(name, std::string(data, len));
+		} while (mysql_session_track_get_next(mysql, SESSION_TRACK_SYSTEM_VARIABLES, &data, &len) == 0);
+	}
+
+	void MySqlConnection::Tracked(const std::string &name, const std::string &value)
+	{
+		if (name == "autocommit") autocommit = (value == "ON") || (value == "1");
+		else if (name == "character_set_client") charset = value;
+		else
+		{
+			auto it = variables.find(name);
+			if (it != variables.end()) it->second = value;
+		}
+	}
+
+	///////////////////////////////////////////
+	MySqlTransaction::MySqlTransaction(MySqlTransaction &&other) noexcept
+		:mysql(other.mysql), activeFlg(other.activeFlg), autocommit(other.autocommit)
+	{
+		other.mysql = nullptr;
+		other.activeFlg = nullptr;
+	}
+
+	MySqlTransaction& MySqlTransaction::operator=(MySqlTransaction &&other) noexcept
+	{
+		if (this != &other)
+		{
+			if (mysql != nullptr)
+			{
+				mysql_rollback(mysql);
+				End();
+			}
+			mysql = other.mysql;
+			activeFlg = other.activeFlg;
+			autocommit = other.autocommit;
+			other.mysql = nullptr;
+			other.activeFlg = nullptr;
+		}
+		return *this;
+	}
+
+	MySqlTransaction::~MySqlTransaction()
+	{
+		if (mysql == nullptr) return;
+		mysql_rollback(mysql);
+		End();
+	}
+
+	// back to autocommit mode
+	void MySqlTransaction::End()
+	{
+		if (autocommit) mysql_autocommit(mysql, 1);
+		*activeFlg = false;
+		mysql = nullptr;
+		activeFlg = nullptr;
+	}
+
+	void MySqlTransaction::Query(const std::string &query)
+	{
+		if (mysql == nullptr) throw std::runtime_error("MySqlTransaction:: transaction is not active");
+		if (mysql_real_query(mysql, query.data(), static_cast<unsigned long>(query.length())))
+			throw std::runtime_error(std::string(query).append(" mysql_query : ").append(mysql_error(mysql)));
+	}
+
+	void MySqlTransaction::Commit()
+	{
+		if (mysql == nullptr) throw std::runtime_error("MySqlTransaction:: transaction is not active");
+		if (mysql_commit(mysql))
+		{
+			std::string err = std::string("mysql_commit : ").append(mysql_error(mysql));
+			mysql_rollback(mysql);
+			End();
+			throw std::runtime_error(err);
+		}
+		End();
+	}
+
+	void MySqlTransaction::Rollback()
+	{
+		if (mysql == nullptr) throw std::runtime_error("MySqlTransaction:: transaction is not active");
+		if (mysql_rollback(mysql))
+		{
+			std::string err = std::string("mysql_rollback : ").append(mysql_error(mysql));
+			End();
+			throw std::runtime_error(err);
+		}
+		End();
+	}
+
+	void MySqlTransaction::Save(const std::string &name)
+	{
+		Query("SAVEPOINT " + MySqlConnection::QuoteIdentifier(name));
+	}
+
+	void MySqlTransaction::RollbackTo(const std::string &name)
+	{
+		Query("ROLLBACK TO SAVEPOINT " + MySqlConnection::QuoteIdentifier(name));
+	}
+
+	void MySqlTransaction::Release(const std::string &name)
+	{
+		Query("RELEASE SAVEPOINT " + MySqlConnection::QuoteIdentifier(name));
 	}
 
 	///////////////////////////////////////////
-	MySqlCommand::MySqlCommand(MYSQL * con, const char *query)
+	MySqlGroupCommit::MySqlGroupCommit(MySqlConnection &con, size_t imaxRows, uint32_t maxMilliseconds)
+		:conn(con), maxRows(imaxRows == 0 ? 1 : imaxRows), maxDelay(maxMilliseconds)
+	{
+	}
+
+	MySqlGroupCommit::~MySqlGroupCommit()
 	{
-		if (!(smnt = mysql_stmt_init(con)))
-			throw std::runtime_error("can't init smnt");
-		if (mysql_stmt_prepare(smnt, query, static_cast<unsigned long>(strlen(query))))
-			throw std::runtime_error(std::string(query).append(" MYSQL_STMT : ").append(mysql_stmt_error(smnt)));
+		try
+		{
+			Rollback();
+		}
+		catch (...)
+		{
+		}
+	}
+
+	MySqlCommand &MySqlGroupCommit::Prepare(const std::string &query)
+	{
+		auto it = commands.find(query);
+		if (it == commands.end())
+			it = commands.emplace(query, conn.CreateCommand(query)).first;
+		return it->second;
+	}
+
+	void MySqlGroupCommit::Begin()
+	{
+		if (trans.IsActive()) return;
+		trans = conn.BeginTransaction();
+		started = std::chrono::steady_clock::now();
+	}
+
+	void MySqlGroupCommit::Written()
+	{
+		pending++;
+		if ((pending >= maxRows) || (std::chrono::steady_clock::now() - started >= maxDelay))
+			Flush();
+	}
+
+	void MySqlGroupCommit::Flush()
+	{
+		if (!trans.IsActive()) return;
+		pending = 0;
+		trans.Commit();
+	}
+
+	void MySqlGroupCommit::Rollback()
+	{
+		if (!trans.IsActive()) return;
+		pending = 0;
+		trans.Rollback();
+	}
+
+	///////////////////////////////////////////
+	MySqlCommand::MySqlCommand(MySqlConnection *con, const char *query, MySqlError *err)
+		:query(query)
+	{
+		smnt = Prepare(con->mysql, err);
+		if (smnt == nullptr) return;
 
 		paramCount = mysql_stmt_param_count(smnt);
 		if (paramCount > 0)
@@ -190,19 +653,149 @@ namespace Kiff {
 				bindings[pos].buffer_type = MySqlDbType::Unspecified;
 			}
 		}
+		Link(con);
+	}
+
+	// nullptr if err takes the failure
+	MYSQL_STMT *MySqlCommand::Prepare(MYSQL *con, MySqlError *err)
+	{
+		MYSQL_STMT *stmt = mysql_stmt_init(con);
+		if (stmt == nullptr)
+		{
+			Fail(err, ConnError(con, "can't init smnt"));
+			return nullptr;
+		}
+		if (mysql_stmt_prepare(stmt, query.data(), static_cast<unsigned long>(query.length())))
+		{
+			MySqlError failure = StmtError(stmt, std::string(query).append(" MYSQL_STMT : ").append(mysql_stmt_error(stmt)));
+			mysql_stmt_close(stmt);
+			Fail(err, std::move(failure));
+			return nullptr;
+		}
+		return stmt;
+	}
+
+	// new handle in the current session; parameters are bound again by Execute
+	bool MySqlCommand::Reprepare(MySqlError *err)
+	{
+		MYSQL_STMT *stmt = Prepare(conn->mysql, err);
+		if (stmt == nullptr) return false;
+		if (mysql_stmt_param_count(stmt) != paramCount)
+		{
+			mysql_stmt_close(stmt);
+			return Fail(err, MySqlError(CR_UNKNOWN_ERROR, "HY000", std::string(query).append(" : parameter count changed on re-prepare")));
+		}
+		mysql_stmt_close(smnt);
+		smnt = stmt;
+		stale = false;
+		bound = false;
+		return true;
+	}
+
+	// execute failed: true if the statement never ran and was re-prepared for a retry;
+	// a failed re-prepare replaces failure with its own error
+	bool MySqlCommand::Recover(MySqlError &failure)
+	{
+		if (conn == nullptr) return false;
+
+		switch (mysql_stmt_errno(smnt))
+		{
+		case CR_SERVER_GONE_ERROR:
+		case CR_SERVER_LOST:
+			// outcome unknown - let the next Execute find the new session
+			mysql_ping(conn->mysql);
+			conn->Reconnected();
+			return false;
+		case CR_STMT_CLOSED:
+		case ER_UNKNOWN_STMT_HANDLER:
+			if (conn->Reconnected() && conn->inTransaction) return false;
+			return Reprepare(&failure);
+		default:
+			return false;
+		}
+	}
+
+	void MySqlCommand::Link(MySqlConnection *con)
+	{
+		conn = con;
+		prevCmd = nullptr;
+		nextCmd = con->commands;
+		if (nextCmd != nullptr) nextCmd->prevCmd = this;
+		con->commands = this;
+	}
+
+	void MySqlCommand::Unlink()
+	{
+		if (conn == nullptr) return;
+		if (prevCmd != nullptr) prevCmd->nextCmd = nextCmd;
+		else conn->commands = nextCmd;
+		if (nextCmd != nullptr) nextCmd->prevCmd = prevCmd;
+		prevCmd = nextCmd = nullptr;
+	}
+
+	MySqlCommand::MySqlCommand(MySqlCommand &&other) noexcept
+		:smnt(other.smnt), paramBind(other.paramBind), bindings(other.bindings), paramCount(other.paramCount),
+		query(std::move(other.query)), explain(std::move(other.explain)), stale(other.stale), bound(other.bound), timeout(other.timeout),
+		readerOptions(std::move(other.readerOptions))
+	{
+		MySqlConnection *con = other.conn;
+		other.Unlink();
+		other.conn = nullptr;
+		if (con != nullptr) Link(con);
+		other.smnt = nullptr;
+		other.paramBind = nullptr;
+		other.bindings = nullptr;
+		other.paramCount = 0;
+	}
+
+	MySqlCommand& MySqlCommand::operator=(MySqlCommand &&other) noexcept
+	{
+		if (this != &other)
+		{
+			Free();
+			smnt = other.smnt;
+			paramBind = other.paramBind;
+			bindings = other.bindings;
+			paramCount = other.paramCount;
+			query = std::move(other.query);
+			explain = std::move(other.explain);
+			stale = other.stale;
+			bound = other.bound;
+			timeout = other.timeout;
+			readerOptions = std::move(other.readerOptions);
+			MySqlConnection *con = other.conn;
+			other.Unlink();
+			other.conn = nullptr;
+			if (con != nullptr) Link(con);
+			other.smnt = nullptr;
+			other.paramBind = nullptr;
+			other.bindings = nullptr;
+			other.paramCount = 0;
+		}
+		return *this;
 	}
 
 	MySqlCommand::~MySqlCommand()
 	{
+		Free();
+	}
+
+	void MySqlCommand::Free()
+	{
+		Unlink();
+		conn = nullptr;
 		if (smnt != nullptr)
 		{
 			mysql_stmt_free_result(smnt);
 			mysql_stmt_close(smnt);
+			smnt = nullptr;
 		}
 		if (paramBind != nullptr)
 		{
 			delete[] paramBind;
 			delete[] bindings;
+			paramBind = nullptr;
+			bindings = nullptr;
 		}
 	}
 
@@ -212,6 +805,7 @@ namespace Kiff {
 		if (pos >= paramCount)	throw std::runtime_error("MySqlCommand:: Wrong param index '" + std::to_string(pos) + "' in BindParam");
 		
 		bindings[pos].buffer_type = type;
+		bound = false;
 
 		enum_field_types mysqlType = (enum_field_types)((int)type & 0xff);
 		bool is_unsigned = ((int)type & 0x200) != 0;
@@ -241,6 +835,7 @@ namespace Kiff {
 
 			paramBind[pos].buffer = bindings[pos].buffer;
 			paramBind[pos].buffer_length = bindings[pos].buffer_length;
+			bound = false;
 		}
 		if (bufLen == 8) memset(bindings[pos].buffer, 0, 8);					// malloc ||     MySqlDbType  ( int8_t-> Int64) (?)
 
@@ -252,13 +847,35 @@ namespace Kiff {
 
 	size_t MySqlCommand::ExecuteNonQuery()
 	{
-		Execute();
+		size_t affRws = 0;
+		NonQuery(affRws, nullptr);
+		return affRws;
+	}
 
+	MySqlResult<size_t> MySqlCommand::TryExecuteNonQuery()
+	{
 		size_t affRws = 0;
+		MySqlError err;
+		if (!NonQuery(affRws, &err)) return err;
+		return affRws;
+	}
+
+	MySqlResult<MySqlDataReader> MySqlCommand::TryExecuteReader()
+	{
+		MySqlError err;
+		if (!Execute(&err)) return err;
+		MySqlDataReader rd(smnt, readerOptions, false);
+		if (!rd.Bind(&err)) return err;
+		return rd;
+	}
+
+	bool MySqlCommand::NonQuery(size_t &affRws, MySqlError *err)
+	{
+		if (!Execute(err)) return false;
 
 		do
 		{
-			if (mysql_stmt_store_result(smnt)) throw std::runtime_error("ExecuteNonQuery : mysql_stmt_store_result failed");
+			if (mysql_stmt_store_result(smnt)) return Fail(err, StmtError(smnt, "ExecuteNonQuery : mysql_stmt_store_result failed"));
 
 			size_t nrws = (size_t)mysql_stmt_num_rows(smnt);
 			if (nrws > 0) affRws += nrws;
@@ -269,7 +886,7 @@ namespace Kiff {
 			}
 		} while (!mysql_stmt_next_result(smnt));
 
-		return affRws;
+		return true;
 	}
 
 	template<>
@@ -279,12 +896,32 @@ namespace Kiff {
 
 		if (bindings[pos].buffer_type == MySqlDbType::Unspecified)
 			BindParam(pos, MySqlDbType::DateTime);
-		tm intim = value.ToTm();
 
 		MYSQL_TIME mtim;
+		ToMySqlTime(value, mtim);
+		SetValue(pos, &mtim, sizeof(MYSQL_TIME));
+	}
+
+	// DECIMAL parameters travel as text
+	template<>
+	void MySqlCommand::SetValue(uint32_t pos, const Decimal& value)
+	{
+		if (pos >= paramCount)	throw std::runtime_error("MySqlCommand:: Wrong param index '" + std::to_string(pos) + "' in SetValue");
+
+		if (bindings[pos].buffer_type == MySqlDbType::Unspecified)
+			BindParam(pos, MySqlDbType::NewDecimal);
+
+		char buf[Decimal::MaxChars];
+		SetValue(pos, buf, value.Format(buf));
+	}
+
+	void ToMySqlTime(const TmDateTime &value, MYSQL_TIME &mtim)
+	{
+		tm intim = value.ToTm();
 
 		uint64_t mks = (std::abs(value.Ticks()) % 1000000000LL) / 1000;
 
+		memset(&mtim, 0, sizeof(MYSQL_TIME));
 		mtim.year = intim.tm_year + 1900;
 		mtim.month = intim.tm_mon + 1;
 		mtim.day = intim.tm_mday;
@@ -293,28 +930,108 @@ namespace Kiff {
 		mtim.second = intim.tm_sec;
 		mtim.second_part = (unsigned long)mks;
 		mtim.time_type = enum_mysql_timestamp_type::MYSQL_TIMESTAMP_DATETIME;
-
-		SetValue(pos, &mtim, sizeof(MYSQL_TIME));
 	}
 
-	void MySqlCommand::Execute()
+	bool MySqlCommand::Execute(MySqlError *err)
 	{
-		if (paramCount != 0)
+		if (smnt == nullptr) return Fail(err, MySqlError(CR_UNKNOWN_ERROR, "HY000", "MySqlCommand:: statement is closed"));
+		if (conn != nullptr)
+		{
+			if (conn->Reconnected() && conn->inTransaction)
+				return Fail(err, MySqlError(CR_SERVER_LOST, "08S01", std::string(query).append(" : connection was reset, transaction is lost")));
+			if (stale && !Reprepare(err)) return false;
+			if (conn->SessionPending()) conn->ApplySession();
+		}
+
+		std::chrono::steady_clock::time_point start;
+		if ((explain != nullptr) || ((conn != nullptr) && conn->workload)) start = std::chrono::steady_clock::now();
+
+		WatchdogTicket wd;
+		if (conn != nullptr)
+			wd.Arm(running, conn->connStr, conn->threadId, (timeout != 0) ? std::chrono::milliseconds(timeout) : conn->timeout);
+
+		// values are read through the bound pointers: only a new type, buffer or handle needs a bind
+		for (uint32_t i = 0; !bound && (i < paramCount); i++)
+		{
+			if ((bindings[i].buffer_type == MySqlDbType::Unspecified) && (bindings[i].is_null == false))
+				return Fail(err, MySqlError(CR_UNKNOWN_ERROR, "HY000", "Unspecified parametr in MySqlCommand"));
+		}
+		for (int attempt = 0; ; attempt++)
 		{
-			for (uint32_t i = 0; i < paramCount; i++)
+			if ((paramCount != 0) && !bound)
+			{
+				if (mysql_stmt_bind_param(smnt, paramBind))
+					return Fail(err, StmtError(smnt, std::string("mysql_stmt_bind_param : ").append(mysql_stmt_error(smnt))));
+				bound = true;
+			}
+			if (mysql_stmt_execute(smnt) == 0) break;
+
+			MySqlError failure = StmtError(smnt, std::string("mysql_stmt_execute : ").append(mysql_stmt_error(smnt)));
+			MySqlWatchdog::Outcome outcome = wd.Disarm();
+			if (outcome != MySqlWatchdog::Outcome::Completed)
+			{
+				CaptureWorkload(start, true);
+				failure.message = Interrupted(failure.message, outcome);
+				return Fail(err, std::move(failure));
+			}
+			if ((attempt != 0) || !Recover(failure))
 			{
-				if ((bindings[i].buffer_type == MySqlDbType::Unspecified) && (bindings[i].is_null == false))
-					throw std::runtime_error("Unspecified parametr in MySqlCommand");
+				CaptureWorkload(start, true);
+				return Fail(err, std::move(failure));
 			}
-			if (mysql_stmt_bind_param(smnt, paramBind)) throw std::runtime_error(std::string("mysql_stmt_bind_param : ").append(mysql_stmt_error(smnt)));
+			if (conn != nullptr)
+				wd.Arm(running, conn->connStr, conn->threadId, (timeout != 0) ? std::chrono::milliseconds(timeout) : conn->timeout);
 		}
-		if (mysql_stmt_execute(smnt)) throw std::runtime_error(std::string("mysql_stmt_execute : ").append(mysql_stmt_error(smnt)));
+		wd.Disarm();
+		if (conn != nullptr) conn->Track();
+		CaptureWorkload(start, false);
+
+		if (explain != nullptr)
+		{
+			std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+			if (explain->IsSlow(elapsed)) CaptureExplain(elapsed);
+		}
+		return true;
+	}
+
+	bool MySqlCommand::Cancel()
+	{
+		return (conn != nullptr) && MySqlWatchdog::Instance().Cancel(running, conn->connStr);
+	}
+
+	bool MySqlConnection::Cancel()
+	{
+		return MySqlWatchdog::Instance().Cancel(running, connStr);
+	}
+
+	// copy the bound parameters for ExplainCapture
+	void MySqlCommand::CaptureExplain(std::chrono::steady_clock::duration elapsed)
+	{
+		std::vector<ExplainParam> params(paramCount);
+		for (uint32_t i = 0; i < paramCount; i++)
+		{
+			params[i].type = bindings[i].buffer_type;
+			params[i].isNull = bindings[i].is_null;
+			if (!bindings[i].is_null) params[i].bytes.assign(static_cast<const char*>(bindings[i].buffer), bindings[i].length);
+		}
+		explain->Capture(query, std::move(params), elapsed);
+	}
+
+	void MySqlCommand::CaptureWorkload(std::chrono::steady_clock::time_point start, bool failed)
+	{
+		if ((conn != nullptr) && conn->workload) conn->workload->Record(conn->workloadSession, query, bindings, paramCount, start, failed);
+	}
+
+	void MySqlConnection::SetWorkloadCapture(std::shared_ptr<WorkloadCapture> capture)
+	{
+		workload = capture;
+		workloadSession = capture ? capture->Session() : 0;
 	}
 
 	uint32_t MySqlDataReader::PosFromName(const std::string &name) const
 	{
 		MYSQL_FIELD* fld = smnt->fields;
-		for (uint32_t i = 0; i < smnt->field_count; i++)
+		for (uint32_t i = 0; i < smnt->field_count; i++, fld++)
 		{
 			if (name.compare(0, name.length(), fld->name, fld->name_length) == 0) return i;
 		}
@@ -322,8 +1039,14 @@ namespace Kiff {
 	}
 
 	//////////////////////////////////////////////
-	MySqlDataReader::MySqlDataReader(MYSQL_STMT * istmt)
-		:smnt(istmt)
+	MySqlDataReader::MySqlDataReader(MYSQL_STMT * istmt, const ReaderOptions &ioptions, bool bind)
+		:smnt(istmt), options(ioptions)
+	{
+		if (bind) Bind(nullptr);
+	}
+
+	// result bindings for the current result set's metadata
+	bool MySqlDataReader::Bind(MySqlError *err)
 	{
 		fieldCount = mysql_stmt_field_count(smnt);
 		if (fieldCount > 0)
@@ -336,28 +1059,154 @@ namespace Kiff {
 			{
 				results[i].Init(meta_result->fields[i], resultBind[i]);
 			}
+
+			std::string msg;
+			bool failed = false;
+			if (options.prefetchRows != 0)
+			{
+				// resultBind stays unbound: the prefetcher fetches into its own buffers
+				try
+				{
+					prefetch.reset(new RowPrefetcher(smnt, meta_result->fields, fieldCount, options.prefetchRows, options.prefetchBlocks));
+				}
+				catch (std::exception &ex)
+				{
+					msg = ex.what();
+					failed = true;
+				}
+			}
+			else if ((options.budget && options.budget->Limit() != 0) || ResultBudget::Process().Limit() != 0)
+			{
+				failed = !Spool(msg);
+			}
+			else if (mysql_stmt_bind_result(smnt, resultBind) || mysql_stmt_store_result(smnt))
+			{
+				msg = mysql_stmt_error(smnt);
+				failed = true;
+			}
 			mysql_free_result(meta_result);
 
-			if (mysql_stmt_bind_result(smnt, resultBind)) throw std::runtime_error(mysql_stmt_error(smnt));
+			if (failed)
+			{
+				delete[] resultBind;
+				delete[] results;
+				resultBind = nullptr;
+				results = nullptr;
+				fieldCount = 0;
+				return Fail(err, StmtError(smnt, msg));
+			}
+		}
+		return true;
+	}
 
-			if (mysql_stmt_store_result(smnt)) throw std::runtime_error(mysql_stmt_error(smnt));
+	// fetch the whole result into a RowSpool: buffered semantics, bounded memory
+	bool MySqlDataReader::Spool(std::string &err)
+	{
+		if (mysql_stmt_bind_result(smnt, resultBind))
+		{
+			err = mysql_stmt_error(smnt);
+			return false;
+		}
+		try
+		{
+			spool.reset(new RowSpool(fieldCount, options.budget));
+			int rc;
+			while ((rc = mysql_stmt_fetch(smnt)) == 0) spool->Append(results);
+			if (rc != MYSQL_NO_DATA)
+			{
+				// a truncated value (over the buffer cap) sets no error text
+				err = (rc == MYSQL_DATA_TRUNCATED) ? std::string("mysql_stmt_fetch : data truncated") : std::string("mysql_stmt_fetch : ").append(mysql_stmt_error(smnt));
+				spool.reset();
+				return false;
+			}
+			spool->Finish();
+			return true;
+		}
+		catch (std::exception &ex)
+		{
+			err = ex.what();
+			spool.reset();
+			return false;
 		}
 	}
 
-	MySqlDataReader::~MySqlDataReader()
+	void MySqlDataReader::Unbind()
 	{
-		mysql_stmt_free_result(smnt);
+		prefetch.reset();
+		spool.reset();
 		if (resultBind != nullptr)
 		{
 			delete[] resultBind;
 			delete[] results;
+			resultBind = nullptr;
+			results = nullptr;
+		}
+		fieldCount = 0;
+	}
+
+	bool MySqlDataReader::NextResult()
+	{
+		if (smnt == nullptr) return false;
+
+		prefetch.reset();
+		mysql_stmt_free_result(smnt);
+		Unbind();
+		for (;;)
+		{
+			int rc = mysql_stmt_next_result(smnt);
+			if (rc == -1) return false;
+			if (rc != 0) throw std::runtime_error(std::string("mysql_stmt_next_result : ").append(mysql_stmt_error(smnt)));
+			if (mysql_stmt_field_count(smnt) == 0) continue;		// status of CALL or a statement without rows
+			Bind(nullptr);
+			return true;
 		}
-		if (rdCmd != nullptr) delete rdCmd;
+	}
+
+	MySqlDataReader::MySqlDataReader(MySqlDataReader &&other) noexcept
+		:smnt(other.smnt), resultBind(other.resultBind), results(other.results), fieldCount(other.fieldCount), ownSmnt(other.ownSmnt),
+		lease(std::move(other.lease)), options(std::move(other.options)), prefetch(std::move(other.prefetch)), spool(std::move(other.spool))
+	{
+		other.smnt = nullptr;
+		other.resultBind = nullptr;
+		other.results = nullptr;
+		other.fieldCount = 0;
+		other.ownSmnt = false;
+	}
+
+	MySqlDataReader& MySqlDataReader::operator=(MySqlDataReader &&other) noexcept
+	{
+		if (this != &other)
+		{
+			std::swap(smnt, other.smnt);
+			std::swap(resultBind, other.resultBind);
+			std::swap(results, other.results);
+			std::swap(fieldCount, other.fieldCount);
+			std::swap(ownSmnt, other.ownSmnt);
+			std::swap(lease, other.lease);
+			std::swap(options, other.options);
+			std::swap(prefetch, other.prefetch);
+			std::swap(spool, other.spool);
+		}
+		return *this;
+	}
+
+	MySqlDataReader::~MySqlDataReader()
+	{
+		prefetch.reset();
+		if (smnt != nullptr)
+		{
+			mysql_stmt_free_result(smnt);
+			if (ownSmnt) mysql_stmt_close(smnt);
+		}
+		Unbind();
+		lease.reset();
 	}
 
 	bool MySqlDataReader::Read()
 	{
 		if (fieldCount == 0) return false;
+		if (prefetch) return prefetch->Next(results);
+		if (spool) return spool->Next(results);
 
 		int rc = mysql_stmt_fetch(smnt);
 		if (rc == 0) return true;
@@ -365,6 +1214,27 @@ namespace Kiff {
 		return false;
 	}
 
+	MySqlResult<bool> MySqlDataReader::TryRead()
+	{
+		if (fieldCount == 0) return false;
+		if (prefetch || spool)
+		{
+			try
+			{
+				return Read();
+			}
+			catch (std::exception &ex)
+			{
+				return StmtError(smnt, ex.what());
+			}
+		}
+
+		int rc = mysql_stmt_fetch(smnt);
+		if (rc == 0) return true;
+		if (rc != MYSQL_NO_DATA) return StmtError(smnt, mysql_stmt_error(smnt));
+		return false;
+	}
+
 	template<>
 	std::string MySqlDataReader::GetFieldValue<std::string>(uint32_t pos) const
 	{
@@ -407,6 +1277,17 @@ namespace Kiff {
 		return TmDateTime (sqtm->year, sqtm->month, sqtm->day, sqtm->hour, sqtm->minute, sqtm->second, mls, mks, 0);
 	}
 
+	template<>
+	Decimal MySqlDataReader::GetFieldValue<Decimal>(uint32_t pos) const
+	{
+		if (pos >= fieldCount)	throw std::runtime_error("MySqlCommand:: Wrong param index '" + std::to_string(pos) + "' in GetFieldValue");
+		if (results[pos].is_null) throw std::runtime_error(std::string("Field '").append(std::to_string(pos)).append("' is NULL"));
+		Decimal dec;
+		if (!Decimal::Parse(static_cast<const char*>(results[pos].buffer), results[pos].length, &dec))
+			throw std::runtime_error(std::string("Field '").append(std::to_string(pos)).append("' is not a decimal"));
+		return dec;
+	}
+
 	void DataStore::Init(MYSQL_FIELD &field, MYSQL_BIND &resbind)
 	{
 		uint32_t bufLen = 0;
@@ -414,6 +1295,7 @@ namespace Kiff {
 
 		switch (field.type)
 		{
+		case enum_field_types::MYSQL_TYPE_TIMESTAMP:
 		case enum_field_types::MYSQL_TYPE_DATE:
 		case enum_field_types::MYSQL_TYPE_TIME:
 		case enum_field_types::MYSQL_TYPE_DATETIME:
@@ -433,6 +1315,11 @@ namespace Kiff {
 			bufferType = field.type;
 			bufLen = field.length;
 			break;
+		case enum_field_types::MYSQL_TYPE_DECIMAL:
+		case enum_field_types::MYSQL_TYPE_NEWDECIMAL:
+			bufferType = enum_field_types::MYSQL_TYPE_NEWDECIMAL;		// text: sign, digits, point
+			bufLen = field.length + 2;
+			break;
 		default:
 			bufferType = field.type;
 			bufLen = 8;
@@ -443,6 +1330,7 @@ namespace Kiff {
 
 		buffer = malloc(bufLen);
 		buffer_length = bufLen;
+		buffer_type = (MySqlDbType)(bufferType | ((field.flags & UNSIGNED_FLAG) ? 0x200 : 0));
 		resbind.buffer = buffer;
 		resbind.buffer_length = bufLen;
 		resbind.buffer_type = bufferType;
@@ -15,8 +15,14 @@ Author:
 #include <string>
 #include <map>
 #include <vector>
+#include <chrono>
+#include <memory>
+#include <atomic>
+#include <functional>
 
 #include "TmDateTime.h"
+#include "Decimal.h"
+#include "MySqlResult.h"
 #include <stdexcept>
 
 namespace Kiff {
@@ -27,7 +33,7 @@ namespace Kiff {
 // Summary:
 //     Kiff.Data.MySqlClient.MySqlDbType.Decimal
 //     A fixed precision and scale numeric value between -1038 -1 and 10 38 -1.
-		//Decimal = 0,
+		Decimal = 0,
 		//
 		// Summary:
 		//     Kiff.Data.MySqlClient.MySqlDbType.Byte
@@ -108,7 +114,7 @@ namespace Kiff {
 		//
 		// Summary:
 		//     New Decimal
-		//NewDecimal = 246,
+		NewDecimal = 246,
 		//
 		// Summary:
 		//     An enumeration. A string object that can have only one value, chosen from the
@@ -178,6 +184,14 @@ namespace Kiff {
 	{
 		friend class MySqlDataReader;
 		friend class MySqlCommand;
+		friend class RowPrefetcher;
+		friend class RowSpool;
+		friend class MySqlSnapshot;
+		friend class ShardedReader;
+		friend class KeysetPager;
+		friend class WorkloadCapture;
+		friend struct RowBlock;
+		template<typename... Args> friend class PreparedStatement;
 
 		DataStore(const DataStore&) {}
 	protected:
@@ -196,17 +210,56 @@ namespace Kiff {
 	};
 
 	class MySqlCommand;
+	class MySqlConnection;
+	struct ExportColumn;
+	class ExplainCapture;
+	class WorkloadCapture;
+	class RowPrefetcher;
+	class RowSpool;
+	class ResultBudget;
+	class RowBatchQueue;
+	class MySqlRow;
+	template<typename... Args> class PreparedStatement;
+
+	void ToMySqlTime(const TmDateTime &value, MYSQL_TIME &mtim);
+
+	// running statement as seen by Cancel from other threads (MySqlWatchdog)
+	struct WatchdogSlot
+	{
+		std::atomic<uint64_t> ticket{ 0 };			// 0 - idle, even - watchdog ticket, odd - running without one
+		std::atomic<unsigned long> threadId{ 0 };	// server thread of the running statement
+		uint64_t runs = 0;							// executing thread only
+	};
+
+	// how readers of a command hold their result set
+	struct ReaderOptions
+	{
+		uint32_t prefetchRows = 0;				// rows per RowPrefetcher block, 0 - buffered
+		uint32_t prefetchBlocks = 0;
+		std::shared_ptr<ResultBudget> budget;	// connection's ceiling for buffered rows (RowSpool)
+	};
 
 	class MySqlDataReader
 	{
 		friend class MySqlConnection;
 		friend class MySqlCommand;
+		friend class MySqlRoutingConnection;
+		friend class MySqlRow;
+		friend class MySqlSnapshot;
+		friend class ShardedReader;
+		friend class KeysetPager;
+		friend class SharedResult;
+		template<typename... Args> friend class PreparedStatement;
 
 		MYSQL_STMT *smnt;
 		MYSQL_BIND *resultBind = nullptr;		// output
-		DataStore *results;					// real results
+		DataStore *results = nullptr;		// real results
 		uint32_t fieldCount = 0;
-		MySqlDataReader(const MySqlDataReader&) {}
+		bool ownSmnt = false;				// close smnt in destructor (reader from MySqlConnection::ExecuteReader)
+		std::shared_ptr<void> lease;		// released after smnt (MySqlRoutingConnection in-flight count)
+		ReaderOptions options;
+		std::unique_ptr<RowPrefetcher> prefetch;
+		std::unique_ptr<RowSpool> spool;		// buffered under a memory budget instead of mysql_stmt_store_result
 
 		template<typename T>
 		void GetRefValue(uint32_t pos, T& value) const
@@ -224,14 +277,28 @@ namespace Kiff {
 		}
 
 		uint32_t PosFromName(const std::string &name) const;
+		std::vector<ExportColumn> ExportColumns() const;
+		bool Bind(MySqlError *err);
+		void Unbind();
+		bool Spool(std::string &err);
+		size_t Scatter(RowBatchQueue &queue, uint32_t batchRows, uint64_t &batches, const std::function<void(uint64_t)> &pushed);
 
 	protected:
-		MySqlDataReader(MYSQL_STMT *ismnt);
-		MySqlCommand *rdCmd = nullptr;
+		MySqlDataReader(MYSQL_STMT *ismnt, const ReaderOptions &ioptions = ReaderOptions(), bool bind = true);
 	public:
+		MySqlDataReader(const MySqlDataReader&) = delete;
+		MySqlDataReader& operator=(const MySqlDataReader&) = delete;
+		MySqlDataReader(MySqlDataReader &&other) noexcept;
+		MySqlDataReader& operator=(MySqlDataReader &&other) noexcept;
 		~MySqlDataReader();
 		bool Read();
 
+		// Read without exceptions: fetch errors are returned
+		MySqlResult<bool> TryRead();
+
+		// advance to the next result set (multi-statement, CALL); false when there are no more
+		bool NextResult();
+
 		bool IsNull(uint32_t pos) const
 		{		
 			if (pos >= fieldCount)	throw std::runtime_error("MySqlCommand:: Wrong param index '" + std::to_string(pos) + "' in IsNull");
@@ -257,6 +324,20 @@ namespace Kiff {
 			return GetFieldValue<T>(PosFromName(name));
 		}
 
+		// empty for NULL instead of throwing; a wrong index still throws
+		template<typename T>
+		Nullable<T> GetNullable(uint32_t pos) const
+		{
+			if (IsNull(pos)) return Nullable<T>();
+			return Nullable<T>(GetFieldValue<T>(pos));
+		}
+
+		template<typename T>
+		Nullable<T> GetNullable(const std::string &name) const
+		{
+			return GetNullable<T>(PosFromName(name));
+		}
+
 		void GetFieldValue(uint32_t pos, void **obuf, uint32_t *olen) const
 		{
 			if (pos >= fieldCount)	throw std::runtime_error("MySqlCommand:: Wrong param index '" + std::to_string(pos) + "' in GetFieldValue");
@@ -270,6 +351,19 @@ namespace Kiff {
 		{
 			GetRefValues(0, Fargs...);
 		}
+
+		// write the remaining rows to a file, return the number of rows (MySqlExport.cpp)
+		size_t ExportCsv(const std::string &path, char delimiter = ',', bool header = true);
+		size_t ExportArrow(const std::string &path, uint32_t batchRows = 65536);
+
+		// fn(const MySqlRow&) for the remaining rows on worker threads (0 - one per core),
+		// this thread reads and hands out batches of batchRows; returns the row count (MySqlParallel.h)
+		template<typename Fn>
+		size_t ParallelForEach(Fn fn, uint32_t threads = 0, uint32_t batchRows = 256);
+
+		// same, the results of fn are passed to sink on this thread in row order
+		template<typename Fn, typename Sink>
+		size_t ParallelForEachOrdered(Fn fn, Sink sink, uint32_t threads = 0, uint32_t batchRows = 256);
 	};
 
 	template<>
@@ -282,19 +376,44 @@ namespace Kiff {
 	template<>
 	TmDateTime MySqlDataReader::GetFieldValue<TmDateTime>(uint32_t pos) const;
 	template<>
+	Decimal MySqlDataReader::GetFieldValue<Decimal>(uint32_t pos) const;
+	template<>
 	std::vector<uint8_t> MySqlDataReader::GetFieldValue<std::vector<uint8_t>>(uint32_t pos) const;
 
 	//////////////////////////////////////////////////////////////
 	class MySqlCommand
 	{
 		friend class MySqlConnection;
+		template<typename... Args> friend class PreparedStatement;
 
 		MYSQL_STMT *smnt = nullptr;
 		MYSQL_BIND *paramBind = nullptr;		// input
-		DataStore *bindings;					// real data
-		uint32_t paramCount;
-		MySqlCommand(const MySqlCommand&) {}
-		void Execute();
+		DataStore *bindings = nullptr;			// real data
+		uint32_t paramCount = 0;
+		std::string query;
+		std::shared_ptr<ExplainCapture> explain;		// MySqlConnection::SetExplainCapture, kept alive by its commands
+
+		// live commands of the connection, re-prepared after a reconnect
+		MySqlConnection *conn = nullptr;
+		MySqlCommand *prevCmd = nullptr;
+		MySqlCommand *nextCmd = nullptr;
+		bool stale = false;						// smnt belongs to a closed session
+		bool bound = false;						// paramBind is bound to smnt: Execute skips the bind
+
+		uint32_t timeout = 0;					// milliseconds, 0 - connection's
+		WatchdogSlot running;					// MySqlWatchdog state while executing
+		ReaderOptions readerOptions;
+
+		void Link(MySqlConnection *con);
+		void Unlink();
+		MYSQL_STMT *Prepare(MYSQL *con, MySqlError *err);
+		bool Reprepare(MySqlError *err);
+		bool Recover(MySqlError &failure);
+		bool Execute(MySqlError *err = nullptr);		// err == nullptr - throw on failure
+		bool NonQuery(size_t &affRws, MySqlError *err);
+		void Free();
+		void CaptureExplain(std::chrono::steady_clock::duration elapsed);
+		void CaptureWorkload(std::chrono::steady_clock::time_point start, bool failed);
 
 		template<typename T>
 		MySqlDbType Typ2My() const
@@ -312,10 +431,14 @@ namespace Kiff {
 		}
 
 	protected:
-		MySqlCommand(MYSQL *con, const char *query);
+		MySqlCommand(MySqlConnection *con, const char *query, MySqlError *err = nullptr);		// failed prepare: smnt == nullptr
 
 	public:
 
+		MySqlCommand(const MySqlCommand&) = delete;
+		MySqlCommand& operator=(const MySqlCommand&) = delete;
+		MySqlCommand(MySqlCommand &&other) noexcept;
+		MySqlCommand& operator=(MySqlCommand &&other) noexcept;
 		~MySqlCommand();
 
 		void SetNull(uint32_t pos)
@@ -360,20 +483,54 @@ namespace Kiff {
 			return ExecuteNonQuery();
 		}
 
-		MySqlDataReader *ExecuteReader()
+		MySqlDataReader ExecuteReader()
 		{
 			Execute();
-			return new MySqlDataReader(smnt);
+			return MySqlDataReader(smnt, readerOptions);
 		}
 
 		template<typename... Targs>
-		MySqlDataReader *ExecuteReader(Targs&& ... Fargs)
+		MySqlDataReader ExecuteReader(Targs&& ... Fargs)
 		{
 			SetValues(0, Fargs...);
 			return ExecuteReader();
 		}
 
-		void Cancel() { if (mysql_stmt_free_result(smnt)) throw std::runtime_error(mysql_stmt_error(smnt)); }
+		// Execute* without exceptions: MySQL errors (errno, SQLSTATE) are returned and the
+		// success path builds no strings. Wrong parameter indexes and session setup failures
+		// (pending MySqlConnection::SetVariable etc., restore after a reconnect) still throw.
+		MySqlResult<size_t> TryExecuteNonQuery();
+
+		template<typename... Targs>
+		MySqlResult<size_t> TryExecuteNonQuery(Targs&& ... Fargs)
+		{
+			SetValues(0, Fargs...);
+			return TryExecuteNonQuery();
+		}
+
+		MySqlResult<MySqlDataReader> TryExecuteReader();
+
+		template<typename... Targs>
+		MySqlResult<MySqlDataReader> TryExecuteReader(Targs&& ... Fargs)
+		{
+			SetValues(0, Fargs...);
+			return TryExecuteReader();
+		}
+
+		// deadline for each Execute, milliseconds; 0 - use the connection's
+		void SetTimeout(uint32_t milliseconds) { timeout = milliseconds; }
+
+		// KILL QUERY the running statement from another thread; false if it isn't running
+		bool Cancel();
+
+		// Readers stream the result set instead of storing it: a background thread fetches
+		// blocks of blockRows rows, up to blocks ahead. 0 - store the whole result (default).
+		// The connection stays busy until the reader is destroyed.
+		void SetPrefetch(uint32_t blockRows, uint32_t blocks = 4)
+		{
+			readerOptions.prefetchRows = blockRows;
+			readerOptions.prefetchBlocks = blocks;
+		}
 	};
 
 	template<> inline MySqlDbType MySqlCommand::Typ2My<int8_t>()   const { return MySqlDbType::Byte; }
@@ -387,6 +544,7 @@ namespace Kiff {
 	template<> inline MySqlDbType MySqlCommand::Typ2My<float>()    const { return MySqlDbType::Float; }
 	template<> inline MySqlDbType MySqlCommand::Typ2My<double>()   const { return MySqlDbType::Double; }
 	template<> inline MySqlDbType MySqlCommand::Typ2My<TmDateTime>() const { return MySqlDbType::DateTime; }
+	template<> inline MySqlDbType MySqlCommand::Typ2My<Decimal>() const { return MySqlDbType::NewDecimal; }
 	template<> inline MySqlDbType MySqlCommand::Typ2My<std::string>() const { return MySqlDbType::VarChar; }
 	template<> inline MySqlDbType MySqlCommand::Typ2My<std::vector<uint8_t>>() const { return MySqlDbType::LongBlob; }
 
@@ -424,14 +582,86 @@ namespace Kiff {
 	template<>
 	void MySqlCommand::SetValue(uint32_t pos, const TmDateTime& value);
 
+	template<>
+	void MySqlCommand::SetValue(uint32_t pos, const Decimal& value);
+
+	/////////////////////////////////////////////////////////////////////////
+	// RAII transaction: autocommit is off while active, rollback on destruction
+	class MySqlTransaction
+	{
+		friend class MySqlConnection;
+
+		MYSQL *mysql = nullptr;			// nullptr - not active
+		bool *activeFlg = nullptr;		// MySqlConnection::inTransaction
+		bool autocommit = true;			// session mode restored by End
+
+		MySqlTransaction(MYSQL *con, bool *active, bool iautocommit)
+			:mysql(con), activeFlg(active), autocommit(iautocommit) {}
+		void End();
+		void Query(const std::string &query);
+	public:
+		MySqlTransaction() {}
+		MySqlTransaction(const MySqlTransaction&) = delete;
+		MySqlTransaction& operator=(const MySqlTransaction&) = delete;
+		MySqlTransaction(MySqlTransaction &&other) noexcept;
+		MySqlTransaction& operator=(MySqlTransaction &&other) noexcept;
+		~MySqlTransaction();
+
+		bool IsActive() const { return mysql != nullptr; }
+
+		void Commit();
+		void Rollback();
+
+		// savepoints
+		void Save(const std::string &name);
+		void RollbackTo(const std::string &name);
+		void Release(const std::string &name);
+	};
+
 	/////////////////////////////////////////////////////////////////////////
 	class MySqlConnection
 	{
+		friend class MySqlCommand;
+		friend class MySqlWatchdog;
+		friend class BinlogStream;
+		friend class MultiRowInsertBuilder;
+		friend class KeysetPager;
+		template<typename... Args> friend class PreparedStatement;
+
 		static const std::map<std::string, std::string> Aliases;		//   ConnectionString 
 		static int connCnt;		//   
 		MySqlConnection(const MySqlConnection&) {}		//  
 		MYSQL *mysql = nullptr;
 		static std::map<std::string, std::string> ParseConnStr(const std::string &str);
+		static MySqlDataReader DetachReader(MySqlCommand &cmd);
+		static MySqlResult<MySqlDataReader> TryDetachReader(MySqlCommand &cmd);
+		bool Query(const std::string &query, size_t &affRws, MySqlError *err);
+		bool inTransaction = false;
+		std::shared_ptr<ExplainCapture> explain;
+		std::shared_ptr<WorkloadCapture> workload;
+		uint32_t workloadSession = 0;
+
+		// session to restore after MYSQL_OPT_RECONNECT opened a new one
+		unsigned long threadId = 0;
+		std::string charset;
+		std::string database;
+		bool autocommit = true;
+		std::map<std::string, std::string> variables;		// chosen with SetVariable: name -> last known value
+		MySqlCommand *commands = nullptr;		// head of the live command list
+		bool Reconnected();
+
+		// session changes not sent yet
+		std::string pendingCharset;
+		int pendingAutocommit = -1;
+		std::map<std::string, std::string> pending;
+		bool SessionPending() const { return !pendingCharset.empty() || (pendingAutocommit >= 0) || !pending.empty(); }
+		void Track();
+		void Tracked(const std::string &name, const std::string &value);
+
+		std::string connStr;					// side connection of MySqlWatchdog
+		std::chrono::milliseconds timeout{ 0 };
+		WatchdogSlot running;					// MySqlWatchdog state of ExecuteNonQuery(query)
+		ReaderOptions readerOptions;			// default of new commands
 	public:
 
 		MySqlConnection(const std::string &ConnStr);
@@ -442,34 +672,149 @@ namespace Kiff {
 		inline void Ping() 
 		{
 			if (mysql_ping(mysql)) throw std::runtime_error("mysql_ping");
+			Reconnected();
 		}
 
-		MySqlCommand *CreateCommand(const std::string &query) { return new MySqlCommand(mysql, query.c_str()); }
+		MySqlCommand CreateCommand(const std::string &query)
+		{
+			MySqlCommand cmd(this, query.c_str());
+			cmd.explain = explain;
+			cmd.readerOptions = readerOptions;
+			return cmd;
+		}
 		
 		size_t ExecuteNonQuery(const std::string &query);
 
 		template<typename... Targs>
 		size_t ExecuteNonQuery(const std::string &query, Targs&& ... Fargs)
 		{
-			MySqlCommand *cmd = CreateCommand(query);
-			cmd->BindParams(Fargs...);
-			size_t affRws = cmd->ExecuteNonQuery();
-			delete cmd;
-			return affRws;
+			MySqlCommand cmd = CreateCommand(query);
+			cmd.BindParams(Fargs...);
+			return cmd.ExecuteNonQuery();
+		}
+
+		MySqlDataReader ExecuteReader(const std::string &query);
+
+		template<typename... Targs>
+		MySqlDataReader ExecuteReader(const std::string &query, Targs&& ... Fargs)
+		{
+			MySqlCommand cmd = CreateCommand(query);
+			cmd.BindParams(Fargs...);
+			return DetachReader(cmd);
+		}
+
+		// non-throwing counterparts, see MySqlCommand::TryExecuteNonQuery
+		MySqlResult<MySqlCommand> TryCreateCommand(const std::string &query);
+
+		MySqlResult<size_t> TryExecuteNonQuery(const std::string &query);
+
+		template<typename... Targs>
+		MySqlResult<size_t> TryExecuteNonQuery(const std::string &query, Targs&& ... Fargs)
+		{
+			MySqlResult<MySqlCommand> cmd = TryCreateCommand(query);
+			if (!cmd) return cmd.Error();
+			return cmd.Value().TryExecuteNonQuery(Fargs...);
 		}
 
-		MySqlDataReader *ExecuteReader(const std::string &query);
+		MySqlResult<MySqlDataReader> TryExecuteReader(const std::string &query);
 
 		template<typename... Targs>
-		MySqlDataReader *ExecuteReader(const std::string &query, Targs&& ... Fargs)
+		MySqlResult<MySqlDataReader> TryExecuteReader(const std::string &query, Targs&& ... Fargs)
 		{
-			MySqlCommand *cmd = CreateCommand(query);
-			cmd->BindParams(Fargs...);
-			MySqlDataReader *rd = cmd->ExecuteReader();
-			rd->rdCmd = cmd;
-			return rd;
+			MySqlResult<MySqlCommand> cmd = TryCreateCommand(query);
+			if (!cmd) return cmd.Error();
+			cmd.Value().BindParams(Fargs...);
+			return TryDetachReader(cmd.Value());
 		}
 
 		virtual void ChangeDatabase(const std::string &dbname);
+
+		MySqlTransaction BeginTransaction();
+		bool InTransaction() const { return inTransaction; }
+
+		static std::string QuoteIdentifier(const std::string &name);
+
+		// deadline of each statement, milliseconds (0 - none); commands may override it
+		void SetTimeout(uint32_t milliseconds) { timeout = std::chrono::milliseconds(milliseconds); }
+
+		// KILL QUERY the running ExecuteNonQuery(query) from another thread
+		bool Cancel();
+
+		// EXPLAIN statements slower than the capture's threshold (commands created afterwards)
+		void SetExplainCapture(std::shared_ptr<ExplainCapture> capture) { explain = capture; }
+
+		// log every statement of this connection and its commands (MySqlWorkload.h)
+		void SetWorkloadCapture(std::shared_ptr<WorkloadCapture> capture);
+
+		// MySqlCommand::SetPrefetch for commands created afterwards
+		void SetPrefetch(uint32_t blockRows, uint32_t blocks = 4)
+		{
+			readerOptions.prefetchRows = blockRows;
+			readerOptions.prefetchBlocks = blocks;
+		}
+
+		// Memory ceiling for rows of buffered readers of this connection (commands created
+		// afterwards), bytes; rows over it are spilled to a mapped temp file. 0 - no limit.
+		void SetResultBudget(uint64_t bytes);
+
+		// the same for all connections together
+		static void SetProcessResultBudget(uint64_t bytes);
+
+		// Session state is tracked on the client, updated from the server's session-state-tracking
+		// responses (variables listed in session_track_system_variables, current schema).
+		// Setters that change nothing send nothing; the others are sent together before
+		// the next statement or by ApplySession. A charset change is a separate round trip.
+		void SetCharset(const std::string &name);
+		void SetAutocommit(bool on);
+
+		// numbers are sent as is, other values as string literals
+		void SetVariable(const std::string &name, const std::string &value);
+		void SetVariable(const std::string &name, int64_t value) { SetVariable(name, std::to_string(value)); }
+
+		void ApplySession();
+
+		const std::string &Charset() const { return charset; }
+		const std::string &Database() const { return database; }
+		bool Autocommit() const { return autocommit; }
+		const std::string &Variable(const std::string &name) const;		// "" if not chosen by SetVariable
+	};
+
+	/////////////////////////////////////////////////////////////////////////
+	// Groups writes into one transaction per maxRows statements or maxMilliseconds.
+	// The time limit is checked on each write; call Flush() when the writer goes idle.
+	// Like MySqlTransaction, writes not flushed when it is destroyed are rolled back,
+	// so an exception unwinding past it does not commit half of the work.
+	class MySqlGroupCommit
+	{
+		MySqlConnection &conn;
+		size_t maxRows;
+		std::chrono::milliseconds maxDelay;
+		MySqlTransaction trans;
+		std::map<std::string, MySqlCommand> commands;		// prepared once per query text
+		size_t pending = 0;
+		std::chrono::steady_clock::time_point started;
+
+		MySqlGroupCommit(const MySqlGroupCommit&) = delete;
+		MySqlCommand &Prepare(const std::string &query);
+		void Begin();
+		void Written();
+	public:
+		MySqlGroupCommit(MySqlConnection &con, size_t maxRows, uint32_t maxMilliseconds);
+		~MySqlGroupCommit();		// rolls back pending writes, errors are ignored
+
+		template<typename... Targs>
+		size_t ExecuteNonQuery(const std::string &query, Targs&& ... Fargs)
+		{
+			MySqlCommand &cmd = Prepare(query);
+			Begin();
+			size_t affRws = cmd.ExecuteNonQuery(Fargs...);
+			Written();
+			return affRws;
+		}
+
+		size_t Pending() const { return pending; }
+
+		void Flush();			// commit pending writes
+		void Rollback();		// discard pending writes
 	};
 }
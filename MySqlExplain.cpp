@@ -0,0 +1,268 @@
+#include "MySqlExplain.h"
+
+#include <cctype>
+#include <cstdio>
+
+namespace Kiff {
+
+	ExplainCapture::ExplainCapture(const std::string &iconnStr, uint32_t thresholdMilliseconds, size_t iplansPerStatement, size_t imaxQueue)
+		:connStr(iconnStr), threshold(std::chrono::milliseconds(thresholdMilliseconds)),
+		plansPerStatement(iplansPerStatement == 0 ? 1 : iplansPerStatement), maxQueue(imaxQueue)
+	{
+		thr = std::thread(&ExplainCapture::Run, this);
+	}
+
+	ExplainCapture::~ExplainCapture()
+	{
+		{
+			std::lock_guard<std::mutex> lk(mtx);
+			stop = true;
+		}
+		cv.notify_all();
+		thr.join();
+	}
+
+	// only these can be explained
+	static bool IsExplainable(const std::string &query)
+	{
+		static const char *verbs[] = { "select", "insert", "update", "delete", "replace", "with" };
+
+		size_t pos = query.find_first_not_of(" \t\n\r(");
+		if (pos == std::string::npos) return false;
+		for (const char *verb : verbs)
+		{
+			size_t len = strlen(verb), i = 0;
+			while ((i < len) && (pos + i < query.length()) && (tolower((unsigned char)query[pos + i]) == verb[i])) i++;
+			if ((i == len) && ((pos + len == query.length()) || !isalnum((unsigned char)query[pos + len]))) return true;
+		}
+		return false;
+	}
+
+	void ExplainCapture::Capture(const std::string &query, std::vector<ExplainParam> &&params, std::chrono::steady_clock::duration elapsed)
+	{
+		if (!IsExplainable(query)) return;
+		{
+			std::lock_guard<std::mutex> lk(mtx);
+			if (queue.size() >= maxQueue) return;
+			queue.push_back(Pending{ query, std::move(params), std::chrono::duration_cast<std::chrono::microseconds>(elapsed), TmDateTime::Now() });
+		}
+		cv.notify_one();
+	}
+
+	void ExplainCapture::Run()
+	{
+		std::unique_ptr<MySqlConnection> side;
+		std::unique_lock<std::mutex> lk(mtx);
+		for (;;)
+		{
+			cv.wait(lk, [this] { return stop || !queue.empty(); });
+			if (stop) return;
+
+			Pending pnd = std::move(queue.front());
+			queue.pop_front();
+			lk.unlock();
+
+			ExplainRecord rec;
+			rec.query = pnd.query;
+			for (const ExplainParam &prm : pnd.params) rec.params.push_back(Literal(prm));
+			rec.elapsed = pnd.elapsed;
+			rec.when = pnd.when;
+			try
+			{
+				if (!side) side.reset(new MySqlConnection(connStr));
+				rec.plan = Explain(*side, pnd);
+			}
+			catch (std::exception &ex)
+			{
+				rec.plan = std::string("error: ") + ex.what();
+				side.reset();
+			}
+			uint64_t fp = Fingerprint(pnd.query);
+
+			lk.lock();
+			auto it = plans.find(fp);
+			if ((it == plans.end()) && (plans.size() >= MaxStatements)) continue;
+			std::deque<ExplainRecord> &ring = plans[fp];
+			if (ring.size() >= plansPerStatement) ring.pop_front();
+			ring.push_back(std::move(rec));
+		}
+	}
+
+	// prepared EXPLAIN with the original parameter bytes and types
+	std::string ExplainCapture::Explain(MySqlConnection &side, const Pending &pnd)
+	{
+		MySqlCommand cmd = side.CreateCommand("EXPLAIN FORMAT=JSON " + pnd.query);
+		for (uint32_t i = 0; i < pnd.params.size(); i++)
+		{
+			const ExplainParam &prm = pnd.params[i];
+			if (prm.isNull)
+			{
+				cmd.SetNull(i);
+				continue;
+			}
+			cmd.BindParam(i, prm.type);
+			cmd.SetValue(i, prm.bytes.data(), prm.bytes.size());
+		}
+		MySqlDataReader rd = cmd.ExecuteReader();
+		if (!rd.Read()) return std::string();
+		return rd.GetFieldValue<std::string>(0);
+	}
+
+	std::string ExplainCapture::Literal(const ExplainParam &prm)
+	{
+		if (prm.isNull) return "NULL";
+
+		char tmp[64];
+		const char *p = prm.bytes.data();
+		bool isUnsigned = ((int)prm.type & 0x200) != 0;
+#ifdef _WIN32
+#pragma warning (disable:4996)
+#endif
+		switch ((enum_field_types)((int)prm.type & 0xff))
+		{
+		case MYSQL_TYPE_TINY:
+		case MYSQL_TYPE_SHORT:
+		case MYSQL_TYPE_LONG:
+		case MYSQL_TYPE_LONGLONG:
+		{
+			int64_t sv = 0;
+			uint64_t uv = 0;
+			size_t n = (prm.bytes.size() < 8) ? prm.bytes.size() : 8;
+			memcpy(&uv, p, n);
+			if (n < 8 && !isUnsigned && (uv >> (n * 8 - 1)) & 1) uv |= ~0ULL << (n * 8);		// sign extension
+			sv = (int64_t)uv;
+			if (isUnsigned) snprintf(tmp, sizeof(tmp), "%llu", (unsigned long long)uv);
+			else snprintf(tmp, sizeof(tmp), "%lld", (long long)sv);
+			return tmp;
+		}
+		case MYSQL_TYPE_FLOAT:
+		{
+			float v;
+			memcpy(&v, p, sizeof(v));
+			snprintf(tmp, sizeof(tmp), "%.9g", v);
+			return tmp;
+		}
+		case MYSQL_TYPE_DOUBLE:
+		{
+			double v;
+			memcpy(&v, p, sizeof(v));
+			snprintf(tmp, sizeof(tmp), "%.17g", v);
+			return tmp;
+		}
+		case MYSQL_TYPE_DATETIME:
+		{
+			MYSQL_TIME t;
+			memcpy(&t, p, sizeof(t));
+			snprintf(tmp, sizeof(tmp), "'%04u-%02u-%02u %02u:%02u:%02u.%06lu'", t.year, t.month, t.day, t.hour, t.minute, t.second, t.second_part);
+			return tmp;
+		}
+		case MYSQL_TYPE_NEWDECIMAL:
+			return prm.bytes;
+		case MYSQL_TYPE_VARCHAR:
+		case MYSQL_TYPE_VAR_STRING:
+		case MYSQL_TYPE_STRING:
+		{
+			std::string ret("'");
+			for (char c : prm.bytes)
+			{
+				if (c == '\'' || c == '\\') ret += c;
+				ret += c;
+			}
+			return ret += '\'';
+		}
+		default:
+		{
+			static const char hex[] = "0123456789ABCDEF";
+			std::string ret("X'");
+			for (unsigned char c : prm.bytes)
+			{
+				ret += hex[c >> 4];
+				ret += hex[c & 0xf];
+			}
+			return ret += '\'';
+		}
+		}
+#ifdef _WIN32
+#pragma warning (default:4996)
+#endif
+	}
+
+	std::vector<ExplainRecord> ExplainCapture::Plans(const std::string &query) const
+	{
+		uint64_t fp = Fingerprint(query);
+		std::lock_guard<std::mutex> lk(mtx);
+		auto it = plans.find(fp);
+		if (it == plans.end()) return std::vector<ExplainRecord>();
+		return std::vector<ExplainRecord>(it->second.begin(), it->second.end());
+	}
+
+	std::vector<ExplainRecord> ExplainCapture::Plans() const
+	{
+		std::vector<ExplainRecord> ret;
+		std::lock_guard<std::mutex> lk(mtx);
+		for (auto &kvp : plans) ret.insert(ret.end(), kvp.second.begin(), kvp.second.end());
+		return ret;
+	}
+
+	// FNV-1a over the normalized text; whitespace only separates words
+	uint64_t ExplainCapture::Fingerprint(const std::string &query)
+	{
+		uint64_t hash = 14695981039346656037ULL;
+		auto put = [&hash](char c)
+		{
+			hash ^= (unsigned char)c;
+			hash *= 1099511628211ULL;
+		};
+
+		bool space = false, lastWord = false;
+		size_t i = 0, len = query.length();
+		while (i < len)
+		{
+			char c = query[i];
+			if (isspace((unsigned char)c))
+			{
+				space = true;
+				i++;
+				continue;
+			}
+			bool word = isalnum((unsigned char)c) || (c == '_') || (c == '$') || (c == '\'') || (c == '"') || (c == '`');
+			if (space && lastWord && word) put(' ');
+			space = false;
+			lastWord = word;
+
+			if ((c == '\'') || (c == '"'))
+			{
+				// string literal, backslash escapes and doubled quotes
+				for (i++; i < len; i++)
+				{
+					if (query[i] == '\\') i++;
+					else if (query[i] == c)
+					{
+						if ((i + 1 < len) && (query[i + 1] == c)) i++;
+						else break;
+					}
+				}
+				i++;
+				put('?');
+			}
+			else if (c == '`')
+			{
+				size_t end = query.find('`', i + 1);
+				if (end == std::string::npos) end = len - 1;
+				for (; i <= end; i++) put(query[i]);
+			}
+			else if (isdigit((unsigned char)c) || ((c == '.') && (i + 1 < len) && isdigit((unsigned char)query[i + 1])))
+			{
+				while ((i < len) && (isalnum((unsigned char)query[i]) || (query[i] == '.'))) i++;
+				put('?');
+			}
+			else if (isalpha((unsigned char)c) || (c == '_') || (c == '$'))
+			{
+				while ((i < len) && (isalnum((unsigned char)query[i]) || (query[i] == '_') || (query[i] == '$')))
+					put((char)tolower((unsigned char)query[i++]));
+			}
+			else put(query[i++]);
+		}
+		return hash;
+	}
+}
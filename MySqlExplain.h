@@ -0,0 +1,88 @@
+/*
+Site:		http://hlspx.ocry.com/mysqlconnestion/
+
+History:
+			VERSION
+			1.0.0.0
+Author:
+		Alexey Tretyakov	hlspx@mail.ru
+*/
+
+#pragma once
+
+#include "MySqlConnection.h"
+
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace Kiff {
+
+	// parameter of a slow statement as it was bound
+	struct ExplainParam
+	{
+		MySqlDbType type;
+		bool isNull;
+		std::string bytes;
+	};
+
+	struct ExplainRecord
+	{
+		std::string query;
+		std::vector<std::string> params;		// parameter values as SQL literals
+		std::chrono::microseconds elapsed;
+		TmDateTime when;
+		std::string plan;						// EXPLAIN FORMAT=JSON output or "error: ..."
+	};
+
+	//////////////////////////////////////////////////////////////
+	// Runs EXPLAIN FORMAT=JSON for statements slower than the threshold on a side
+	// connection in a background thread and keeps the last plans per statement fingerprint.
+	// Attach with MySqlConnection::SetExplainCapture; one capture may serve several connections.
+	class ExplainCapture
+	{
+		struct Pending
+		{
+			std::string query;
+			std::vector<ExplainParam> params;
+			std::chrono::microseconds elapsed;
+			TmDateTime when;
+		};
+
+		std::string connStr;
+		std::chrono::steady_clock::duration threshold;
+		size_t plansPerStatement;
+		size_t maxQueue;
+
+		mutable std::mutex mtx;
+		std::condition_variable cv;
+		std::deque<Pending> queue;
+		std::map<uint64_t, std::deque<ExplainRecord>> plans;
+		bool stop = false;
+		std::thread thr;
+
+		ExplainCapture(const ExplainCapture&) = delete;
+		void Run();
+		std::string Explain(MySqlConnection &side, const Pending &pnd);
+		static std::string Literal(const ExplainParam &prm);
+	public:
+		static const size_t MaxStatements = 1024;		// distinct fingerprints kept
+
+		ExplainCapture(const std::string &connStr, uint32_t thresholdMilliseconds, size_t plansPerStatement = 8, size_t maxQueue = 64);
+		~ExplainCapture();
+
+		bool IsSlow(std::chrono::steady_clock::duration elapsed) const { return elapsed >= threshold; }
+
+		// queue a slow statement; dropped when the queue is full or it can't be explained
+		void Capture(const std::string &query, std::vector<ExplainParam> &&params, std::chrono::steady_clock::duration elapsed);
+
+		// plans for the fingerprint of query, oldest first
+		std::vector<ExplainRecord> Plans(const std::string &query) const;
+		std::vector<ExplainRecord> Plans() const;
+
+		// hash of query with literals replaced by '?', whitespace collapsed and keywords lowercased
+		static uint64_t Fingerprint(const std::string &query);
+	};
+}
@@ -0,0 +1,710 @@
+#include "MySqlConnection.h"
+#include "MySqlExport.h"
+
+#include <cstring>
+#include <cstdlib>
+
+namespace Kiff {
+
+	///////////////////////////////////////////
+	AsyncFileWriter::AsyncFileWriter(const std::string &path, size_t iflushSize)
+		:flushSize(iflushSize)
+	{
+#ifdef _WIN32
+#pragma warning (disable:4996)
+#endif
+		if (!(file = fopen(path.c_str(), "wb")))
+			throw std::runtime_error("AsyncFileWriter : can't open '" + path + "'");
+#ifdef _WIN32
+#pragma warning (default:4996)
+#endif
+		bufs[0].reserve(flushSize + flushSize / 4);
+		bufs[1].reserve(flushSize + flushSize / 4);
+		fill = &bufs[0];
+		try
+		{
+			thr = std::thread(&AsyncFileWriter::Run, this);
+		}
+		catch (...)
+		{
+			fclose(file);
+			throw;
+		}
+	}
+
+	AsyncFileWriter::~AsyncFileWriter()
+	{
+		if (file == nullptr) return;
+		Stop();
+		fclose(file);
+	}
+
+	void AsyncFileWriter::Run()
+	{
+		std::unique_lock<std::mutex> lk(mtx);
+		for (;;)
+		{
+			cv.wait(lk, [this] { return (pending != nullptr) || stop; });
+			if (pending == nullptr) return;
+
+			std::string *buf = pending;
+			lk.unlock();
+			bool ok = fwrite(buf->data(), 1, buf->size(), file) == buf->size();
+			buf->clear();
+			lk.lock();
+
+			if (!ok) failed = true;
+			pending = nullptr;
+			cv.notify_all();
+		}
+	}
+
+	void AsyncFileWriter::Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lk(mtx);
+			stop = true;
+		}
+		cv.notify_all();
+		if (thr.joinable()) thr.join();
+	}
+
+	// swap buffers once the thread is done with the previous one
+	void AsyncFileWriter::Flush()
+	{
+		{
+			std::unique_lock<std::mutex> lk(mtx);
+			cv.wait(lk, [this] { return pending == nullptr; });
+			if (failed) throw std::runtime_error("AsyncFileWriter : write failed");
+			pending = fill;
+			fill = (fill == &bufs[0]) ? &bufs[1] : &bufs[0];
+			written += pending->size();
+		}
+		cv.notify_all();
+	}
+
+	void AsyncFileWriter::Close()
+	{
+		if (file == nullptr) return;
+		if (!fill->empty()) Flush();
+		Stop();
+		bool ok = !failed && (fflush(file) == 0);
+		ok = (fclose(file) == 0) && ok;
+		file = nullptr;
+		if (!ok) throw std::runtime_error("AsyncFileWriter : write failed");
+	}
+
+	///////////////////////////////////////////
+	std::vector<ExportColumn> MySqlDataReader::ExportColumns() const
+	{
+		std::vector<ExportColumn> cols(fieldCount);
+		for (uint32_t i = 0; i < fieldCount; i++)
+		{
+			const MYSQL_FIELD &fld = smnt->fields[i];
+			ExportColumn &col = cols[i];
+			col.name.assign(fld.name, fld.name_length);
+			col.type = (enum_field_types)((int)results[i].buffer_type & 0xff);
+			col.isUnsigned = ((int)results[i].buffer_type & 0x200) != 0;
+			col.isBinary = (fld.charsetnr == 63) && (col.type != MYSQL_TYPE_DECIMAL) && (col.type != MYSQL_TYPE_NEWDECIMAL);
+			col.scale = fld.decimals;
+			col.precision = static_cast<uint32_t>(fld.length) - ((fld.decimals > 0) ? 1 : 0) - ((fld.flags & UNSIGNED_FLAG) ? 0 : 1);
+			col.buffer = results[i].buffer;
+			col.bufferLength = results[i].buffer_length;
+			col.length = &results[i].length;
+			col.isNull = &results[i].is_null;
+		}
+		return cols;
+	}
+
+	static int64_t IntValue(const ExportColumn &col)
+	{
+		switch (col.type)
+		{
+		case MYSQL_TYPE_TINY:	return col.isUnsigned ? (int64_t)*static_cast<const uint8_t*>(col.buffer) : (int64_t)*static_cast<const int8_t*>(col.buffer);
+		case MYSQL_TYPE_SHORT:	return col.isUnsigned ? (int64_t)*static_cast<const uint16_t*>(col.buffer) : (int64_t)*static_cast<const int16_t*>(col.buffer);
+		case MYSQL_TYPE_INT24:
+		case MYSQL_TYPE_LONG:	return col.isUnsigned ? (int64_t)*static_cast<const uint32_t*>(col.buffer) : (int64_t)*static_cast<const int32_t*>(col.buffer);
+		default:				return *static_cast<const int64_t*>(col.buffer);
+		}
+	}
+
+	// digits of v written backwards, ending at end
+	static char *FormatUInt(char *end, uint64_t v)
+	{
+		do
+		{
+			*--end = char('0' + v % 10);
+			v /= 10;
+		} while (v != 0);
+		return end;
+	}
+
+	static void AppendInt(std::string &out, int64_t v)
+	{
+		char tmp[24];
+		char *end = tmp + sizeof(tmp);
+		char *p = FormatUInt(end, (v < 0) ? 0 - (uint64_t)v : (uint64_t)v);
+		if (v < 0) *--p = '-';
+		out.append(p, end - p);
+	}
+
+	static void AppendUInt(std::string &out, uint64_t v)
+	{
+		char tmp[24];
+		char *end = tmp + sizeof(tmp);
+		char *p = FormatUInt(end, v);
+		out.append(p, end - p);
+	}
+
+	// zero padded to width
+	static void AppendDigits(std::string &out, uint64_t v, int width)
+	{
+		char tmp[24];
+		char *end = tmp + sizeof(tmp);
+		char *p = FormatUInt(end, v);
+		while (end - p < width) *--p = '0';
+		out.append(p, end - p);
+	}
+
+	// shortest of %.15g / %.17g (%.7g / %.9g for float) that reads back the same value
+	static void AppendDouble(std::string &out, double v, bool isFloat)
+	{
+		char tmp[32];
+		int precision = isFloat ? 9 : 17;
+#ifdef _WIN32
+#pragma warning (disable:4996)
+#endif
+		int n = snprintf(tmp, sizeof(tmp), "%.*g", precision - 2, v);
+		double rd = strtod(tmp, nullptr);
+		if ((isFloat ? (double)(float)rd : rd) != v) n = snprintf(tmp, sizeof(tmp), "%.*g", precision, v);
+#ifdef _WIN32
+#pragma warning (default:4996)
+#endif
+		out.append(tmp, n);
+	}
+
+	// YYYY-MM-DD hh:mm:ss[.uuuuuu], date or [-]hh:mm:ss[.uuuuuu] by time_type
+	static void AppendTime(std::string &out, const MYSQL_TIME &t)
+	{
+		if (t.time_type != MYSQL_TIMESTAMP_TIME)
+		{
+			AppendDigits(out, t.year, 4);
+			out += '-';
+			AppendDigits(out, t.month, 2);
+			out += '-';
+			AppendDigits(out, t.day, 2);
+			if (t.time_type == MYSQL_TIMESTAMP_DATE) return;
+			out += ' ';
+		}
+		else if (t.neg) out += '-';
+
+		AppendDigits(out, t.hour, 2);
+		out += ':';
+		AppendDigits(out, t.minute, 2);
+		out += ':';
+		AppendDigits(out, t.second, 2);
+		if (t.second_part != 0)
+		{
+			out += '.';
+			AppendDigits(out, t.second_part, 6);
+		}
+	}
+
+	// RFC 4180: quote fields with delimiter, quote or line break; empty string is "" to differ from NULL
+	static void AppendCsvString(std::string &out, const char *s, size_t len, char delimiter)
+	{
+		bool quote = (len == 0);
+		for (size_t i = 0; (i < len) && !quote; i++)
+		{
+			char c = s[i];
+			quote = (c == delimiter) || (c == '"') || (c == '\n') || (c == '\r');
+		}
+		if (!quote)
+		{
+			out.append(s, len);
+			return;
+		}
+
+		out += '"';
+		const char *p = s, *end = s + len;
+		while (const char *q = static_cast<const char*>(memchr(p, '"', end - p)))
+		{
+			out.append(p, q - p + 1);
+			out += '"';
+			p = q + 1;
+		}
+		out.append(p, end - p);
+		out += '"';
+	}
+
+	static void AppendCsvField(std::string &out, const ExportColumn &col, char delimiter)
+	{
+		if (*col.isNull) return;
+
+		switch (col.type)
+		{
+		case MYSQL_TYPE_TINY:
+		case MYSQL_TYPE_SHORT:
+		case MYSQL_TYPE_INT24:
+		case MYSQL_TYPE_LONG:
+		case MYSQL_TYPE_LONGLONG:
+			if (col.isUnsigned && (col.type == MYSQL_TYPE_LONGLONG)) AppendUInt(out, *static_cast<const uint64_t*>(col.buffer));
+			else AppendInt(out, IntValue(col));
+			break;
+		case MYSQL_TYPE_FLOAT:
+			AppendDouble(out, *static_cast<const float*>(col.buffer), true);
+			break;
+		case MYSQL_TYPE_DOUBLE:
+			AppendDouble(out, *static_cast<const double*>(col.buffer), false);
+			break;
+		case MYSQL_TYPE_DATETIME:
+			AppendTime(out, *static_cast<const MYSQL_TIME*>(col.buffer));
+			break;
+		default:
+			AppendCsvString(out, static_cast<const char*>(col.buffer), col.Length(), delimiter);
+			break;
+		}
+	}
+
+	size_t MySqlDataReader::ExportCsv(const std::string &path, char delimiter, bool header)
+	{
+		std::vector<ExportColumn> cols = ExportColumns();
+		AsyncFileWriter wr(path);
+
+		if (header && !cols.empty())
+		{
+			std::string &out = wr.Buffer();
+			for (size_t i = 0; i < cols.size(); i++)
+			{
+				if (i != 0) out += delimiter;
+				AppendCsvString(out, cols[i].name.data(), cols[i].name.length(), delimiter);
+			}
+			out += "\r\n";
+		}
+
+		size_t rows = 0;
+		while (Read())
+		{
+			std::string &out = wr.Buffer();
+			for (size_t i = 0; i < cols.size(); i++)
+			{
+				if (i != 0) out += delimiter;
+				AppendCsvField(out, cols[i], delimiter);
+			}
+			out += "\r\n";
+			rows++;
+			wr.Commit();
+		}
+		wr.Close();
+		return rows;
+	}
+
+	///////////////////////////////////////////
+	// Minimal FlatBuffers builder for the Arrow IPC metadata.
+	// Like the reference builder it grows from the end: a reference is the
+	// buffer size right after the object was written. Little-endian host only.
+	class FlatBuilder
+	{
+		std::string buf;
+		size_t minAlign = 8;
+		uint32_t tableStart = 0;
+		std::vector<std::pair<uint16_t, uint32_t>> fields;		// id, reference
+
+		void Align(size_t len, size_t align)
+		{
+			if (align > minAlign) minAlign = align;
+			buf.insert(0, (align - (buf.size() + len) % align) % align, '\0');
+		}
+
+		template<typename T>
+		void PushRaw(T v)
+		{
+			buf.insert(0, reinterpret_cast<const char*>(&v), sizeof(T));
+		}
+
+		template<typename T>
+		void Push(T v)
+		{
+			Align(sizeof(T), sizeof(T));
+			PushRaw(v);
+		}
+
+		void PushOffset(uint32_t ref)
+		{
+			PushRaw<uint32_t>(Size() + 4 - ref);
+		}
+	public:
+		uint32_t Size() const { return static_cast<uint32_t>(buf.size()); }
+		const std::string &Data() const { return buf; }
+
+		uint32_t CreateString(const std::string &s)
+		{
+			Align(s.length() + 1, 4);
+			buf.insert(0, 1, '\0');
+			buf.insert(0, s);
+			PushRaw<uint32_t>(static_cast<uint32_t>(s.length()));
+			return Size();
+		}
+
+		uint32_t CreateOffsetVector(const std::vector<uint32_t> &refs)
+		{
+			Align(refs.size() * 4, 4);
+			for (size_t i = refs.size(); i-- > 0; ) PushOffset(refs[i]);
+			PushRaw<uint32_t>(static_cast<uint32_t>(refs.size()));
+			return Size();
+		}
+
+		uint32_t CreateStructVector(const void *data, size_t elemSize, size_t count)
+		{
+			Align(elemSize * count, 8);
+			if (count != 0) buf.insert(0, static_cast<const char*>(data), elemSize * count);
+			PushRaw<uint32_t>(static_cast<uint32_t>(count));
+			return Size();
+		}
+
+		void StartTable()
+		{
+			fields.clear();
+			tableStart = Size();
+		}
+
+		template<typename T>
+		void AddScalar(uint16_t id, T v)
+		{
+			Push(v);
+			fields.emplace_back(id, Size());
+		}
+
+		void AddOffset(uint16_t id, uint32_t ref)
+		{
+			Align(4, 4);
+			PushOffset(ref);
+			fields.emplace_back(id, Size());
+		}
+
+		uint32_t EndTable()
+		{
+			Push<int32_t>(0);		// vtable soffset, patched below
+			uint32_t table = Size();
+
+			uint16_t numFields = 0;
+			for (auto &fld : fields) if (fld.first >= numFields) numFields = fld.first + 1;
+			std::vector<uint16_t> vtable(numFields, 0);
+			for (auto &fld : fields) vtable[fld.first] = static_cast<uint16_t>(table - fld.second);
+
+			for (size_t i = numFields; i-- > 0; ) PushRaw<uint16_t>(vtable[i]);
+			PushRaw<uint16_t>(static_cast<uint16_t>(table - tableStart));
+			PushRaw<uint16_t>(static_cast<uint16_t>(4 + 2 * numFields));
+
+			int32_t soffset = static_cast<int32_t>(Size() - table);
+			memcpy(&buf[Size() - table], &soffset, sizeof(soffset));
+			return table;
+		}
+
+		void Finish(uint32_t root)
+		{
+			Align(4, minAlign);
+			PushOffset(root);
+		}
+	};
+
+	// Arrow IPC format ids (Schema.fbs, Message.fbs)
+	static const uint8_t ArrowInt = 2;
+	static const uint8_t ArrowFloatingPoint = 3;
+	static const uint8_t ArrowBinary = 4;
+	static const uint8_t ArrowUtf8 = 5;
+	static const uint8_t ArrowDecimal = 7;
+	static const uint8_t ArrowTimestamp = 10;
+	static const uint8_t ArrowHeaderSchema = 1;
+	static const uint8_t ArrowHeaderRecordBatch = 3;
+	static const int16_t ArrowMetadataV5 = 4;
+	static const size_t ArrowMaxData = 1u << 30;		// int32 offsets: end the batch early
+
+	struct ArrowBlock
+	{
+		int64_t offset;
+		int32_t metaDataLength;
+		int32_t pad;
+		int64_t bodyLength;
+	};
+
+	struct ArrowColumn
+	{
+		const ExportColumn *src;
+		uint8_t typeId;
+		int width;						// bytes per value, 0 - variable length
+		std::vector<uint8_t> validity;
+		std::vector<int32_t> offsets;
+		std::vector<uint8_t> data;
+		int64_t nullCount = 0;
+
+		void Reset()
+		{
+			validity.clear();
+			offsets.clear();
+			data.clear();
+			nullCount = 0;
+			if (width == 0) offsets.push_back(0);
+		}
+	};
+
+	static void ArrowType(ArrowColumn &col)
+	{
+		switch (col.src->type)
+		{
+		case MYSQL_TYPE_TINY:		col.typeId = ArrowInt; col.width = 1; break;
+		case MYSQL_TYPE_SHORT:		col.typeId = ArrowInt; col.width = 2; break;
+		case MYSQL_TYPE_INT24:
+		case MYSQL_TYPE_LONG:		col.typeId = ArrowInt; col.width = 4; break;
+		case MYSQL_TYPE_LONGLONG:	col.typeId = ArrowInt; col.width = 8; break;
+		case MYSQL_TYPE_FLOAT:		col.typeId = ArrowFloatingPoint; col.width = 4; break;
+		case MYSQL_TYPE_DOUBLE:		col.typeId = ArrowFloatingPoint; col.width = 8; break;
+		case MYSQL_TYPE_DATETIME:	col.typeId = ArrowTimestamp; col.width = 8; break;
+		case MYSQL_TYPE_NEWDECIMAL:
+			if ((col.src->precision > 0) && (col.src->precision <= Decimal::MaxDigits) && (col.src->scale <= col.src->precision))
+			{
+				col.typeId = ArrowDecimal;
+				col.width = 16;
+				break;
+			}
+			col.typeId = ArrowUtf8; col.width = 0; break;
+		default:					col.typeId = col.src->isBinary ? ArrowBinary : ArrowUtf8; col.width = 0; break;
+		}
+	}
+
+	// days since 1970-01-01 (H. Hinnant's days_from_civil)
+	static int64_t DaysFromCivil(int y, unsigned m, unsigned d)
+	{
+		y -= (m <= 2);
+		const int era = ((y >= 0) ? y : y - 399) / 400;
+		const unsigned yoe = static_cast<unsigned>(y - era * 400);
+		const unsigned doy = (153 * ((m > 2) ? m - 3 : m + 9) + 2) / 5 + d - 1;
+		const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+		return era * 146097LL + static_cast<int64_t>(doe) - 719468;
+	}
+
+	static int64_t EpochMicroseconds(const MYSQL_TIME &t)
+	{
+		int64_t mks = ((t.hour * 60LL + t.minute) * 60 + t.second) * 1000000LL + t.second_part;
+		if (t.time_type == MYSQL_TIMESTAMP_TIME) return t.neg ? -mks : mks;
+		return DaysFromCivil(t.year, t.month, t.day) * 86400000000LL + mks;
+	}
+
+	static void ArrowAppend(ArrowColumn &col, int64_t row)
+	{
+		const ExportColumn &src = *col.src;
+		bool isNull = *src.isNull;
+
+		if ((row & 7) == 0) col.validity.push_back(0);
+		if (isNull) col.nullCount++;
+		else col.validity.back() |= static_cast<uint8_t>(1 << (row & 7));
+
+		if (col.width == 0)
+		{
+			if (!isNull)
+			{
+				const uint8_t *p = static_cast<const uint8_t*>(src.buffer);
+				col.data.insert(col.data.end(), p, p + src.Length());
+			}
+			col.offsets.push_back(static_cast<int32_t>(col.data.size()));
+			return;
+		}
+
+		size_t pos = col.data.size();
+		col.data.resize(pos + col.width);
+		if (isNull) return;
+		if (col.typeId == ArrowTimestamp)
+		{
+			int64_t mks = EpochMicroseconds(*static_cast<const MYSQL_TIME*>(src.buffer));
+			memcpy(&col.data[pos], &mks, sizeof(mks));
+		}
+		else if (col.typeId == ArrowDecimal)
+		{
+			// 128-bit two's complement at the column scale
+			Decimal dec;
+			if (!Decimal::Parse(static_cast<const char*>(src.buffer), src.Length(), &dec))
+				throw std::runtime_error("ExportArrow : bad DECIMAL value in '" + src.name + "'");
+			uint64_t lo;
+			int64_t hi;
+			dec.Rescale(src.scale).Unscaled(lo, hi);
+			memcpy(&col.data[pos], &lo, sizeof(lo));
+			memcpy(&col.data[pos + 8], &hi, sizeof(hi));
+		}
+		else memcpy(&col.data[pos], src.buffer, col.width);
+	}
+
+	static uint32_t ArrowSchema(FlatBuilder &fb, const std::vector<ArrowColumn> &cols)
+	{
+		std::vector<uint32_t> fields;
+		for (const ArrowColumn &col : cols)
+		{
+			uint32_t name = fb.CreateString(col.src->name);
+			uint32_t children = fb.CreateOffsetVector(std::vector<uint32_t>());
+
+			fb.StartTable();
+			if (col.typeId == ArrowInt)
+			{
+				fb.AddScalar<int32_t>(0, col.width * 8);			// bitWidth
+				fb.AddScalar<uint8_t>(1, !col.src->isUnsigned);		// is_signed
+			}
+			else if (col.typeId == ArrowFloatingPoint) fb.AddScalar<int16_t>(0, (col.width == 4) ? 1 : 2);	// SINGLE, DOUBLE
+			else if (col.typeId == ArrowTimestamp) fb.AddScalar<int16_t>(0, 2);							// MICROSECOND
+			else if (col.typeId == ArrowDecimal)
+			{
+				fb.AddScalar<int32_t>(0, static_cast<int32_t>(col.src->precision));
+				fb.AddScalar<int32_t>(1, static_cast<int32_t>(col.src->scale));
+				fb.AddScalar<int32_t>(2, 128);			// bitWidth
+			}
+			uint32_t type = fb.EndTable();
+
+			fb.StartTable();
+			fb.AddOffset(0, name);
+			fb.AddScalar<uint8_t>(1, 1);				// nullable
+			fb.AddScalar<uint8_t>(2, col.typeId);		// type_type
+			fb.AddOffset(3, type);
+			fb.AddOffset(5, children);
+			fields.push_back(fb.EndTable());
+		}
+		uint32_t vec = fb.CreateOffsetVector(fields);
+
+		fb.StartTable();
+		fb.AddScalar<int16_t>(0, 0);		// little endian
+		fb.AddOffset(1, vec);
+		return fb.EndTable();
+	}
+
+	static void AppendPadded(std::string &out, const void *data, size_t len)
+	{
+		out.append(static_cast<const char*>(data), len);
+		out.append((8 - len % 8) % 8, '\0');
+	}
+
+	// encapsulated message: continuation, metadata size, metadata; returns its length
+	static int32_t ArrowMessage(std::string &out, FlatBuilder &fb, uint8_t headerType, uint32_t header, int64_t bodyLength)
+	{
+		fb.StartTable();
+		fb.AddScalar<int64_t>(3, bodyLength);
+		fb.AddOffset(2, header);
+		fb.AddScalar<int16_t>(0, ArrowMetadataV5);
+		fb.AddScalar<uint8_t>(1, headerType);
+		fb.Finish(fb.EndTable());
+
+		uint32_t prefix[2] = { 0xFFFFFFFF, fb.Size() };
+		out.append(reinterpret_cast<const char*>(prefix), sizeof(prefix));
+		out.append(fb.Data());
+		return static_cast<int32_t>(sizeof(prefix) + fb.Size());
+	}
+
+	static ArrowBlock ArrowBatch(AsyncFileWriter &wr, std::vector<ArrowColumn> &cols, int64_t rows)
+	{
+		std::vector<int64_t> nodes;			// FieldNode { length, null_count }
+		std::vector<int64_t> buffers;		// Buffer { offset, length }
+		int64_t bodyLength = 0;
+		auto addBuffer = [&](size_t len)
+		{
+			buffers.push_back(bodyLength);
+			buffers.push_back(static_cast<int64_t>(len));
+			bodyLength += (len + 7) & ~size_t(7);
+		};
+
+		for (ArrowColumn &col : cols)
+		{
+			nodes.push_back(rows);
+			nodes.push_back(col.nullCount);
+			addBuffer(col.validity.size());
+			if (col.width == 0) addBuffer(col.offsets.size() * sizeof(int32_t));
+			addBuffer(col.data.size());
+		}
+
+		FlatBuilder fb;
+		uint32_t nodeVec = fb.CreateStructVector(nodes.data(), 16, nodes.size() / 2);
+		uint32_t bufVec = fb.CreateStructVector(buffers.data(), 16, buffers.size() / 2);
+		fb.StartTable();
+		fb.AddScalar<int64_t>(0, rows);
+		fb.AddOffset(1, nodeVec);
+		fb.AddOffset(2, bufVec);
+		uint32_t batch = fb.EndTable();
+
+		ArrowBlock blk;
+		blk.offset = static_cast<int64_t>(wr.Position());
+		blk.pad = 0;
+		blk.bodyLength = bodyLength;
+
+		std::string &out = wr.Buffer();
+		blk.metaDataLength = ArrowMessage(out, fb, ArrowHeaderRecordBatch, batch, bodyLength);
+		for (ArrowColumn &col : cols)
+		{
+			AppendPadded(out, col.validity.data(), col.validity.size());
+			if (col.width == 0) AppendPadded(out, col.offsets.data(), col.offsets.size() * sizeof(int32_t));
+			AppendPadded(out, col.data.data(), col.data.size());
+			col.Reset();
+		}
+		wr.Commit();
+		return blk;
+	}
+
+	size_t MySqlDataReader::ExportArrow(const std::string &path, uint32_t batchRows)
+	{
+		if (batchRows == 0) batchRows = 65536;
+
+		std::vector<ExportColumn> src = ExportColumns();
+		std::vector<ArrowColumn> cols(src.size());
+		for (size_t i = 0; i < src.size(); i++)
+		{
+			cols[i].src = &src[i];
+			ArrowType(cols[i]);
+			cols[i].Reset();
+		}
+
+		AsyncFileWriter wr(path);
+		wr.Buffer().append("ARROW1\0\0", 8);
+		{
+			FlatBuilder fb;
+			ArrowMessage(wr.Buffer(), fb, ArrowHeaderSchema, ArrowSchema(fb, cols), 0);
+		}
+
+		std::vector<ArrowBlock> blocks;
+		size_t rows = 0;
+		int64_t batch = 0;
+		while (Read())
+		{
+			bool full = false;
+			for (ArrowColumn &col : cols)
+			{
+				ArrowAppend(col, batch);
+				if (col.data.size() > ArrowMaxData) full = true;
+			}
+			rows++;
+			if ((++batch >= batchRows) || full)
+			{
+				blocks.push_back(ArrowBatch(wr, cols, batch));
+				batch = 0;
+			}
+		}
+		if (batch > 0) blocks.push_back(ArrowBatch(wr, cols, batch));
+
+		// end-of-stream marker, footer, footer size, magic
+		std::string &out = wr.Buffer();
+		const uint32_t eos[2] = { 0xFFFFFFFF, 0 };
+		out.append(reinterpret_cast<const char*>(eos), sizeof(eos));
+
+		FlatBuilder fb;
+		uint32_t schema = ArrowSchema(fb, cols);
+		uint32_t dictionaries = fb.CreateStructVector(nullptr, sizeof(ArrowBlock), 0);
+		uint32_t recordBatches = fb.CreateStructVector(blocks.data(), sizeof(ArrowBlock), blocks.size());
+		fb.StartTable();
+		fb.AddOffset(1, schema);
+		fb.AddOffset(2, dictionaries);
+		fb.AddOffset(3, recordBatches);
+		fb.AddScalar<int16_t>(0, ArrowMetadataV5);
+		fb.Finish(fb.EndTable());
+
+		int32_t footerLength = static_cast<int32_t>(fb.Size());
+		out.append(fb.Data());
+		out.append(reinterpret_cast<const char*>(&footerLength), sizeof(footerLength));
+		out.append("ARROW1", 6);
+
+		wr.Close();
+		return rows;
+	}
+}
@@ -0,0 +1,80 @@
+/*
+Site:		http://hlspx.ocry.com/mysqlconnestion/
+
+History:
+			VERSION
+			1.0.0.0
+Author:
+		Alexey Tretyakov	hlspx@mail.ru
+*/
+
+#pragma once
+
+#include <mariadb/mysql.h>
+
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace Kiff {
+
+	//////////////////////////////////////////////////////////////
+	// Double-buffered file writer: the caller fills Buffer() while a background
+	// thread writes the previously filled buffer to the file.
+	class AsyncFileWriter
+	{
+		FILE *file = nullptr;
+		size_t flushSize;
+		std::string bufs[2];
+		std::string *fill;					// filled by the caller
+		std::string *pending = nullptr;		// being written by the thread
+		uint64_t written = 0;				// bytes handed to the thread
+		bool stop = false;
+		bool failed = false;
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::thread thr;
+
+		AsyncFileWriter(const AsyncFileWriter&) = delete;
+		void Run();
+		void Stop();
+	public:
+		AsyncFileWriter(const std::string &path, size_t flushSize = 1 << 20);
+		~AsyncFileWriter();
+
+		std::string &Buffer() { return *fill; }
+
+		// file position of the next byte appended to Buffer()
+		uint64_t Position() const { return written + fill->size(); }
+
+		// hand the buffer to the writer thread once it holds flushSize bytes
+		void Commit()
+		{
+			if (fill->size() >= flushSize) Flush();
+		}
+
+		void Flush();
+		void Close();		// flush, wait for the thread and close the file
+	};
+
+	//////////////////////////////////////////////////////////////
+	// Result column as seen by the exporters: points at the reader's DataStore
+	struct ExportColumn
+	{
+		std::string name;
+		enum_field_types type;
+		bool isUnsigned;
+		bool isBinary;				// binary charset - Arrow Binary instead of Utf8
+		uint32_t precision;			// DECIMAL digits
+		uint32_t scale;				// DECIMAL digits after the point
+		const void *buffer;
+		unsigned long bufferLength;
+		const unsigned long *length;
+		const bool *isNull;
+
+		unsigned long Length() const { return (*length < bufferLength) ? *length : bufferLength; }
+	};
+}
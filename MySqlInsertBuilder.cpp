@@ -0,0 +1,279 @@
+#include "MySqlInsertBuilder.h"
+
+#include <cmath>
+#include <cstdio>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define KIFF_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+namespace Kiff {
+
+	MultiRowInsertBuilder::MultiRowInsertBuilder(MySqlConnection &con, const std::string &table, const std::vector<std::string> &columns, size_t imaxPacket)
+		:conn(con), columnCount(columns.size()), maxPacket(imaxPacket)
+	{
+		if (columns.empty()) throw std::runtime_error("MultiRowInsertBuilder:: no columns");
+
+		if (maxPacket == 0)
+		{
+			MySqlDataReader rd = conn.ExecuteReader("SELECT @@max_allowed_packet");
+			if (!rd.Read()) throw std::runtime_error("MultiRowInsertBuilder:: can't get max_allowed_packet");
+			maxPacket = static_cast<size_t>(rd.GetFieldValue<uint64_t>(0));
+		}
+
+		// multibyte charsets whose trailing bytes may be 0x5c need the server-aware escaping
+		static const char *unsafe[] = { "big5", "cp932", "gbk", "sjis", "gb18030" };
+		std::string csname = mysql_character_set_name(conn.mysql);
+		bytewiseEscape = (conn.mysql->server_status & SERVER_STATUS_NO_BACKSLASH_ESCAPES) == 0;
+		for (const char *cs : unsafe)
+		{
+			if (csname == cs) bytewiseEscape = false;
+		}
+
+		query = "INSERT INTO " + MySqlConnection::QuoteIdentifier(table) + " (";
+		for (size_t i = 0; i < columns.size(); i++)
+		{
+			if (i != 0) query += ',';
+			query += MySqlConnection::QuoteIdentifier(columns[i]);
+		}
+		query += ") VALUES ";
+		headerLength = query.size();
+	}
+
+	void MultiRowInsertBuilder::OnDuplicateKeyUpdate(const std::vector<std::string> &columns)
+	{
+		tail.clear();
+		for (size_t i = 0; i < columns.size(); i++)
+		{
+			std::string col = MySqlConnection::QuoteIdentifier(columns[i]);
+			tail += (i == 0) ? " ON DUPLICATE KEY UPDATE " : ",";
+			tail += col + "=VALUES(" + col + ")";
+		}
+	}
+
+	void MultiRowInsertBuilder::BeginRow()
+	{
+		if (rows != 0) query += ',';
+		query += '(';
+	}
+
+	// row at mark does not fit: send what is before it and start over with it
+	void MultiRowInsertBuilder::EndRow(size_t mark)
+	{
+		if (query.size() + tail.size() < maxPacket)
+		{
+			rows++;
+			return;
+		}
+		if (rows == 0)
+		{
+			query.resize(headerLength);
+			throw std::runtime_error("MultiRowInsertBuilder:: row exceeds max_allowed_packet");
+		}
+
+		rowTmp.assign(query, mark + 1, std::string::npos);		// without ','
+		query.resize(mark);
+		Execute();
+		query += rowTmp;
+		if (query.size() + tail.size() >= maxPacket)
+		{
+			query.resize(headerLength);
+			throw std::runtime_error("MultiRowInsertBuilder:: row exceeds max_allowed_packet");
+		}
+		rows = 1;
+	}
+
+	void MultiRowInsertBuilder::Execute()
+	{
+		query += tail;
+		try
+		{
+			affectedRows += conn.ExecuteNonQuery(query);
+		}
+		catch (...)
+		{
+			query.resize(headerLength);
+			rows = 0;
+			throw;
+		}
+		query.resize(headerLength);
+		rows = 0;
+	}
+
+	size_t MultiRowInsertBuilder::Flush()
+	{
+		if (rows != 0) Execute();
+		size_t ret = affectedRows;
+		affectedRows = 0;
+		return ret;
+	}
+
+	void MultiRowInsertBuilder::AppendInt(int64_t value)
+	{
+		char tmp[24];
+		char *end = tmp + sizeof(tmp), *p = end;
+		uint64_t v = (value < 0) ? 0 - (uint64_t)value : (uint64_t)value;
+		do
+		{
+			*--p = char('0' + v % 10);
+			v /= 10;
+		} while (v != 0);
+		if (value < 0) *--p = '-';
+		query.append(p, end - p);
+	}
+
+	void MultiRowInsertBuilder::AppendUInt(uint64_t value)
+	{
+		char tmp[24];
+		char *end = tmp + sizeof(tmp), *p = end;
+		do
+		{
+			*--p = char('0' + value % 10);
+			value /= 10;
+		} while (value != 0);
+		query.append(p, end - p);
+	}
+
+	void MultiRowInsertBuilder::Append(double value)
+	{
+		if (!std::isfinite(value)) throw std::runtime_error("MultiRowInsertBuilder:: value is not finite");
+		char tmp[32];
+#ifdef _WIN32
+#pragma warning (disable:4996)
+#endif
+		int n = snprintf(tmp, sizeof(tmp), "%.17g", value);
+#ifdef _WIN32
+#pragma warning (default:4996)
+#endif
+		query.append(tmp, n);
+	}
+
+	void MultiRowInsertBuilder::Append(const char *value)
+	{
+		if (value == nullptr)
+		{
+			query += "NULL";
+			return;
+		}
+		query += '\'';
+		AppendEscaped(value, strlen(value));
+		query += '\'';
+	}
+
+	void MultiRowInsertBuilder::Append(const std::string &value)
+	{
+		query += '\'';
+		AppendEscaped(value.data(), value.length());
+		query += '\'';
+	}
+
+	// blobs as hex literal - no escaping
+	void MultiRowInsertBuilder::Append(const std::vector<uint8_t> &value)
+	{
+		static const char hex[] = "0123456789ABCDEF";
+		query += "X'";
+		size_t pos = query.size();
+		query.resize(pos + value.size() * 2);
+		for (uint8_t b : value)
+		{
+			query[pos++] = hex[b >> 4];
+			query[pos++] = hex[b & 0xf];
+		}
+		query += '\'';
+	}
+
+	void MultiRowInsertBuilder::Append(const TmDateTime &value)
+	{
+		tm intim = value.ToTm();
+		int mks = static_cast<int>((std::abs(value.Ticks()) % 1000000000LL) / 1000);
+		char tmp[40];
+#ifdef _WIN32
+#pragma warning (disable:4996)
+#endif
+		int n = snprintf(tmp, sizeof(tmp), "'%04d-%02d-%02d %02d:%02d:%02d.%06d'",
+			intim.tm_year + 1900, intim.tm_mon + 1, intim.tm_mday, intim.tm_hour, intim.tm_min, intim.tm_sec, mks);
+#ifdef _WIN32
+#pragma warning (default:4996)
+#endif
+		query.append(tmp, n);
+	}
+
+	void MultiRowInsertBuilder::Append(const Decimal &value)
+	{
+		char tmp[Decimal::MaxChars];
+		query.append(tmp, value.Format(tmp));
+	}
+
+	// same escapes as mysql_real_escape_string for single-byte safe charsets
+	static inline const char *EscapeOf(char c)
+	{
+		switch (c)
+		{
+		case '\0':		return "\\0";
+		case '\n':		return "\\n";
+		case '\r':		return "\\r";
+		case '\\':		return "\\\\";
+		case '\'':		return "\\'";
+		case '"':		return "\\\"";
+		case '\x1a':	return "\\Z";
+		default:		return nullptr;
+		}
+	}
+
+	void MultiRowInsertBuilder::AppendEscaped(const char *s, size_t len)
+	{
+		if (!bytewiseEscape)
+		{
+			size_t pos = query.size();
+			query.resize(pos + len * 2 + 1);
+			unsigned long n = mysql_real_escape_string(conn.mysql, &query[pos], s, static_cast<unsigned long>(len));
+			query.resize(pos + n);
+			return;
+		}
+
+		size_t i = 0;
+#ifdef KIFF_SSE2
+		// 16 bytes at a time; copy clean blocks, escape up to the first special byte
+		const __m128i c0 = _mm_setzero_si128();
+		const __m128i cn = _mm_set1_epi8('\n');
+		const __m128i cr = _mm_set1_epi8('\r');
+		const __m128i cb = _mm_set1_epi8('\\');
+		const __m128i cq = _mm_set1_epi8('\'');
+		const __m128i cd = _mm_set1_epi8('"');
+		const __m128i cz = _mm_set1_epi8('\x1a');
+		while (i + 16 <= len)
+		{
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+			__m128i m = _mm_or_si128(
+				_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, c0), _mm_cmpeq_epi8(v, cn)), _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, cb))),
+				_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, cq), _mm_cmpeq_epi8(v, cd)), _mm_cmpeq_epi8(v, cz)));
+			unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(m));
+			if (mask == 0)
+			{
+				query.append(s + i, 16);
+				i += 16;
+				continue;
+			}
+#ifdef _MSC_VER
+			unsigned long k;
+			_BitScanForward(&k, mask);
+#else
+			unsigned k = static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+			query.append(s + i, k);
+			query += EscapeOf(s[i + k]);
+			i += k + 1;
+		}
+#endif
+		for (; i < len; i++)
+		{
+			const char *esc = EscapeOf(s[i]);
+			if (esc == nullptr) query += s[i];
+			else query += esc;
+		}
+	}
+}
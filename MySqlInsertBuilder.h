@@ -0,0 +1,113 @@
+/*
+Site:		http://hlspx.ocry.com/mysqlconnestion/
+
+History:
+			VERSION
+			1.0.0.0
+Author:
+		Alexey Tretyakov	hlspx@mail.ru
+*/
+
+#pragma once
+
+#include "MySqlConnection.h"
+
+#include <type_traits>
+
+namespace Kiff {
+
+	//////////////////////////////////////////////////////////////
+	// Text INSERT ... VALUES (...),(...) for servers/proxies without binary bulk execution.
+	// Rows are serialized into one reusable buffer; the statement is executed when the
+	// next row would exceed max_allowed_packet and by Flush().
+	class MultiRowInsertBuilder
+	{
+		MySqlConnection &conn;
+		size_t columnCount;
+		size_t maxPacket;
+		size_t headerLength;
+		std::string query;				// header + rows
+		std::string tail;				// ON DUPLICATE KEY UPDATE ...
+		std::string rowTmp;				// row moved to the next statement
+		size_t rows = 0;
+		size_t affectedRows = 0;
+		bool bytewiseEscape;			// charset without 0x5c in multibyte chars, backslash escapes on
+
+		MultiRowInsertBuilder(const MultiRowInsertBuilder&) = delete;
+
+		void AppendEscaped(const char *s, size_t len);
+		void BeginRow();
+		void EndRow(size_t mark);
+		void Execute();
+
+		void Append(std::nullptr_t) { query += "NULL"; }
+
+		template<typename T>
+		typename std::enable_if<std::is_integral<T>::value>::type Append(T value)
+		{
+			if (std::is_signed<T>::value) AppendInt(static_cast<int64_t>(value));
+			else AppendUInt(static_cast<uint64_t>(value));
+		}
+
+		void AppendInt(int64_t value);
+		void AppendUInt(uint64_t value);
+		void Append(double value);
+		void Append(float value) { Append(static_cast<double>(value)); }
+		void Append(const char *value);
+		void Append(const std::string &value);
+		void Append(const std::vector<uint8_t> &value);
+		void Append(const TmDateTime &value);
+		void Append(const Decimal &value);
+
+		void AppendValues(size_t) {}
+
+		template<typename T, typename... Targs>
+		void AppendValues(size_t pos, T&& val, Targs&& ... Fargs)
+		{
+			if (pos != 0) query += ',';
+			Append(val);
+			AppendValues(pos + 1, Fargs...);
+		}
+
+	public:
+		// maxPacket = 0 - use the server's max_allowed_packet
+		MultiRowInsertBuilder(MySqlConnection &con, const std::string &table, const std::vector<std::string> &columns, size_t maxPacket = 0);
+		~MultiRowInsertBuilder() {}
+
+		// ON DUPLICATE KEY UPDATE `col`=VALUES(`col`), ...
+		void OnDuplicateKeyUpdate(const std::vector<std::string> &columns);
+
+		template<typename... Targs>
+		void AddRow(Targs&& ... Fargs)
+		{
+			if (sizeof...(Fargs) != columnCount)
+				throw std::runtime_error("MultiRowInsertBuilder:: " + std::to_string(sizeof...(Fargs)) + " values for " + std::to_string(columnCount) + " columns");
+			size_t mark = query.size();
+			try
+			{
+				BeginRow();
+				AppendValues(0, Fargs...);
+				query += ')';
+			}
+			catch (...)
+			{
+				query.resize(mark);
+				throw;
+			}
+			EndRow(mark);
+		}
+
+		size_t Pending() const { return rows; }
+
+		// drop buffered rows without executing them
+		void Clear()
+		{
+			query.resize(headerLength);
+			rows = 0;
+		}
+		size_t AffectedRows() const { return affectedRows; }
+
+		// execute buffered rows, return affected rows since the previous Flush
+		size_t Flush();
+	};
+}
@@ -0,0 +1,200 @@
+#include "MySqlKeyset.h"
+
+#include <algorithm>
+#include <cctype>
+
+namespace Kiff {
+
+	static bool IsWordChar(char c)
+	{
+		return isalnum(static_cast<unsigned char>(c)) || (c == '_') || (c == '$');
+	}
+
+	// position of a keyword outside quotes and parentheses, npos if there is none
+	static size_t TopLevel(const std::string &query, const std::string &word)
+	{
+		int depth = 0;
+		char quote = 0;
+		for (size_t i = 0; i < query.length(); i++)
+		{
+			char c = query[i];
+			if (quote != 0)
+			{
+				if ((c == '\\') && (quote != '`')) i++;
+				else if (c == quote) quote = 0;
+				continue;
+			}
+			if ((c == '\'') || (c == '"') || (c == '`')) quote = c;
+			else if (c == '(') depth++;
+			else if (c == ')') depth--;
+			else if ((depth == 0) && ((i == 0) || !IsWordChar(query[i - 1])) && (query.length() - i >= word.length())
+				&& ((i + word.length() == query.length()) || !IsWordChar(query[i + word.length()])))
+			{
+				size_t j = 0;
+				while ((j < word.length()) && (toupper(static_cast<unsigned char>(query[i + j])) == word[j])) j++;
+				if (j == word.length()) return i;
+			}
+		}
+		return std::string::npos;
+	}
+
+	// base [WHERE (cond) AND] (k1, k2) > (?, ?) ORDER BY k1, k2 LIMIT ?
+	static std::string PageQuery(std::string base, const std::vector<std::string> &keys, bool descending, bool bounded)
+	{
+		if (keys.empty()) throw std::runtime_error("KeysetPager : no key columns");
+		while (!base.empty() && (isspace(static_cast<unsigned char>(base.back())) || (base.back() == ';'))) base.pop_back();
+		for (const char *word : { "ORDER", "GROUP", "HAVING", "LIMIT", "UNION" })
+			if (TopLevel(base, word) != std::string::npos) throw std::runtime_error(std::string("KeysetPager : base query has a top-level ") + word);
+
+		std::string cols, marks, order;
+		for (size_t i = 0; i < keys.size(); i++)
+		{
+			const char *sep = (i == 0) ? "" : ", ";
+			cols.append(sep).append(keys[i]);
+			marks.append(sep).append("?");
+			order.append(sep).append(keys[i]).append(descending ? " DESC" : "");
+		}
+
+		if (bounded)
+		{
+			std::string op = descending ? " < " : " > ";
+			std::string bound = (keys.size() == 1) ? keys[0] + op + "?" : "(" + cols + ")" + op + "(" + marks + ")";
+			size_t where = TopLevel(base, "WHERE");
+			if (where == std::string::npos) base.append(" WHERE ").append(bound);
+			else
+			{
+				size_t cond = base.find_first_not_of(" \t\r\n", where + 5);
+				base = base.substr(0, where) + "WHERE (" + base.substr(cond) + ") AND " + bound;
+			}
+		}
+		return base + " ORDER BY " + order + " LIMIT ?";
+	}
+
+	// "t.`id`" -> "id"
+	static std::string ColumnName(const std::string &key)
+	{
+		std::string name = key.substr(key.find_last_of('.') + 1);
+		name.erase(std::remove(name.begin(), name.end(), '`'), name.end());
+		return name;
+	}
+
+	///////////////////////////////////////////
+	KeysetPager::KeysetPager(MySqlConnection &iconn, const std::string &baseQuery, const std::vector<std::string> &ikeys,
+		uint32_t ipageSize, bool descending, bool iprefetch)
+		:keys(ikeys), pageSize(ipageSize), prefetch(iprefetch), first(iconn.CreateCommand(PageQuery(baseQuery, ikeys, descending, false)))
+	{
+		if (pageSize == 0) throw std::runtime_error("KeysetPager : page size is 0");
+		std::string query = PageQuery(baseQuery, keys, descending, true);
+		next[0].reset(new MySqlCommand(iconn.CreateCommand(query)));
+		if (prefetch)
+		{
+			side.reset(new MySqlConnection(iconn.connStr));
+			side->readerOptions = iconn.readerOptions;
+			next[1].reset(new MySqlCommand(side->CreateCommand(query)));
+		}
+	}
+
+	MySqlCommand &KeysetPager::Next()
+	{
+		if (!next[1]) return *next[0];
+		MySqlCommand &cmd = *next[turn];
+		turn ^= 1;
+		return cmd;
+	}
+
+	void KeysetPager::Capture(const MySqlDataReader &rd, Key &key) const
+	{
+		key.resize(keyPos.size());
+		for (size_t i = 0; i < keyPos.size(); i++)
+		{
+			const DataStore &ds = rd.results[keyPos[i]];
+			if (ds.is_null) throw std::runtime_error("KeysetPager : key column '" + keys[i] + "' is NULL");
+			key[i].first = ds.buffer_type;
+			key[i].second.assign(static_cast<const char*>(ds.buffer), (ds.length < ds.buffer_length) ? ds.length : ds.buffer_length);
+		}
+	}
+
+	// a stored page's last key is read before its rows, so the next page can start at once
+	// on the other connection
+	std::unique_ptr<KeysetPager::Page> KeysetPager::Load(MySqlCommand &cmd, const Key *after)
+	{
+		uint32_t pos = 0;
+		if (after != nullptr)
+		{
+			for (const auto &k : *after)
+			{
+				cmd.BindParam(pos, k.first);
+				cmd.SetValue(pos++, k.second.data(), k.second.length());
+			}
+		}
+		cmd.SetValue(pos, pageSize);
+
+		std::unique_ptr<Page> pg(new Page);
+		pg->reader.reset(new MySqlDataReader(cmd.ExecuteReader()));
+		MySqlDataReader &rd = *pg->reader;
+		if (keyPos.empty())
+		{
+			for (const std::string &key : keys) keyPos.push_back(rd.PosFromName(ColumnName(key)));
+		}
+
+		if (!rd.prefetch && !rd.spool)
+		{
+			pg->count = mysql_stmt_num_rows(rd.smnt);
+			if (pg->count != 0)
+			{
+				mysql_stmt_data_seek(rd.smnt, pg->count - 1);
+				if (mysql_stmt_fetch(rd.smnt) != 0) throw std::runtime_error(mysql_stmt_error(rd.smnt));
+				Capture(rd, pg->last);
+				mysql_stmt_data_seek(rd.smnt, 0);
+			}
+			pg->lastKnown = true;
+		}
+		return pg;
+	}
+
+	void KeysetPager::Ahead()
+	{
+		if (!prefetch || !page->lastKnown || (page->count < pageSize)) return;
+		MySqlCommand &cmd = Next();
+		Key key = page->last;
+		ahead = std::async(std::launch::async, [this, &cmd, key]() { return Load(cmd, &key); });
+	}
+
+	bool KeysetPager::Read()
+	{
+		if (!started)
+		{
+			started = true;
+			page = Load(first, nullptr);
+			pages++;
+			Ahead();
+		}
+
+		while (page)
+		{
+			if (page->reader->Read())
+			{
+				page->rows++;
+				if (!page->lastKnown) Capture(*page->reader, page->last);
+				return true;
+			}
+
+			// a short page is the last one
+			if (page->rows < pageSize)
+			{
+				page.reset();
+				break;
+			}
+			if (ahead.valid()) page = ahead.get();
+			else
+			{
+				Key key = std::move(page->last);
+				page.reset();
+				page = Load(Next(), &key);
+			}
+			pages++;
+			Ahead();
+		}
+		return false;
+	}
+}
@@ -0,0 +1,111 @@
+/*
+Site:		http://hlspx.ocry.com/mysqlconnestion/
+
+History:
+			VERSION
+			1.0.0.0
+Author:
+		Alexey Tretyakov	hlspx@mail.ru
+*/
+
+#pragma once
+
+#include "MySqlConnection.h"
+
+#include <future>
+
+namespace Kiff {
+
+	//////////////////////////////////////////////////////////////
+	// Rows of a large table page by page without OFFSET: each page is
+	//   base [WHERE (cond) AND] (k1, k2) > (?, ?) ORDER BY k1, k2 LIMIT ?
+	// on a prepared statement, bound to the last key of the page before. Read() streams
+	// all pages as one result; accessors are the page reader's.
+	//
+	// The base query is "SELECT ... FROM ... [WHERE ...]" without ORDER BY, GROUP BY or LIMIT.
+	// Key columns must be unique together, non-NULL and in the select list ("t.id" is found
+	// as "id"). With prefetch every other page runs on a second connection the pager opens with
+	// the same connection string, so the next page executes while the current one is read; that
+	// connection is outside the caller's transaction and session variables. The caller's
+	// connection must not be used until Read returns false or the pager is destroyed.
+	class KeysetPager
+	{
+		typedef std::vector<std::pair<MySqlDbType, std::string>> Key;		// bound as read
+
+		struct Page
+		{
+			std::unique_ptr<MySqlDataReader> reader;
+			Key last;							// key of the last row
+			bool lastKnown = false;				// stored result: read ahead of the rows
+			uint64_t count = 0;					// rows in a stored result
+			uint64_t rows = 0;					// rows read
+		};
+
+		std::vector<std::string> keys;
+		std::vector<uint32_t> keyPos;
+		uint32_t pageSize;
+		bool prefetch;
+		std::unique_ptr<MySqlConnection> side;	// look-ahead pages with prefetch
+		MySqlCommand first;
+		std::unique_ptr<MySqlCommand> next[2];	// caller's and side connection: one is read while the other runs ahead
+		size_t turn = 1;						// the page after the first runs on the side connection
+		bool started = false;
+		uint64_t pages = 0;
+
+		std::unique_ptr<Page> page;
+		std::future<std::unique_ptr<Page>> ahead;		// last member: waited for before the rest goes
+
+		KeysetPager(const KeysetPager&) = delete;
+		std::unique_ptr<Page> Load(MySqlCommand &cmd, const Key *after);
+		void Capture(const MySqlDataReader &rd, Key &key) const;
+		void Ahead();
+		MySqlCommand &Next();
+
+		const MySqlDataReader &Current() const
+		{
+			if (!page) throw std::runtime_error("KeysetPager : no current row");
+			return *page->reader;
+		}
+	public:
+		KeysetPager(MySqlConnection &iconn, const std::string &baseQuery, const std::vector<std::string> &ikeys,
+			uint32_t ipageSize, bool descending = false, bool iprefetch = false);
+
+		bool Read();
+
+		// pages executed so far
+		uint64_t Pages() const { return pages; }
+
+		bool IsNull(uint32_t pos) const { return Current().IsNull(pos); }
+		bool IsNull(const std::string &name) const { return Current().IsNull(name); }
+
+		template<typename T>
+		T GetFieldValue(uint32_t pos) const
+		{
+			return Current().GetFieldValue<T>(pos);
+		}
+
+		template<typename T>
+		T GetFieldValue(const std::string &name) const
+		{
+			return Current().GetFieldValue<T>(name);
+		}
+
+		template<typename T>
+		Nullable<T> GetNullable(uint32_t pos) const
+		{
+			return Current().GetNullable<T>(pos);
+		}
+
+		template<typename T>
+		Nullable<T> GetNullable(const std::string &name) const
+		{
+			return Current().GetNullable<T>(name);
+		}
+
+		template<typename... Targs>
+		void GetValues(Targs&& ... Fargs) const
+		{
+			Current().GetValues(Fargs...);
+		}
+	};
+}
@@ -0,0 +1,162 @@
+#include "MySqlParallel.h"
+
+namespace Kiff {
+
+	template<>
+	std::string MySqlRow::GetFieldValue<std::string>(uint32_t pos) const
+	{
+		const RowBlock::Cell &c = Value(pos);
+		return std::string(data + c.offset, c.length);
+	}
+
+	template<>
+	std::vector<uint8_t> MySqlRow::GetFieldValue<std::vector<uint8_t>>(uint32_t pos) const
+	{
+		const RowBlock::Cell &c = Value(pos);
+		const uint8_t *buf = reinterpret_cast<const uint8_t*>(data) + c.offset;
+		return std::vector<uint8_t>(buf, buf + c.length);
+	}
+
+	template<>
+	TmDateTime MySqlRow::GetFieldValue<TmDateTime>(uint32_t pos) const
+	{
+		MYSQL_TIME sqtm = GetFieldValue<MYSQL_TIME>(pos);
+		uint32_t mls = sqtm.second_part / 1000;
+		uint32_t mks = sqtm.second_part % 1000;
+		return TmDateTime(sqtm.year, sqtm.month, sqtm.day, sqtm.hour, sqtm.minute, sqtm.second, mls, mks, 0);
+	}
+
+	template<>
+	Decimal MySqlRow::GetFieldValue<Decimal>(uint32_t pos) const
+	{
+		const RowBlock::Cell &c = Value(pos);
+		Decimal dec;
+		if (!Decimal::Parse(data + c.offset, c.length, &dec))
+			throw std::runtime_error(std::string("Field '").append(std::to_string(pos)).append("' is not a decimal"));
+		return dec;
+	}
+
+	///////////////////////////////////////////
+	bool RowBatchQueue::Push(Batch &&batch)
+	{
+		std::unique_lock<std::mutex> lk(mtx);
+		notFull.wait(lk, [this] { return closed || items.size() < capacity; });
+		if (closed) return false;
+		items.push_back(std::move(batch));
+		notEmpty.notify_one();
+		return true;
+	}
+
+	bool RowBatchQueue::Pop(Batch &batch)
+	{
+		std::unique_lock<std::mutex> lk(mtx);
+		notEmpty.wait(lk, [this] { return closed || !items.empty(); });
+		if (items.empty()) return false;
+		batch = std::move(items.front());
+		items.pop_front();
+		notFull.notify_one();
+		return true;
+	}
+
+	void RowBatchQueue::Close()
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		closed = true;
+		notEmpty.notify_all();
+		notFull.notify_all();
+	}
+
+	RowBatchQueue::Batch RowBatchQueue::Spare()
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		if (spare.empty()) return Batch();
+		Batch b = std::move(spare.back());
+		spare.pop_back();
+		return b;
+	}
+
+	void RowBatchQueue::Recycle(Batch &&batch)
+	{
+		batch.block.Clear();
+		std::lock_guard<std::mutex> lk(mtx);
+		if (spare.size() < capacity) spare.push_back(std::move(batch));
+	}
+
+	///////////////////////////////////////////
+	RowWorkers::RowWorkers(RowBatchQueue &iqueue, uint32_t count, std::function<void(RowBatchQueue::Batch&)> work, std::function<void()> onError)
+		:queue(iqueue)
+	{
+		for (uint32_t i = 0; i < count; i++)
+		{
+			threads.emplace_back([this, work, onError]
+			{
+				RowBatchQueue::Batch b;
+				while (queue.Pop(b))
+				{
+					try
+					{
+						work(b);
+					}
+					catch (...)
+					{
+						{
+							std::lock_guard<std::mutex> lk(mtx);
+							if (!error) error = std::current_exception();
+						}
+						queue.Close();
+						if (onError) onError();
+					}
+					queue.Recycle(std::move(b));
+				}
+			});
+		}
+	}
+
+	RowWorkers::~RowWorkers()
+	{
+		queue.Close();
+		for (auto &thr : threads)
+			if (thr.joinable()) thr.join();
+	}
+
+	uint32_t RowWorkers::Count(uint32_t threads)
+	{
+		if (threads != 0) return threads;
+		unsigned hw = std::thread::hardware_concurrency();
+		return (hw == 0) ? 1 : hw;
+	}
+
+	void RowWorkers::Join()
+	{
+		for (auto &thr : threads)
+			if (thr.joinable()) thr.join();
+		if (error) std::rethrow_exception(error);
+	}
+
+	///////////////////////////////////////////
+	// the calling thread reads and packs rows; stops early when a worker failed
+	size_t MySqlDataReader::Scatter(RowBatchQueue &queue, uint32_t batchRows, uint64_t &batches, const std::function<void(uint64_t)> &pushed)
+	{
+		if (batchRows == 0) batchRows = 1;
+		size_t rows = 0;
+		batches = 0;
+		RowBatchQueue::Batch b = queue.Spare();
+		while (Read())
+		{
+			b.block.Append(results, fieldCount);
+			rows++;
+			if (b.block.rows < batchRows) continue;
+
+			b.seq = batches++;
+			if (!queue.Push(std::move(b))) return rows;
+			if (pushed) pushed(batches);
+			b = queue.Spare();
+		}
+		if (b.block.rows > 0)
+		{
+			b.seq = batches++;
+			if (queue.Push(std::move(b)) && pushed) pushed(batches);
+		}
+		return rows;
+	}
+}
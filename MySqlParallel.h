@@ -0,0 +1,254 @@
+/*
+Site:		http://hlspx.ocry.com/mysqlconnestion/
+
+History:
+			VERSION
+			1.0.0.0
+Author:
+		Alexey Tretyakov	hlspx@mail.ru
+*/
+
+#pragma once
+
+#include "MySqlPrefetch.h"
+
+#include <deque>
+#include <exception>
+#include <type_traits>
+
+namespace Kiff {
+
+	//////////////////////////////////////////////////////////////
+	// One row of a batch with the reader's accessors; valid while the callback runs.
+	class MySqlRow
+	{
+		const RowBlock::Cell *cells;
+		const char *data;
+		uint32_t fieldCount;
+		const MySqlDataReader *reader;		// field names
+
+		template<typename T>
+		void GetRefValue(uint32_t pos, T& value) const
+		{
+			value = GetFieldValue<T>(pos);
+		}
+
+		void GetRefValues(uint32_t) const {}
+
+		template<typename T, typename... Targs>
+		void GetRefValues(uint32_t pos, T&& val, Targs&& ... Fargs) const
+		{
+			GetRefValue(pos, val);
+			GetRefValues(++pos, Fargs...);
+		}
+
+		const RowBlock::Cell &Value(uint32_t pos) const
+		{
+			if (pos >= fieldCount) throw std::runtime_error("MySqlRow:: Wrong param index '" + std::to_string(pos) + "' in GetFieldValue");
+			if (cells[pos].is_null) throw std::runtime_error("Field '" + std::to_string(pos) + "' is NULL");
+			return cells[pos];
+		}
+	public:
+		MySqlRow(const RowBlock &block, uint32_t row, uint32_t ifieldCount, const MySqlDataReader &ireader)
+			:cells(&block.cells[static_cast<size_t>(row) * ifieldCount]), data(block.data.data()), fieldCount(ifieldCount), reader(&ireader) {}
+
+		uint32_t FieldCount() const { return fieldCount; }
+
+		bool IsNull(uint32_t pos) const
+		{
+			if (pos >= fieldCount) throw std::runtime_error("MySqlRow:: Wrong param index '" + std::to_string(pos) + "' in IsNull");
+			return cells[pos].is_null;
+		}
+
+		bool IsNull(const std::string &name) const
+		{
+			return IsNull(reader->PosFromName(name));
+		}
+
+		// values are packed without alignment: copied, not dereferenced in place
+		template<typename T>
+		T GetFieldValue(uint32_t pos) const
+		{
+			const RowBlock::Cell &c = Value(pos);
+			T value = T();
+			memcpy(&value, data + c.offset, (c.length < sizeof(T)) ? c.length : sizeof(T));
+			return value;
+		}
+
+		template<typename T>
+		T GetFieldValue(const std::string &name) const
+		{
+			return GetFieldValue<T>(reader->PosFromName(name));
+		}
+
+		void GetFieldValue(uint32_t pos, const void **obuf, uint32_t *olen) const
+		{
+			const RowBlock::Cell &c = Value(pos);
+			*obuf = data + c.offset;
+			*olen = c.length;
+		}
+
+		template<typename... Targs>
+		void GetValues(Targs&& ... Fargs) const
+		{
+			GetRefValues(0, Fargs...);
+		}
+	};
+
+	template<>
+	std::string MySqlRow::GetFieldValue<std::string>(uint32_t pos) const;
+	template<>
+	std::vector<uint8_t> MySqlRow::GetFieldValue<std::vector<uint8_t>>(uint32_t pos) const;
+	template<>
+	TmDateTime MySqlRow::GetFieldValue<TmDateTime>(uint32_t pos) const;
+	template<>
+	Decimal MySqlRow::GetFieldValue<Decimal>(uint32_t pos) const;
+
+	//////////////////////////////////////////////////////////////
+	// Bounded queue of row batches from the reading thread to the workers.
+	// Batches are recycled so their buffers are allocated once per worker, not per batch.
+	class RowBatchQueue
+	{
+	public:
+		struct Batch
+		{
+			uint64_t seq = 0;
+			RowBlock block;
+		};
+	private:
+		std::deque<Batch> items;
+		std::vector<Batch> spare;
+		size_t capacity;
+		bool closed = false;
+		std::mutex mtx;
+		std::condition_variable notEmpty;
+		std::condition_variable notFull;
+
+		RowBatchQueue(const RowBatchQueue&) = delete;
+	public:
+		explicit RowBatchQueue(size_t icapacity) :capacity(icapacity == 0 ? 1 : icapacity) {}
+
+		// blocks while full; false once closed
+		bool Push(Batch &&batch);
+
+		// blocks while empty; false when closed and drained
+		bool Pop(Batch &batch);
+
+		// wakes everyone; Push fails, Pop drains what is queued
+		void Close();
+
+		Batch Spare();
+		void Recycle(Batch &&batch);
+	};
+
+	// worker threads running work on each popped batch; the first exception closes the queue
+	class RowWorkers
+	{
+		RowBatchQueue &queue;
+		std::vector<std::thread> threads;
+		std::mutex mtx;
+		std::exception_ptr error;
+
+		RowWorkers(const RowWorkers&) = delete;
+	public:
+		RowWorkers(RowBatchQueue &iqueue, uint32_t count, std::function<void(RowBatchQueue::Batch&)> work, std::function<void()> onError = nullptr);
+		~RowWorkers();
+
+		static uint32_t Count(uint32_t threads);
+
+		// after the queue is closed: waits for the workers, rethrows the first exception
+		void Join();
+	};
+
+	// per-batch results reassembled in batch order for the reading thread
+	template<typename R>
+	class OrderedResults
+	{
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::map<uint64_t, std::vector<R>> ready;
+		uint64_t next = 0;
+		bool aborted = false;
+	public:
+		void Put(uint64_t seq, std::vector<R> &&results)
+		{
+			std::lock_guard<std::mutex> lk(mtx);
+			ready.emplace(seq, std::move(results));
+			cv.notify_all();
+		}
+
+		void Abort()
+		{
+			std::lock_guard<std::mutex> lk(mtx);
+			aborted = true;
+			cv.notify_all();
+		}
+
+		// hand ready batches to sink in order, waiting until batches before 'upto' are done; false if aborted
+		template<typename Sink>
+		bool Deliver(Sink &sink, uint64_t upto)
+		{
+			for (;;)
+			{
+				std::vector<R> results;
+				{
+					std::unique_lock<std::mutex> lk(mtx);
+					cv.wait(lk, [&] { return aborted || next >= upto || ready.count(next) != 0; });
+					if (aborted) return false;
+					auto it = ready.find(next);
+					if (it == ready.end()) return true;
+					results = std::move(it->second);
+					ready.erase(it);
+					next++;
+				}
+				for (R &r : results) sink(std::move(r));
+			}
+		}
+	};
+
+	///////////////////////////////////////////
+	template<typename Fn>
+	size_t MySqlDataReader::ParallelForEach(Fn fn, uint32_t threads, uint32_t batchRows)
+	{
+		uint32_t count = RowWorkers::Count(threads);
+		RowBatchQueue queue(count * 2);
+		RowWorkers workers(queue, count, [&](RowBatchQueue::Batch &b)
+		{
+			for (uint32_t r = 0; r < b.block.rows; r++) fn(MySqlRow(b.block, r, fieldCount, *this));
+		});
+
+		uint64_t batches;
+		size_t rows = Scatter(queue, batchRows, batches, nullptr);
+		queue.Close();
+		workers.Join();
+		return rows;
+	}
+
+	template<typename Fn, typename Sink>
+	size_t MySqlDataReader::ParallelForEachOrdered(Fn fn, Sink sink, uint32_t threads, uint32_t batchRows)
+	{
+		typedef typename std::result_of<Fn&(const MySqlRow&)>::type R;
+
+		uint32_t count = RowWorkers::Count(threads);
+		OrderedResults<R> done;
+		RowBatchQueue queue(count * 2);
+		RowWorkers workers(queue, count, [&](RowBatchQueue::Batch &b)
+		{
+			std::vector<R> out;
+			out.reserve(b.block.rows);
+			for (uint32_t r = 0; r < b.block.rows; r++) out.push_back(fn(MySqlRow(b.block, r, fieldCount, *this)));
+			done.Put(b.seq, std::move(out));
+		}, [&] { done.Abort(); });
+
+		// results of at most 'window' batches wait for an earlier one
+		uint64_t window = static_cast<uint64_t>(count) * 4, batches;
+		size_t rows = Scatter(queue, batchRows, batches, [&](uint64_t pushed)
+		{
+			if (pushed > window) done.Deliver(sink, pushed - window);
+		});
+		queue.Close();
+		done.Deliver(sink, batches);
+		workers.Join();
+		return rows;
+	}
+}
@@ -0,0 +1,126 @@
+#include "MySqlPrefetch.h"
+
+namespace Kiff {
+
+	void RowBlock::Append(const DataStore *stores, uint32_t fieldCount)
+	{
+		for (uint32_t i = 0; i < fieldCount; i++)
+		{
+			const DataStore &ds = stores[i];
+			Cell c = { static_cast<uint32_t>(data.size()), 0, ds.is_null };
+			if (!ds.is_null)
+			{
+				c.length = static_cast<uint32_t>(ds.length < ds.buffer_length ? ds.length : ds.buffer_length);
+				data.append(static_cast<const char*>(ds.buffer), c.length);
+			}
+			cells.push_back(c);
+		}
+		rows++;
+	}
+
+	void RowBlock::CopyRow(uint32_t row, DataStore *results, uint32_t fieldCount) const
+	{
+		const Cell *c = &cells[static_cast<size_t>(row) * fieldCount];
+		for (uint32_t i = 0; i < fieldCount; i++, c++)
+		{
+			results[i].is_null = c->is_null;
+			results[i].length = c->length;
+			if (!c->is_null) memcpy(results[i].buffer, data.data() + c->offset, c->length);
+		}
+	}
+
+	///////////////////////////////////////////
+	RowPrefetcher::RowPrefetcher(MYSQL_STMT *ismnt, MYSQL_FIELD *fields, uint32_t ifieldCount, uint32_t iblockRows, uint32_t blocks)
+		:smnt(ismnt), fieldCount(ifieldCount), blockRows(iblockRows == 0 ? 1 : iblockRows), ring(blocks < 2 ? 2 : blocks)
+	{
+		fetchBind = new MYSQL_BIND[fieldCount];
+		memset(fetchBind, 0, sizeof(MYSQL_BIND) * fieldCount);
+		fetched = new DataStore[fieldCount];
+		for (uint32_t i = 0; i < fieldCount; i++) fetched[i].Init(fields[i], fetchBind[i]);
+
+		if (mysql_stmt_bind_result(smnt, fetchBind))
+		{
+			std::string err = mysql_stmt_error(smnt);
+			delete[] fetchBind;
+			delete[] fetched;
+			throw std::runtime_error(err);
+		}
+		for (RowBlock &b : ring) b.cells.reserve(static_cast<size_t>(blockRows) * fieldCount);
+		thr = std::thread(&RowPrefetcher::Run, this);
+	}
+
+	RowPrefetcher::~RowPrefetcher()
+	{
+		{
+			std::lock_guard<std::mutex> lk(mtx);
+			stop = true;
+		}
+		notFull.notify_all();
+		if (thr.joinable()) thr.join();
+		delete[] fetchBind;
+		delete[] fetched;
+	}
+
+	void RowPrefetcher::Run()
+	{
+		for (;;)
+		{
+			size_t idx;
+			{
+				std::unique_lock<std::mutex> lk(mtx);
+				notFull.wait(lk, [this] { return stop || filled < ring.size(); });
+				if (stop) return;
+				idx = (head + filled) % ring.size();
+			}
+
+			// the block is outside [head, head + filled): the reader doesn't look at it
+			RowBlock &b = ring[idx];
+			b.Clear();
+			int rc = 0;
+			while (b.rows < blockRows && !stop)
+			{
+				rc = mysql_stmt_fetch(smnt);
+				if (rc != 0) break;
+				b.Append(fetched, fieldCount);
+			}
+
+			std::lock_guard<std::mutex> lk(mtx);
+			if (b.rows > 0) filled++;
+			if (rc != 0)
+			{
+				if (rc == MYSQL_DATA_TRUNCATED) error = "mysql_stmt_fetch : data truncated";
+				else if (rc != MYSQL_NO_DATA) error = std::string("mysql_stmt_fetch : ").append(mysql_stmt_error(smnt));
+				done = true;
+			}
+			notEmpty.notify_one();
+			if (done) return;
+		}
+	}
+
+	bool RowPrefetcher::Next(DataStore *results)
+	{
+		if (reading && row == ring[head].rows)
+		{
+			std::lock_guard<std::mutex> lk(mtx);
+			head = (head + 1) % ring.size();
+			filled--;
+			reading = false;
+			notFull.notify_one();
+		}
+		if (!reading)
+		{
+			std::unique_lock<std::mutex> lk(mtx);
+			notEmpty.wait(lk, [this] { return done || filled > 0; });
+			if (filled == 0)
+			{
+				if (!error.empty()) throw std::runtime_error(error);
+				return false;
+			}
+			reading = true;
+			row = 0;
+		}
+
+		ring[head].CopyRow(row++, results, fieldCount);
+		return true;
+	}
+}
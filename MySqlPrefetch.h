@@ -0,0 +1,84 @@
+/*
+Site:		http://hlspx.ocry.com/mysqlconnestion/
+
+History:
+			VERSION
+			1.0.0.0
+Author:
+		Alexey Tretyakov	hlspx@mail.ru
+*/
+
+#pragma once
+
+#include "MySqlConnection.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace Kiff {
+
+	// rows copied out of bound result buffers, packed one after another
+	struct RowBlock
+	{
+		struct Cell
+		{
+			uint32_t offset;
+			uint32_t length;
+			bool is_null;
+		};
+
+		std::vector<Cell> cells;		// rows * fieldCount
+		std::string data;
+		uint32_t rows = 0;
+
+		void Clear()
+		{
+			cells.clear();
+			data.clear();
+			rows = 0;
+		}
+
+		void Append(const DataStore *stores, uint32_t fieldCount);
+		void CopyRow(uint32_t row, DataStore *results, uint32_t fieldCount) const;
+	};
+
+	//////////////////////////////////////////////////////////////
+	// Streams an unbuffered result set on a background thread: mysql_stmt_fetch fills a ring
+	// of row blocks while the reader's thread copies rows out of the block before it.
+	// The connection must not be used by anyone else until the reader is done or destroyed.
+	class RowPrefetcher
+	{
+		MYSQL_STMT *smnt;
+		uint32_t fieldCount;
+		uint32_t blockRows;
+		MYSQL_BIND *fetchBind = nullptr;		// fetch thread buffers
+		DataStore *fetched = nullptr;
+
+		std::vector<RowBlock> ring;
+		size_t head = 0;						// block being read, when reading
+		size_t filled = 0;						// blocks from head handed over by the fetch thread
+		uint32_t row = 0;						// next row of ring[head]
+		bool reading = false;
+
+		std::mutex mtx;
+		std::condition_variable notEmpty;
+		std::condition_variable notFull;
+		bool done = false;
+		std::atomic<bool> stop{ false };
+		std::string error;
+		std::thread thr;
+
+		RowPrefetcher(const RowPrefetcher&) = delete;
+		void Run();
+	public:
+		// binds its own buffers to smnt; the result set must not be stored (mysql_stmt_store_result)
+		RowPrefetcher(MYSQL_STMT *ismnt, MYSQL_FIELD *fields, uint32_t ifieldCount, uint32_t iblockRows, uint32_t blocks);
+
+		// waits for the block being fetched, the rest of the result set is left to mysql_stmt_free_result
+		~RowPrefetcher();
+
+		// copy the next row into the reader's buffers; false at the end, throws the fetch error
+		bool Next(DataStore *results);
+	};
+}
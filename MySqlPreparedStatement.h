@@ -0,0 +1,200 @@
+/*
+Site:		http://hlspx.ocry.com/mysqlconnestion/
+
+History:
+			VERSION
+			1.0.0.0
+Author:
+		Alexey Tretyakov	hlspx@mail.ru
+*/
+
+#pragma once
+
+#include "MySqlConnection.h"
+
+#include <tuple>
+#include <utility>
+#include <type_traits>
+
+namespace Kiff {
+
+	//////////////////////////////////////////////////////////////
+	// Compile-time parameter mapping: Storage is what MYSQL_BIND points at.
+	// Types without a mapping do not compile.
+	template<typename T>
+	struct MySqlParam
+	{
+		static_assert(sizeof(T) == 0, "PreparedStatement : parameter type has no MySqlDbType mapping");
+	};
+
+	template<typename T, MySqlDbType DbType>
+	struct MySqlFixedParam
+	{
+		typedef T Storage;
+		static constexpr MySqlDbType Type() { return DbType; }
+		static void Reserve(Storage &) {}
+		static void Store(Storage &st, const T &value) { st = value; }
+		static void *Data(Storage &st) { return &st; }
+		static unsigned long Length(const Storage &) { return sizeof(T); }
+	};
+
+	template<> struct MySqlParam<int8_t>   : MySqlFixedParam<int8_t, MySqlDbType::Byte> {};
+	template<> struct MySqlParam<uint8_t>  : MySqlFixedParam<uint8_t, MySqlDbType::UByte> {};
+	template<> struct MySqlParam<int16_t>  : MySqlFixedParam<int16_t, MySqlDbType::Int16> {};
+	template<> struct MySqlParam<uint16_t> : MySqlFixedParam<uint16_t, MySqlDbType::UInt16> {};
+	template<> struct MySqlParam<int32_t>  : MySqlFixedParam<int32_t, MySqlDbType::Int32> {};
+	template<> struct MySqlParam<uint32_t> : MySqlFixedParam<uint32_t, MySqlDbType::UInt32> {};
+	template<> struct MySqlParam<int64_t>  : MySqlFixedParam<int64_t, MySqlDbType::Int64> {};
+	template<> struct MySqlParam<uint64_t> : MySqlFixedParam<uint64_t, MySqlDbType::UInt64> {};
+	template<> struct MySqlParam<float>    : MySqlFixedParam<float, MySqlDbType::Float> {};
+	template<> struct MySqlParam<double>   : MySqlFixedParam<double, MySqlDbType::Double> {};
+
+	template<>
+	struct MySqlParam<TmDateTime>
+	{
+		typedef MYSQL_TIME Storage;
+		static constexpr MySqlDbType Type() { return MySqlDbType::DateTime; }
+		static void Reserve(Storage &st) { memset(&st, 0, sizeof(st)); }
+		static void Store(Storage &st, const TmDateTime &value) { ToMySqlTime(value, st); }
+		static void *Data(Storage &st) { return &st; }
+		static unsigned long Length(const Storage &) { return sizeof(MYSQL_TIME); }
+	};
+
+	// sent as text; the array lives in the tuple so the buffer never moves
+	template<>
+	struct MySqlParam<Decimal>
+	{
+		struct Storage
+		{
+			char text[Decimal::MaxChars];
+			unsigned long length;
+		};
+		static constexpr MySqlDbType Type() { return MySqlDbType::NewDecimal; }
+		static void Reserve(Storage &st) { st.length = 0; }
+		static void Store(Storage &st, const Decimal &value) { st.length = static_cast<unsigned long>(value.Format(st.text)); }
+		static void *Data(Storage &st) { return st.text; }
+		static unsigned long Length(const Storage &st) { return st.length; }
+	};
+
+	// variable length: the buffer stays put while the value fits its capacity
+	template<>
+	struct MySqlParam<std::string>
+	{
+		typedef std::string Storage;
+		static constexpr MySqlDbType Type() { return MySqlDbType::VarChar; }
+		static void Reserve(Storage &st) { st.reserve(64); }
+		static void Store(Storage &st, const std::string &value) { st.assign(value); }
+		static void *Data(Storage &st) { return &st[0]; }
+		static unsigned long Length(const Storage &st) { return static_cast<unsigned long>(st.length()); }
+	};
+
+	template<>
+	struct MySqlParam<std::vector<uint8_t>>
+	{
+		typedef std::vector<uint8_t> Storage;
+		static constexpr MySqlDbType Type() { return MySqlDbType::LongBlob; }
+		static void Reserve(Storage &st) { st.reserve(64); }
+		static void Store(Storage &st, const std::vector<uint8_t> &value) { st.assign(value.begin(), value.end()); }
+		static void *Data(Storage &st) { return st.data(); }
+		static unsigned long Length(const Storage &st) { return static_cast<unsigned long>(st.size()); }
+	};
+
+	//////////////////////////////////////////////////////////////
+	// Statement with parameter types fixed at compile time. Arguments are copied into
+	// an inline tuple the command's MYSQL_BIND array points at, so a repeated Execute
+	// stores the values in place and sends a single mysql_stmt_execute. It runs through
+	// its MySqlCommand: re-prepared after a reconnect, under the connection's deadline and
+	// captures. Parameters are never NULL.
+	template<typename... Args>
+	class PreparedStatement
+	{
+		static const size_t N = sizeof...(Args);
+
+		MySqlCommand cmd;
+		std::tuple<typename MySqlParam<Args>::Storage...> values;
+
+		PreparedStatement(const PreparedStatement&) = delete;
+		PreparedStatement& operator=(const PreparedStatement&) = delete;
+
+		// the command's parameter buffer is the tuple storage, not owned by its DataStore
+		template<size_t I>
+		void Point()
+		{
+			typedef typename std::tuple_element<I, std::tuple<Args...>>::type T;
+			auto &st = std::get<I>(values);
+			DataStore &ds = cmd.bindings[I];
+			if (ds.buffer != MySqlParam<T>::Data(st)) cmd.bound = false;		// string storage grew
+			ds.buffer = MySqlParam<T>::Data(st);
+			ds.buffer_length = ds.length = MySqlParam<T>::Length(st);
+			cmd.paramBind[I].buffer = ds.buffer;
+			cmd.paramBind[I].buffer_length = ds.buffer_length;
+		}
+
+		template<size_t I>
+		int InitBind()
+		{
+			typedef typename std::tuple_element<I, std::tuple<Args...>>::type T;
+			MySqlParam<T>::Reserve(std::get<I>(values));
+			cmd.BindParam(I, MySqlParam<T>::Type());
+			Point<I>();
+			return 0;
+		}
+
+		template<size_t... I>
+		void Init(std::index_sequence<I...>)
+		{
+			int dummy[] = { 0, InitBind<I>()... };
+			(void)dummy;
+		}
+
+		template<size_t I, typename T>
+		int StoreOne(const T &value)
+		{
+			MySqlParam<T>::Store(std::get<I>(values), value);
+			Point<I>();
+			return 0;
+		}
+
+		template<size_t... I>
+		void Store(std::index_sequence<I...>, const Args&... args)
+		{
+			int dummy[] = { 0, StoreOne<I>(args)... };
+			(void)dummy;
+		}
+
+	public:
+		PreparedStatement(MySqlConnection &conn, const std::string &query)
+			:cmd(conn.CreateCommand(query))
+		{
+			if (cmd.paramCount != N)
+				throw std::runtime_error(std::string(query).append(" PreparedStatement : ").append(std::to_string(N)).append(" parameter types for ").append(std::to_string(cmd.paramCount)).append(" placeholders"));
+			Init(std::index_sequence_for<Args...>());
+		}
+
+		~PreparedStatement()
+		{
+			for (uint32_t i = 0; i < cmd.paramCount; i++) cmd.bindings[i].buffer = nullptr;
+		}
+
+		// result sets, if any, are left to the caller
+		void Execute(const Args&... args)
+		{
+			Store(std::index_sequence_for<Args...>(), args...);
+			cmd.Execute();
+		}
+
+		// extra result sets (CALL) are drained
+		size_t ExecuteNonQuery(const Args&... args)
+		{
+			Store(std::index_sequence_for<Args...>(), args...);
+			return cmd.ExecuteNonQuery();
+		}
+
+		// the reader must be destroyed before the next Execute
+		MySqlDataReader ExecuteReader(const Args&... args)
+		{
+			Store(std::index_sequence_for<Args...>(), args...);
+			return cmd.ExecuteReader();
+		}
+	};
+}
@@ -0,0 +1,135 @@
+/*
+Site:		http://hlspx.ocry.com/mysqlconnestion/
+
+History:
+			VERSION
+			1.0.0.0
+Author:
+		Alexey Tretyakov	hlspx@mail.ru
+*/
+
+#pragma once
+
+#include <cstring>
+#include <new>
+#include <string>
+#include <stdexcept>
+#include <utility>
+
+namespace Kiff {
+
+	// failure of a Try* call: server or client error number, SQLSTATE and the text
+	// the throwing call would have thrown
+	struct MySqlError
+	{
+		unsigned int code = 0;
+		char sqlstate[6] = { 'H', 'Y', '0', '0', '0', '\0' };
+		std::string message;
+
+		MySqlError() {}
+		MySqlError(unsigned int icode, const char *isqlstate, std::string imessage)
+			:code(icode), message(std::move(imessage))
+		{
+			if (isqlstate != nullptr) strncpy(sqlstate, isqlstate, sizeof(sqlstate) - 1);
+		}
+
+		// SQLSTATE class "23": duplicate key, foreign key and other constraint violations
+		bool IsConstraintViolation() const { return (sqlstate[0] == '2') && (sqlstate[1] == '3'); }
+	};
+
+	//////////////////////////////////////////////////////////////
+	// value of a column that may be NULL
+	template<typename T>
+	class Nullable
+	{
+		bool has = false;
+		T value = T();
+	public:
+		Nullable() {}
+		Nullable(const T &ivalue) :has(true), value(ivalue) {}
+		Nullable(T &&ivalue) :has(true), value(std::move(ivalue)) {}
+
+		bool HasValue() const { return has; }
+		explicit operator bool() const { return has; }
+
+		const T &Value() const
+		{
+			if (!has) throw std::runtime_error("Nullable : value is NULL");
+			return value;
+		}
+
+		T ValueOr(const T &def) const { return has ? value : def; }
+
+		const T &operator*() const { return value; }
+		const T *operator->() const { return &value; }
+	};
+
+	//////////////////////////////////////////////////////////////
+	// Value of a Try* call or the MySqlError it failed with (expected-like, C++14).
+	// Value() of a failed result throws the error's message.
+	template<typename T>
+	class MySqlResult
+	{
+		bool ok;
+		union
+		{
+			T value;
+			MySqlError error;
+		};
+
+		void Destroy()
+		{
+			if (ok) value.~T();
+			else error.~MySqlError();
+		}
+	public:
+		MySqlResult(T ivalue) :ok(true) { new (&value) T(std::move(ivalue)); }
+		MySqlResult(MySqlError ierror) :ok(false) { new (&error) MySqlError(std::move(ierror)); }
+
+		MySqlResult(MySqlResult &&other) :ok(other.ok)
+		{
+			if (ok) new (&value) T(std::move(other.value));
+			else new (&error) MySqlError(std::move(other.error));
+		}
+
+		MySqlResult& operator=(MySqlResult &&other)
+		{
+			if (this != &other)
+			{
+				Destroy();
+				ok = other.ok;
+				if (ok) new (&value) T(std::move(other.value));
+				else new (&error) MySqlError(std::move(other.error));
+			}
+			return *this;
+		}
+
+		MySqlResult(const MySqlResult&) = delete;
+		MySqlResult& operator=(const MySqlResult&) = delete;
+		~MySqlResult() { Destroy(); }
+
+		bool Ok() const { return ok; }
+		explicit operator bool() const { return ok; }
+
+		T &Value()
+		{
+			if (!ok) throw std::runtime_error(error.message);
+			return value;
+		}
+
+		const T &Value() const
+		{
+			if (!ok) throw std::runtime_error(error.message);
+			return value;
+		}
+
+		T ValueOr(const T &def) const { return ok ? value : def; }
+
+		// empty MySqlError when the call succeeded
+		const MySqlError &Error() const
+		{
+			static const MySqlError none(0, "00000", std::string());
+			return ok ? none : error;
+		}
+	};
+}
@@ -0,0 +1,142 @@
+#include "MySqlRouting.h"
+
+namespace Kiff {
+
+	MySqlReplicaSet::MySqlReplicaSet(const std::vector<std::string> &connStrs, uint32_t maxLagSeconds, uint32_t lagCheckMilliseconds, uint32_t retryMilliseconds)
+		:replicas(new Replica[connStrs.size()]), count(connStrs.size()), maxLag(maxLagSeconds),
+		lagCheck(std::chrono::milliseconds(lagCheckMilliseconds)), retry(std::chrono::milliseconds(retryMilliseconds))
+	{
+		for (size_t i = 0; i < count; i++) replicas[i].connStr = connStrs[i];
+	}
+
+	// least (in-flight + 1) * latency among usable replicas; unmeasured ones go first.
+	// A lagging replica comes back once its lag check is due, for Route to measure it again
+	size_t MySqlReplicaSet::Pick()
+	{
+		if (count == 0) return None;
+
+		int64_t now = Now();
+		size_t start = next++ % count, best = None;
+		double bestScore = 0;
+		for (size_t k = 0; k < count; k++)
+		{
+			size_t i = (start + k) % count;
+			Replica &r = replicas[i];
+			if (r.downUntil > now) continue;
+			if (maxLag != 0)
+			{
+				int64_t lag = r.lag;
+				if (((lag < 0) || (lag > maxLag)) && (now - r.lagChecked < lagCheck.count())) continue;
+			}
+			int64_t latency = r.latency;
+			double score = (r.inFlight + 1.0) * (latency < 1 ? 1 : latency);
+			if ((best == None) || (score < bestScore))
+			{
+				best = i;
+				bestScore = score;
+			}
+		}
+		if (best != None) replicas[best].inFlight++;
+		return best;
+	}
+
+	// one caller per lagCheck interval runs SHOW SLAVE STATUS
+	bool MySqlReplicaSet::ClaimLagCheck(size_t idx)
+	{
+		if (maxLag == 0) return false;
+		int64_t now = Now();
+		int64_t checked = replicas[idx].lagChecked;
+		if ((checked != 0) && (now - checked < lagCheck.count())) return false;
+		return replicas[idx].lagChecked.compare_exchange_strong(checked, now);
+	}
+
+	void MySqlReplicaSet::SetLag(size_t idx, int64_t seconds)
+	{
+		replicas[idx].lag = seconds;
+	}
+
+	void MySqlReplicaSet::MarkDown(size_t idx)
+	{
+		replicas[idx].downUntil = Now() + retry.count();
+	}
+
+	void MySqlReplicaSet::Executed(size_t idx, std::chrono::steady_clock::duration elapsed)
+	{
+		int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+		int64_t old = replicas[idx].latency;
+		replicas[idx].latency = (old == 0) ? us : old + (us - old) / 8;
+	}
+
+	///////////////////////////////////////////
+	MySqlRoutingConnection::MySqlRoutingConnection(const std::string &primaryConnStr, std::shared_ptr<MySqlReplicaSet> replicaSet, uint32_t stickyMilliseconds)
+		:primary(primaryConnStr), set(replicaSet), replicas(replicaSet->Count()), sticky(std::chrono::milliseconds(stickyMilliseconds))
+	{
+	}
+
+	// Seconds_Behind_Master, -1 if the server is not replicating
+	static int64_t ReplicationLag(MySqlConnection &conn)
+	{
+		MySqlDataReader rd = conn.ExecuteReader("SHOW SLAVE STATUS");
+		if (!rd.Read() || rd.IsNull("Seconds_Behind_Master")) return -1;
+		return rd.GetFieldValue<int64_t>("Seconds_Behind_Master");
+	}
+
+	// replica index with its in-flight count taken, or None for the primary
+	size_t MySqlRoutingConnection::Route()
+	{
+		if (primary.InTransaction()) return MySqlReplicaSet::None;
+		if (std::chrono::steady_clock::now() - lastWrite < sticky) return MySqlReplicaSet::None;
+
+		for (size_t tries = 0; tries < set->Count(); tries++)
+		{
+			size_t idx = set->Pick();
+			if (idx == MySqlReplicaSet::None) break;
+
+			MySqlReplicaSet::Replica &r = set->replicas[idx];
+			try
+			{
+				if (!replicas[idx]) replicas[idx].reset(new MySqlConnection(r.connStr));
+				if (set->ClaimLagCheck(idx)) set->SetLag(idx, ReplicationLag(*replicas[idx]));
+			}
+			catch (std::exception &)
+			{
+				replicas[idx].reset();
+				r.inFlight--;
+				set->MarkDown(idx);
+				continue;
+			}
+			if ((set->maxLag != 0) && ((r.lag < 0) || (r.lag > set->maxLag)))
+			{
+				r.inFlight--;
+				continue;
+			}
+			return idx;
+		}
+		return MySqlReplicaSet::None;
+	}
+
+	// statement failed on a replica: true if the replica is unreachable and the read can go elsewhere
+	bool MySqlRoutingConnection::Failed(size_t idx)
+	{
+		set->replicas[idx].inFlight--;
+		try
+		{
+			replicas[idx]->Ping();
+			return false;
+		}
+		catch (std::exception &)
+		{
+			replicas[idx].reset();
+			set->MarkDown(idx);
+			return true;
+		}
+	}
+
+	// the reader holds the in-flight count until it is destroyed
+	void MySqlRoutingConnection::Attach(size_t idx, MySqlDataReader &rd, std::chrono::steady_clock::time_point start)
+	{
+		set->Executed(idx, std::chrono::steady_clock::now() - start);
+		std::shared_ptr<MySqlReplicaSet> keep = set;
+		rd.lease = std::shared_ptr<void>(&set->replicas[idx], [keep](void *p) { static_cast<MySqlReplicaSet::Replica*>(p)->inFlight--; });
+	}
+}
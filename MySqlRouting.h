@@ -0,0 +1,122 @@
+/*
+Site:		http://hlspx.ocry.com/mysqlconnestion/
+
+History:
+			VERSION
+			1.0.0.0
+Author:
+		Alexey Tretyakov	hlspx@mail.ru
+*/
+
+#pragma once
+
+#include "MySqlConnection.h"
+
+#include <atomic>
+
+namespace Kiff {
+
+	//////////////////////////////////////////////////////////////
+	// Replica list with load statistics shared by all routing connections (thread safe).
+	// A replica is chosen by in-flight reads times measured latency; replicas behind
+	// by more than maxLagSeconds or failing to connect are skipped for a while.
+	class MySqlReplicaSet
+	{
+		friend class MySqlRoutingConnection;
+
+		struct Replica
+		{
+			std::string connStr;
+			std::atomic<uint32_t> inFlight{ 0 };		// open readers
+			std::atomic<int64_t> latency{ 0 };			// EWMA of execute time, microseconds
+			std::atomic<int64_t> lag{ 0 };				// Seconds_Behind_Master, -1 - not replicating
+			std::atomic<int64_t> lagChecked{ 0 };		// steady_clock ticks of the last lag check
+			std::atomic<int64_t> downUntil{ 0 };		// steady_clock ticks
+		};
+
+		std::unique_ptr<Replica[]> replicas;
+		size_t count;
+		int64_t maxLag;
+		std::chrono::steady_clock::duration lagCheck;
+		std::chrono::steady_clock::duration retry;
+		std::atomic<uint32_t> next{ 0 };
+
+		MySqlReplicaSet(const MySqlReplicaSet&) = delete;
+
+		static int64_t Now() { return std::chrono::steady_clock::now().time_since_epoch().count(); }
+		size_t Pick();
+		bool ClaimLagCheck(size_t idx);
+		void SetLag(size_t idx, int64_t seconds);
+		void MarkDown(size_t idx);
+		void Executed(size_t idx, std::chrono::steady_clock::duration elapsed);
+	public:
+		static const size_t None = (size_t)-1;
+
+		// maxLagSeconds = 0 - replication lag is not checked
+		MySqlReplicaSet(const std::vector<std::string> &connStrs, uint32_t maxLagSeconds = 0, uint32_t lagCheckMilliseconds = 1000, uint32_t retryMilliseconds = 5000);
+
+		size_t Count() const { return count; }
+		uint32_t InFlight(size_t idx) const { return replicas[idx].inFlight; }
+		std::chrono::microseconds Latency(size_t idx) const { return std::chrono::microseconds(replicas[idx].latency.load()); }
+	};
+
+	//////////////////////////////////////////////////////////////
+	// Read/write splitting for one thread: writes, transactions and reads inside a transaction
+	// go to the primary, ExecuteReader to the least loaded replica. For stickyMilliseconds after
+	// a write reads also go to the primary (read-your-writes). Replica connections open lazily.
+	class MySqlRoutingConnection
+	{
+		MySqlConnection primary;
+		std::shared_ptr<MySqlReplicaSet> set;
+		std::vector<std::unique_ptr<MySqlConnection>> replicas;
+		std::chrono::steady_clock::duration sticky;
+		std::chrono::steady_clock::time_point lastWrite;
+
+		MySqlRoutingConnection(const MySqlRoutingConnection&) = delete;
+		size_t Route();
+		bool Failed(size_t idx);
+		void Attach(size_t idx, MySqlDataReader &rd, std::chrono::steady_clock::time_point start);
+		void Written() { lastWrite = std::chrono::steady_clock::now(); }
+	public:
+		MySqlRoutingConnection(const std::string &primaryConnStr, std::shared_ptr<MySqlReplicaSet> replicaSet, uint32_t stickyMilliseconds = 0);
+
+		MySqlConnection &Primary() { return primary; }
+
+		template<typename... Targs>
+		size_t ExecuteNonQuery(const std::string &query, Targs&& ... Fargs)
+		{
+			size_t affRws = primary.ExecuteNonQuery(query, Fargs...);
+			Written();
+			return affRws;
+		}
+
+		// statement must be read-only unless routed to the primary
+		template<typename... Targs>
+		MySqlDataReader ExecuteReader(const std::string &query, Targs&& ... Fargs)
+		{
+			for (;;)
+			{
+				size_t idx = Route();
+				if (idx == MySqlReplicaSet::None) return primary.ExecuteReader(query, Fargs...);
+				try
+				{
+					std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+					MySqlDataReader rd = replicas[idx]->ExecuteReader(query, Fargs...);
+					Attach(idx, rd, start);
+					return rd;
+				}
+				catch (std::exception &)
+				{
+					if (!Failed(idx)) throw;
+				}
+			}
+		}
+
+		MySqlTransaction BeginTransaction()
+		{
+			MySqlTransaction trans = primary.BeginTransaction();
+			Written();
+			return trans;
+		}
+	};
+}
@@ -0,0 +1,250 @@
+#include "MySqlSharding.h"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <thread>
+
+namespace Kiff {
+
+	ShardMap ShardMap::Hash(size_t shards)
+	{
+		if (shards == 0) throw std::runtime_error("ShardMap : no shards");
+		ShardMap map;
+		map.count = shards;
+		return map;
+	}
+
+	ShardMap ShardMap::Range(std::vector<std::pair<int64_t, size_t>> lowerBounds, size_t shards)
+	{
+		if (lowerBounds.empty()) throw std::runtime_error("ShardMap : no ranges");
+		for (const auto &b : lowerBounds)
+			if (b.second >= shards) throw std::runtime_error("ShardMap : range shard '" + std::to_string(b.second) + "' out of range");
+		std::sort(lowerBounds.begin(), lowerBounds.end());
+		ShardMap map;
+		map.count = shards;
+		map.bounds = std::move(lowerBounds);
+		return map;
+	}
+
+	// FNV-1a, 64 bit; integers as 8 little-endian bytes
+	static uint64_t Fnv1a(const uint8_t *p, size_t len)
+	{
+		uint64_t h = 14695981039346656037ull;
+		for (size_t i = 0; i < len; i++)
+		{
+			h ^= p[i];
+			h *= 1099511628211ull;
+		}
+		return h;
+	}
+
+	size_t ShardMap::Of(int64_t key) const
+	{
+		if (bounds.empty())
+		{
+			uint8_t bytes[8];
+			for (int i = 0; i < 8; i++) bytes[i] = static_cast<uint8_t>(static_cast<uint64_t>(key) >> (i * 8));
+			return static_cast<size_t>(Fnv1a(bytes, sizeof(bytes)) % count);
+		}
+		auto it = std::upper_bound(bounds.begin(), bounds.end(), key,
+			[](int64_t k, const std::pair<int64_t, size_t> &b) { return k < b.first; });
+		if (it == bounds.begin()) throw std::runtime_error("ShardMap : key '" + std::to_string(key) + "' below the first range");
+		return (--it)->second;
+	}
+
+	size_t ShardMap::Of(const std::string &key) const
+	{
+		if (!bounds.empty()) throw std::runtime_error("ShardMap : range map needs an integer key");
+		return static_cast<size_t>(Fnv1a(reinterpret_cast<const uint8_t*>(key.data()), key.length()) % count);
+	}
+
+	///////////////////////////////////////////
+	template<typename T>
+	static int CompareAs(const void *a, const void *b)
+	{
+		T x, y;
+		memcpy(&x, a, sizeof(T));
+		memcpy(&y, b, sizeof(T));
+		return (x < y) ? -1 : (y < x) ? 1 : 0;
+	}
+
+	static bool IsText(enum_field_types type)
+	{
+		switch (type)
+		{
+		case MYSQL_TYPE_VARCHAR:
+		case MYSQL_TYPE_VAR_STRING:
+		case MYSQL_TYPE_STRING:
+		case MYSQL_TYPE_TINY_BLOB:
+		case MYSQL_TYPE_MEDIUM_BLOB:
+		case MYSQL_TYPE_LONG_BLOB:
+		case MYSQL_TYPE_BLOB:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	// the shards sort text keys by their collation and ENUM/SET by member index, the merge compares bytes
+	ShardedReader::ShardedReader(std::vector<std::unique_ptr<MySqlDataReader>> &&ireaders, const std::vector<MergeKey> &iorder)
+		:readers(std::move(ireaders)), order(iorder)
+	{
+		if (order.empty() || readers.empty()) return;
+		const MySqlDataReader &rd = *readers[0];
+		for (const MergeKey &key : order)
+		{
+			if (key.pos >= rd.fieldCount) throw std::runtime_error("ShardedReader : merge key '" + std::to_string(key.pos) + "' out of range");
+			const MYSQL_FIELD &fld = rd.smnt->fields[key.pos];
+			if ((fld.type == MYSQL_TYPE_ENUM) || (fld.type == MYSQL_TYPE_SET) || (fld.flags & (ENUM_FLAG | SET_FLAG)))
+				throw std::runtime_error("ShardedReader : merge key '" + std::string(fld.name, fld.name_length) + "' is an ENUM or SET, select it as CAST(... AS CHAR) with a binary collation");
+			if (!IsText(fld.type) || (fld.charsetnr == 63)) continue;
+			const MARIADB_CHARSET_INFO *cs = mariadb_get_charset_by_nr(fld.charsetnr);
+			std::string collation = ((cs != nullptr) && (cs->name != nullptr)) ? cs->name : std::to_string(fld.charsetnr);
+			if ((collation.length() < 4) || (collation.compare(collation.length() - 4, 4, "_bin") != 0))
+				throw std::runtime_error("ShardedReader : text merge key '" + std::string(fld.name, fld.name_length) + "' has collation " + collation + ", select it with a binary collation");
+		}
+	}
+
+	// one column of two rows in server order; NULL sorts first, strings compare as bytes
+	int ShardedReader::CompareField(const DataStore &a, const DataStore &b)
+	{
+		if (a.is_null || b.is_null) return (a.is_null && b.is_null) ? 0 : (a.is_null ? -1 : 1);
+
+		// field type in the low byte, 0x200 - unsigned; MEDIUMINT is fetched as 4 bytes
+		bool isUnsigned = (static_cast<int>(a.buffer_type) & 0x200) != 0;
+		switch (static_cast<enum_field_types>(static_cast<int>(a.buffer_type) & 0xff))
+		{
+		case MYSQL_TYPE_TINY: return isUnsigned ? CompareAs<uint8_t>(a.buffer, b.buffer) : CompareAs<int8_t>(a.buffer, b.buffer);
+		case MYSQL_TYPE_SHORT: return isUnsigned ? CompareAs<uint16_t>(a.buffer, b.buffer) : CompareAs<int16_t>(a.buffer, b.buffer);
+		case MYSQL_TYPE_INT24:
+		case MYSQL_TYPE_LONG: return isUnsigned ? CompareAs<uint32_t>(a.buffer, b.buffer) : CompareAs<int32_t>(a.buffer, b.buffer);
+		case MYSQL_TYPE_LONGLONG: return isUnsigned ? CompareAs<uint64_t>(a.buffer, b.buffer) : CompareAs<int64_t>(a.buffer, b.buffer);
+		case MYSQL_TYPE_FLOAT: return CompareAs<float>(a.buffer, b.buffer);
+		case MYSQL_TYPE_DOUBLE: return CompareAs<double>(a.buffer, b.buffer);
+		case MYSQL_TYPE_DATETIME:
+		{
+			const MYSQL_TIME *x = static_cast<const MYSQL_TIME*>(a.buffer);
+			const MYSQL_TIME *y = static_cast<const MYSQL_TIME*>(b.buffer);
+			const unsigned long xs[] = { x->year, x->month, x->day, x->hour, x->minute, x->second, x->second_part };
+			const unsigned long ys[] = { y->year, y->month, y->day, y->hour, y->minute, y->second, y->second_part };
+			int sign = x->neg ? -1 : 1;
+			if (x->neg != y->neg) return sign;
+			for (size_t i = 0; i < sizeof(xs) / sizeof(xs[0]); i++)
+				if (xs[i] != ys[i]) return (xs[i] < ys[i]) ? -sign : sign;
+			return 0;
+		}
+		case MYSQL_TYPE_NEWDECIMAL:
+		{
+			Decimal x, y;
+			if (!Decimal::Parse(static_cast<const char*>(a.buffer), a.length, &x) || !Decimal::Parse(static_cast<const char*>(b.buffer), b.length, &y))
+				throw std::runtime_error("ShardedReader : bad decimal");
+			return x.Compare(y);
+		}
+		default:
+		{
+			unsigned long la = (a.length < a.buffer_length) ? a.length : a.buffer_length;
+			unsigned long lb = (b.length < b.buffer_length) ? b.length : b.buffer_length;
+			int c = memcmp(a.buffer, b.buffer, (la < lb) ? la : lb);
+			if (c != 0) return (c < 0) ? -1 : 1;
+			return (la < lb) ? -1 : (lb < la) ? 1 : 0;
+		}
+		}
+	}
+
+	// current rows of two shards in merge order; ties go to the lower shard
+	int ShardedReader::Compare(size_t a, size_t b) const
+	{
+		for (const MergeKey &key : order)
+		{
+			if ((key.pos >= readers[a]->fieldCount) || (key.pos >= readers[b]->fieldCount))
+				throw std::runtime_error("ShardedReader : merge key '" + std::to_string(key.pos) + "' out of range");
+			int c = CompareField(readers[a]->results[key.pos], readers[b]->results[key.pos]);
+			if (c != 0) return key.descending ? -c : c;
+		}
+		return (a < b) ? -1 : (b < a) ? 1 : 0;
+	}
+
+	bool ShardedReader::Read()
+	{
+		if (order.empty())
+		{
+			if (!started)
+			{
+				started = true;
+				current = 0;
+			}
+			for (; current < readers.size(); current++)
+				if (readers[current]->Read()) return true;
+			current = None;
+			return false;
+		}
+
+		// max-heap on "comes later": front is the next row
+		auto later = [this](size_t a, size_t b) { return Compare(a, b) > 0; };
+		if (!started)
+		{
+			started = true;
+			for (size_t i = 0; i < readers.size(); i++)
+				if (readers[i]->Read()) heap.push_back(i);
+			std::make_heap(heap.begin(), heap.end(), later);
+		}
+		else if ((current != None) && readers[current]->Read())
+		{
+			heap.push_back(current);
+			std::push_heap(heap.begin(), heap.end(), later);
+		}
+
+		if (heap.empty())
+		{
+			current = None;
+			return false;
+		}
+		std::pop_heap(heap.begin(), heap.end(), later);
+		current = heap.back();
+		heap.pop_back();
+		return true;
+	}
+
+	///////////////////////////////////////////
+	ShardedConnection::ShardedConnection(const std::vector<std::string> &iconnStrs, const ShardMap &imap)
+		:connStrs(iconnStrs), map(imap), shards(iconnStrs.size())
+	{
+		if (map.Count() != connStrs.size()) throw std::runtime_error("ShardedConnection : map has " + std::to_string(map.Count()) + " shards, " + std::to_string(connStrs.size()) + " given");
+	}
+
+	MySqlConnection &ShardedConnection::Shard(size_t idx)
+	{
+		if (idx >= shards.size()) throw std::runtime_error("ShardedConnection : wrong shard index '" + std::to_string(idx) + "'");
+		if (!shards[idx]) shards[idx].reset(new MySqlConnection(connStrs[idx]));
+		return *shards[idx];
+	}
+
+	// connections are opened here, the statements run on one thread per shard;
+	// the first shard's error is rethrown after all have finished
+	void ShardedConnection::Parallel(const std::function<void(size_t)> &fn)
+	{
+		for (size_t i = 0; i < shards.size(); i++) Shard(i);
+
+		std::vector<std::exception_ptr> errors(shards.size());
+		auto run = [&fn, &errors](size_t i)
+		{
+			try
+			{
+				fn(i);
+			}
+			catch (...)
+			{
+				errors[i] = std::current_exception();
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (size_t i = 1; i < shards.size(); i++) threads.emplace_back(run, i);
+		if (!shards.empty()) run(0);
+		for (std::thread &t : threads) t.join();
+
+		for (std::exception_ptr &e : errors)
+			if (e) std::rethrow_exception(e);
+	}
+}
@@ -0,0 +1,198 @@
+/*
+Site:		http://hlspx.ocry.com/mysqlconnestion/
+
+History:
+			VERSION
+			1.0.0.0
+Author:
+		Alexey Tretyakov	hlspx@mail.ru
+*/
+
+#pragma once
+
+#include "MySqlConnection.h"
+
+namespace Kiff {
+
+	//////////////////////////////////////////////////////////////
+	// Shard key -> shard index. Hash maps integers and strings with a fixed function
+	// (stable across builds and platforms); Range maps integer keys by lower bounds.
+	class ShardMap
+	{
+		size_t count = 0;
+		std::vector<std::pair<int64_t, size_t>> bounds;		// sorted lower bounds, Range only
+	public:
+		static ShardMap Hash(size_t shards);
+
+		// keys from a bound up to the next one go to its shard; keys below the first bound are an error
+		static ShardMap Range(std::vector<std::pair<int64_t, size_t>> lowerBounds, size_t shards);
+
+		size_t Count() const { return count; }
+		size_t Of(int64_t key) const;
+		size_t Of(const std::string &key) const;		// Hash only
+	};
+
+	// column of the ORDER BY each shard's query ends with
+	struct MergeKey
+	{
+		uint32_t pos;
+		bool descending;
+
+		MergeKey(uint32_t ipos, bool idescending = false) :pos(ipos), descending(idescending) {}
+	};
+
+	enum class ShardAggregate
+	{
+		Sum,			// also COUNT
+		Min,
+		Max
+	};
+
+	//////////////////////////////////////////////////////////////
+	// Rows of one query run on all shards: shard after shard, or a streaming k-way merge
+	// of per-shard sorted results when merge keys are given. Accessors are the reader's.
+	class ShardedReader
+	{
+		friend class ShardedConnection;
+		static const size_t None = (size_t)-1;
+
+		std::vector<std::unique_ptr<MySqlDataReader>> readers;
+		std::vector<MergeKey> order;
+		std::vector<size_t> heap;			// shards with a pending row, merge only
+		size_t current = None;
+		bool started = false;
+
+		ShardedReader(std::vector<std::unique_ptr<MySqlDataReader>> &&ireaders, const std::vector<MergeKey> &iorder);
+		static int CompareField(const DataStore &a, const DataStore &b);
+		int Compare(size_t a, size_t b) const;
+
+		const MySqlDataReader &Current() const
+		{
+			if (current == None) throw std::runtime_error("ShardedReader : no current row");
+			return *readers[current];
+		}
+	public:
+		ShardedReader(ShardedReader &&other) = default;
+		ShardedReader& operator=(ShardedReader &&other) = default;
+
+		bool Read();
+
+		// shard of the current row
+		size_t Shard() const { return current; }
+
+		bool IsNull(uint32_t pos) const { return Current().IsNull(pos); }
+		bool IsNull(const std::string &name) const { return Current().IsNull(name); }
+
+		template<typename T>
+		T GetFieldValue(uint32_t pos) const
+		{
+			return Current().GetFieldValue<T>(pos);
+		}
+
+		template<typename T>
+		T GetFieldValue(const std::string &name) const
+		{
+			return Current().GetFieldValue<T>(name);
+		}
+
+		template<typename... Targs>
+		void GetValues(Targs&& ... Fargs) const
+		{
+			Current().GetValues(Fargs...);
+		}
+	};
+
+	//////////////////////////////////////////////////////////////
+	// One connection per shard, opened on first use. Keyed statements go to the key's shard;
+	// the *All methods run on every shard in parallel, one thread per shard. Not thread safe.
+	class ShardedConnection
+	{
+		std::vector<std::string> connStrs;
+		ShardMap map;
+		std::vector<std::unique_ptr<MySqlConnection>> shards;
+
+		ShardedConnection(const ShardedConnection&) = delete;
+		void Parallel(const std::function<void(size_t)> &fn);
+	public:
+		ShardedConnection(const std::vector<std::string> &iconnStrs, const ShardMap &imap);
+
+		size_t Count() const { return connStrs.size(); }
+		MySqlConnection &Shard(size_t idx);
+
+		template<typename K>
+		MySqlConnection &ShardFor(const K &key)
+		{
+			return Shard(map.Of(key));
+		}
+
+		template<typename K, typename... Targs>
+		size_t ExecuteNonQuery(const K &key, const std::string &query, Targs&& ... Fargs)
+		{
+			return ShardFor(key).ExecuteNonQuery(query, Fargs...);
+		}
+
+		template<typename K, typename... Targs>
+		MySqlDataReader ExecuteReader(const K &key, const std::string &query, Targs&& ... Fargs)
+		{
+			return ShardFor(key).ExecuteReader(query, Fargs...);
+		}
+
+		// total affected rows
+		template<typename... Targs>
+		size_t ExecuteNonQueryAll(const std::string &query, Targs&& ... Fargs)
+		{
+			std::vector<size_t> affRws(Count());
+			Parallel([&](size_t i) { affRws[i] = Shard(i).ExecuteNonQuery(query, Fargs...); });
+			size_t total = 0;
+			for (size_t n : affRws) total += n;
+			return total;
+		}
+
+		// rows of all shards, shard after shard
+		template<typename... Targs>
+		ShardedReader ExecuteReaderAll(const std::string &query, Targs&& ... Fargs)
+		{
+			return ExecuteReaderMerged(std::vector<MergeKey>(), query, Fargs...);
+		}
+
+		// query must end with ORDER BY on the order columns; rows come in that order across shards.
+		// Text keys are merged as bytes: they must come with a binary collation
+		// ("SELECT name COLLATE utf8mb4_bin AS name ... ORDER BY name"), others are rejected.
+		// ENUM and SET keys sort by member index on the server and are rejected as well.
+		template<typename... Targs>
+		ShardedReader ExecuteReaderMerged(const std::vector<MergeKey> &order, const std::string &query, Targs&& ... Fargs)
+		{
+			std::vector<std::unique_ptr<MySqlDataReader>> readers(Count());
+			Parallel([&](size_t i) { readers[i].reset(new MySqlDataReader(Shard(i).ExecuteReader(query, Fargs...))); });
+			return ShardedReader(std::move(readers), order);
+		}
+
+		// Combines the first column of a one-row aggregate (SUM, COUNT, MIN, MAX) over shards,
+		// NULLs skipped; false if every shard returned NULL. AVG needs SUM and COUNT separately.
+		// SUM of integers is DECIMAL on the server: read it as Decimal.
+		template<typename T, typename... Targs>
+		bool ExecuteAggregate(ShardAggregate op, T *result, const std::string &query, Targs&& ... Fargs)
+		{
+			std::vector<T> values(Count());
+			std::vector<uint8_t> present(Count(), 0);
+			Parallel([&](size_t i)
+			{
+				MySqlDataReader rd = Shard(i).ExecuteReader(query, Fargs...);
+				if (!rd.Read() || rd.IsNull(0)) return;
+				values[i] = rd.GetFieldValue<T>(0);
+				present[i] = 1;
+			});
+
+			bool any = false;
+			for (size_t i = 0; i < values.size(); i++)
+			{
+				if (!present[i]) continue;
+				if (!any) *result = values[i];
+				else if (op == ShardAggregate::Sum) *result = *result + values[i];
+				else if ((op == ShardAggregate::Min) ? (values[i] < *result) : (*result < values[i])) *result = values[i];
+				any = true;
+			}
+			return any;
+		}
+	};
+}
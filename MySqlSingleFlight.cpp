@@ -0,0 +1,115 @@
+#include "MySqlSingleFlight.h"
+
+namespace Kiff {
+
+	std::shared_ptr<const SharedResult> SharedResult::Materialize(MySqlDataReader &rd)
+	{
+		std::shared_ptr<SharedResult> res = std::make_shared<SharedResult>();
+		res->fieldCount = rd.fieldCount;
+		for (uint32_t i = 0; i < rd.fieldCount; i++)
+			res->names.emplace_back(rd.smnt->fields[i].name, rd.smnt->fields[i].name_length);
+		while (rd.Read()) res->block.Append(rd.results, rd.fieldCount);
+		return res;
+	}
+
+	uint32_t SharedResult::PosFromName(const std::string &name) const
+	{
+		for (uint32_t i = 0; i < names.size(); i++)
+			if (names[i] == name) return i;
+		throw std::runtime_error("Field '" + name + "' not found");
+	}
+
+	///////////////////////////////////////////
+	template<>
+	std::string SharedReader::GetFieldValue<std::string>(uint32_t pos) const
+	{
+		const RowBlock::Cell &c = Value(pos);
+		return std::string(result->Rows().data.data() + c.offset, c.length);
+	}
+
+	template<>
+	std::vector<uint8_t> SharedReader::GetFieldValue<std::vector<uint8_t>>(uint32_t pos) const
+	{
+		const RowBlock::Cell &c = Value(pos);
+		const uint8_t *buf = reinterpret_cast<const uint8_t*>(result->Rows().data.data()) + c.offset;
+		return std::vector<uint8_t>(buf, buf + c.length);
+	}
+
+	template<>
+	TmDateTime SharedReader::GetFieldValue<TmDateTime>(uint32_t pos) const
+	{
+		MYSQL_TIME sqtm = GetFieldValue<MYSQL_TIME>(pos);
+		uint32_t mls = sqtm.second_part / 1000;
+		uint32_t mks = sqtm.second_part % 1000;
+		return TmDateTime(sqtm.year, sqtm.month, sqtm.day, sqtm.hour, sqtm.minute, sqtm.second, mls, mks, 0);
+	}
+
+	template<>
+	Decimal SharedReader::GetFieldValue<Decimal>(uint32_t pos) const
+	{
+		const RowBlock::Cell &c = Value(pos);
+		Decimal dec;
+		if (!Decimal::Parse(result->Rows().data.data() + c.offset, c.length, &dec))
+			throw std::runtime_error(std::string("Field '").append(std::to_string(pos)).append("' is not a decimal"));
+		return dec;
+	}
+
+	///////////////////////////////////////////
+	// the key leaves the map before the waiters wake: later calls run the query again
+	SharedReader SingleFlight::Run(const std::string &key, const std::function<MySqlDataReader()> &execute)
+	{
+		std::promise<std::shared_ptr<const SharedResult>> done;
+		Flight flight;
+		bool leader = false;
+		{
+			std::lock_guard<std::mutex> lk(mtx);
+			auto it = flights.find(key);
+			if (it != flights.end())
+			{
+				joined++;
+				flight = it->second;
+			}
+			else
+			{
+				executed++;
+				leader = true;
+				flight = done.get_future().share();
+				flights.emplace(key, flight);
+			}
+		}
+
+		if (leader)
+		{
+			std::shared_ptr<const SharedResult> res;
+			std::exception_ptr error;
+			try
+			{
+				MySqlDataReader rd = execute();
+				res = SharedResult::Materialize(rd);
+			}
+			catch (...)
+			{
+				error = std::current_exception();
+			}
+			{
+				std::lock_guard<std::mutex> lk(mtx);
+				flights.erase(key);
+			}
+			if (error) done.set_exception(error);
+			else done.set_value(std::move(res));
+		}
+		return SharedReader(flight.get());
+	}
+
+	uint64_t SingleFlight::Executed()
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		return executed;
+	}
+
+	uint64_t SingleFlight::Joined()
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		return joined;
+	}
+}
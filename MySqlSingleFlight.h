@@ -0,0 +1,205 @@
+/*
+Site:		http://hlspx.ocry.com/mysqlconnestion/
+
+History:
+			VERSION
+			1.0.0.0
+Author:
+		Alexey Tretyakov	hlspx@mail.ru
+*/
+
+#pragma once
+
+#include "MySqlPrefetch.h"
+#include "MySqlPreparedStatement.h"
+
+#include <future>
+#include <unordered_map>
+
+namespace Kiff {
+
+	// a result set copied out of its reader; never changed after it is built
+	class SharedResult
+	{
+		friend class SingleFlight;
+
+		RowBlock block;
+		std::vector<std::string> names;
+		uint32_t fieldCount = 0;
+
+		static std::shared_ptr<const SharedResult> Materialize(MySqlDataReader &rd);
+	public:
+		uint32_t RowCount() const { return block.rows; }
+		uint32_t FieldCount() const { return fieldCount; }
+		const RowBlock &Rows() const { return block; }
+		uint32_t PosFromName(const std::string &name) const;
+	};
+
+	//////////////////////////////////////////////////////////////
+	// Cursor over a SharedResult with the reader's accessors; every caller gets its own.
+	class SharedReader
+	{
+		std::shared_ptr<const SharedResult> result;
+		uint32_t row = 0;					// current row + 1, 0 before the first Read
+
+		template<typename T>
+		void GetRefValue(uint32_t pos, T& value) const
+		{
+			value = GetFieldValue<T>(pos);
+		}
+
+		void GetRefValues(uint32_t) const {}
+
+		template<typename T, typename... Targs>
+		void GetRefValues(uint32_t pos, T&& val, Targs&& ... Fargs) const
+		{
+			GetRefValue(pos, val);
+			GetRefValues(++pos, Fargs...);
+		}
+
+		const RowBlock::Cell &Cell(uint32_t pos) const
+		{
+			if (pos >= result->FieldCount()) throw std::runtime_error("SharedReader:: Wrong param index '" + std::to_string(pos) + "' in GetFieldValue");
+			if (row == 0) throw std::runtime_error("SharedReader : Read was not called");
+			return result->Rows().cells[static_cast<size_t>(row - 1) * result->FieldCount() + pos];
+		}
+
+		const RowBlock::Cell &Value(uint32_t pos) const
+		{
+			const RowBlock::Cell &c = Cell(pos);
+			if (c.is_null) throw std::runtime_error("Field '" + std::to_string(pos) + "' is NULL");
+			return c;
+		}
+	public:
+		explicit SharedReader(std::shared_ptr<const SharedResult> iresult) :result(std::move(iresult)) {}
+
+		const std::shared_ptr<const SharedResult> &Result() const { return result; }
+		uint32_t RowCount() const { return result->RowCount(); }
+		uint32_t FieldCount() const { return result->FieldCount(); }
+
+		bool Read()
+		{
+			if (row >= result->RowCount()) return false;
+			row++;
+			return true;
+		}
+
+		// back before the first row
+		void Rewind() { row = 0; }
+
+		bool IsNull(uint32_t pos) const
+		{
+			return Cell(pos).is_null;
+		}
+
+		bool IsNull(const std::string &name) const
+		{
+			return IsNull(result->PosFromName(name));
+		}
+
+		// values are packed without alignment: copied, not dereferenced in place
+		template<typename T>
+		T GetFieldValue(uint32_t pos) const
+		{
+			const RowBlock::Cell &c = Value(pos);
+			T value = T();
+			memcpy(&value, result->Rows().data.data() + c.offset, (c.length < sizeof(T)) ? c.length : sizeof(T));
+			return value;
+		}
+
+		template<typename T>
+		T GetFieldValue(const std::string &name) const
+		{
+			return GetFieldValue<T>(result->PosFromName(name));
+		}
+
+		void GetFieldValue(uint32_t pos, const void **obuf, uint32_t *olen) const
+		{
+			const RowBlock::Cell &c = Value(pos);
+			*obuf = result->Rows().data.data() + c.offset;
+			*olen = c.length;
+		}
+
+		template<typename... Targs>
+		void GetValues(Targs&& ... Fargs) const
+		{
+			GetRefValues(0, Fargs...);
+		}
+	};
+
+	template<>
+	std::string SharedReader::GetFieldValue<std::string>(uint32_t pos) const;
+	template<>
+	std::vector<uint8_t> SharedReader::GetFieldValue<std::vector<uint8_t>>(uint32_t pos) const;
+	template<>
+	TmDateTime SharedReader::GetFieldValue<TmDateTime>(uint32_t pos) const;
+	template<>
+	Decimal SharedReader::GetFieldValue<Decimal>(uint32_t pos) const;
+
+	//////////////////////////////////////////////////////////////
+	// Opt-in deduplication of identical concurrent reads (a hot key missing from a cache):
+	// callers asking for the same query text and parameter bytes while one of them is
+	// running it wait for that execution and share its rows instead of sending their own.
+	// The first caller runs the query on its connection and materializes the whole result;
+	// a failure is rethrown to everyone who waited for it. A call arriving after the
+	// execution finished runs the query again. Parameters take the MySqlCommand::SetValue
+	// types; the connection's session state is not part of the key.
+	class SingleFlight
+	{
+		typedef std::shared_future<std::shared_ptr<const SharedResult>> Flight;
+
+		std::mutex mtx;
+		std::unordered_map<std::string, Flight> flights;
+		uint64_t executed = 0;
+		uint64_t joined = 0;
+
+		SingleFlight(const SingleFlight&) = delete;
+
+		template<typename T>
+		static void AppendKey(std::string &key, const T &value)
+		{
+			typename MySqlParam<T>::Storage st;
+			MySqlParam<T>::Reserve(st);
+			MySqlParam<T>::Store(st, value);
+			uint32_t head[2] = { static_cast<uint32_t>(MySqlParam<T>::Type()), static_cast<uint32_t>(MySqlParam<T>::Length(st)) };
+			key.append(reinterpret_cast<const char*>(head), sizeof(head));
+			key.append(static_cast<const char*>(MySqlParam<T>::Data(st)), head[1]);
+		}
+
+		// the other types MySqlCommand::SetValue takes: C strings are VARCHAR, nullptr is NULL
+		static void AppendKey(std::string &key, const char *value)
+		{
+			AppendKey(key, std::string(value));
+		}
+
+		template<size_t N>
+		static void AppendKey(std::string &key, const char(&value)[N])
+		{
+			AppendKey(key, std::string(value));
+		}
+
+		static void AppendKey(std::string &key, std::nullptr_t)
+		{
+			uint32_t head[2] = { static_cast<uint32_t>(MySqlDbType::Unspecified), 0 };
+			key.append(reinterpret_cast<const char*>(head), sizeof(head));
+		}
+
+		SharedReader Run(const std::string &key, const std::function<MySqlDataReader()> &execute);
+	public:
+		SingleFlight() {}
+
+		template<typename... Args>
+		SharedReader ExecuteReader(MySqlConnection &conn, const std::string &query, const Args&... args)
+		{
+			std::string key = query;
+			key.push_back('\0');
+			int dummy[] = { 0, (AppendKey(key, args), 0)... };
+			(void)dummy;
+			return Run(key, [&]() { return conn.ExecuteReader(query, args...); });
+		}
+
+		// executions sent, calls that shared another caller's execution
+		uint64_t Executed();
+		uint64_t Joined();
+	};
+}
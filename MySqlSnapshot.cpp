@@ -0,0 +1,341 @@
+#include "MySqlSnapshot.h"
+
+#include <cstdio>
+
+namespace Kiff {
+
+	static const char Magic[8] = { 'K', 'I', 'F', 'F', 'S', 'N', 'A', 'P' };
+
+	static bool IsVariable(MySqlDbType type)
+	{
+		switch (static_cast<int>(type) & 0xff)
+		{
+		case MYSQL_TYPE_VARCHAR:
+		case MYSQL_TYPE_TINY_BLOB:
+		case MYSQL_TYPE_MEDIUM_BLOB:
+		case MYSQL_TYPE_LONG_BLOB:
+		case MYSQL_TYPE_BLOB:
+		case MYSQL_TYPE_VAR_STRING:
+		case MYSQL_TYPE_STRING:
+		case MYSQL_TYPE_GEOMETRY:
+		case MYSQL_TYPE_NEWDECIMAL:
+		case MYSQL_TYPE_JSON:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	static uint64_t Align8(uint64_t n)
+	{
+		return (n + 7) & ~static_cast<uint64_t>(7);
+	}
+
+	// bounds-checked cursor over the mapped directory
+	class SnapshotCursor
+	{
+		const char *base;
+		size_t size;
+		size_t pos = 0;
+		const std::string &path;
+	public:
+		SnapshotCursor(const MappedFile &map, const std::string &ipath) :base(map.Data()), size(map.Size()), path(ipath) {}
+
+		const char *Take(uint64_t n)
+		{
+			if (n > size - pos) throw std::runtime_error("MySqlSnapshot : '" + path + "' is truncated");
+			const char *p = base + pos;
+			pos += static_cast<size_t>(n);
+			return p;
+		}
+
+		template<typename T>
+		T Get()
+		{
+			T v;
+			memcpy(&v, Take(sizeof(T)), sizeof(T));
+			return v;
+		}
+
+		std::string String()
+		{
+			uint32_t len = Get<uint32_t>();
+			return std::string(Take(len), len);
+		}
+
+		// a section of the file by absolute offset
+		const char *At(uint64_t offset, uint64_t n) const
+		{
+			if ((offset > size) || (n > size - offset)) throw std::runtime_error("MySqlSnapshot : '" + path + "' is truncated");
+			return base + offset;
+		}
+	};
+
+	MySqlSnapshot::MySqlSnapshot(const std::string &path)
+		:map(path)
+	{
+		SnapshotCursor cur(map, path);
+		if (memcmp(cur.Take(sizeof(Magic)), Magic, sizeof(Magic)) != 0) throw std::runtime_error("MySqlSnapshot : '" + path + "' is not a snapshot");
+		if (cur.Get<uint32_t>() != FormatVersion) throw std::runtime_error("MySqlSnapshot : '" + path + "' has another format version");
+		uint32_t fieldCount = cur.Get<uint32_t>();
+		rowCount = cur.Get<uint64_t>();
+		version = cur.String();
+
+		uint64_t nullBytes = Align8((rowCount + 7) / 8);
+		columns.resize(fieldCount);
+		for (Column &col : columns)
+		{
+			col.name = cur.String();
+			col.type = static_cast<MySqlDbType>(cur.Get<int32_t>());
+			col.width = cur.Get<uint32_t>();
+			uint64_t offset = cur.Get<uint64_t>();
+
+			col.nulls = reinterpret_cast<const uint8_t*>(cur.At(offset, nullBytes));
+			offset += nullBytes;
+			col.offsets = nullptr;
+			if (col.width != 0)
+			{
+				col.values = cur.At(offset, rowCount * col.width);
+				continue;
+			}
+			uint64_t offsetBytes = (rowCount + 1) * sizeof(uint64_t);
+			col.offsets = reinterpret_cast<const uint64_t*>(cur.At(offset, offsetBytes));
+			col.values = cur.At(offset + offsetBytes, col.offsets[rowCount]);
+		}
+	}
+
+	uint32_t MySqlSnapshot::PosFromName(const std::string &name) const
+	{
+		for (uint32_t i = 0; i < columns.size(); i++)
+			if (columns[i].name == name) return i;
+		throw std::runtime_error("Field '" + name + "' not found");
+	}
+
+	const char *MySqlSnapshot::Value(uint32_t pos, uint32_t *olen) const
+	{
+		if (IsNull(pos)) throw std::runtime_error(std::string("Field '").append(std::to_string(pos)).append("' is NULL"));
+		const Column &col = columns[pos];
+		uint64_t r = row - 1;
+		if (col.width != 0)
+		{
+			*olen = col.width;
+			return col.values + r * col.width;
+		}
+		*olen = static_cast<uint32_t>(col.offsets[r + 1] - col.offsets[r]);
+		return col.values + col.offsets[r];
+	}
+
+	template<>
+	std::string MySqlSnapshot::GetFieldValue<std::string>(uint32_t pos) const
+	{
+		uint32_t len;
+		const char *p = Value(pos, &len);
+		return std::string(p, len);
+	}
+
+	template<>
+	std::vector<uint8_t> MySqlSnapshot::GetFieldValue<std::vector<uint8_t>>(uint32_t pos) const
+	{
+		uint32_t len;
+		const uint8_t *p = reinterpret_cast<const uint8_t*>(Value(pos, &len));
+		return std::vector<uint8_t>(p, p + len);
+	}
+
+	template<>
+	TmDateTime MySqlSnapshot::GetFieldValue<TmDateTime>(uint32_t pos) const
+	{
+		MYSQL_TIME sqtm = GetFieldValue<MYSQL_TIME>(pos);
+		uint32_t mls = sqtm.second_part / 1000;
+		uint32_t mks = sqtm.second_part % 1000;
+		return TmDateTime(sqtm.year, sqtm.month, sqtm.day, sqtm.hour, sqtm.minute, sqtm.second, mls, mks, 0);
+	}
+
+	template<>
+	Decimal MySqlSnapshot::GetFieldValue<Decimal>(uint32_t pos) const
+	{
+		uint32_t len;
+		const char *p = Value(pos, &len);
+		Decimal dec;
+		if (!Decimal::Parse(p, len, &dec))
+			throw std::runtime_error(std::string("Field '").append(std::to_string(pos)).append("' is not a decimal"));
+		return dec;
+	}
+
+	///////////////////////////////////////////
+	size_t MySqlSnapshot::Write(MySqlDataReader &rd, const std::string &path, const std::string &version)
+	{
+		struct Out
+		{
+			std::string name;
+			MySqlDbType type;
+			uint32_t width;
+			std::vector<uint8_t> nulls;
+			std::string values;
+			std::vector<uint64_t> offsets;
+		};
+
+		std::vector<Out> outs(rd.fieldCount);
+		for (uint32_t i = 0; i < rd.fieldCount; i++)
+		{
+			const MYSQL_FIELD &fld = rd.smnt->fields[i];
+			outs[i].name.assign(fld.name, fld.name_length);
+			outs[i].type = rd.results[i].buffer_type;
+			outs[i].width = IsVariable(outs[i].type) ? 0 : static_cast<uint32_t>(rd.results[i].buffer_length);
+			if (outs[i].width == 0) outs[i].offsets.push_back(0);
+		}
+
+		// columns are collected in memory, then written one after another
+		uint64_t rows = 0;
+		while (rd.Read())
+		{
+			for (uint32_t i = 0; i < rd.fieldCount; i++)
+			{
+				const DataStore &ds = rd.results[i];
+				Out &out = outs[i];
+				if (rows % 8 == 0) out.nulls.push_back(0);
+				if (ds.is_null) out.nulls.back() |= static_cast<uint8_t>(1 << (rows % 8));
+				if (out.width != 0)
+				{
+					if (ds.is_null) out.values.append(out.width, '\0');
+					else out.values.append(static_cast<const char*>(ds.buffer), out.width);
+					continue;
+				}
+				if (!ds.is_null) out.values.append(static_cast<const char*>(ds.buffer), (ds.length < ds.buffer_length) ? ds.length : ds.buffer_length);
+				out.offsets.push_back(out.values.size());
+			}
+			rows++;
+		}
+
+		std::string head(Magic, sizeof(Magic));
+		auto put = [&head](const void *p, size_t n) { head.append(static_cast<const char*>(p), n); };
+		auto putString = [&put](const std::string &s) { uint32_t len = static_cast<uint32_t>(s.length()); put(&len, sizeof(len)); put(s.data(), len); };
+		uint32_t format = FormatVersion;
+		put(&format, sizeof(format));
+		put(&rd.fieldCount, sizeof(rd.fieldCount));
+		put(&rows, sizeof(rows));
+		putString(version);
+
+		uint64_t headSize = head.size();
+		for (const Out &out : outs) headSize += sizeof(uint32_t) + out.name.length() + sizeof(int32_t) + sizeof(uint32_t) + sizeof(uint64_t);
+		uint64_t nullBytes = Align8((rows + 7) / 8);
+		uint64_t offset = Align8(headSize);
+		for (Out &out : outs)
+		{
+			int32_t type = static_cast<int32_t>(out.type);
+			putString(out.name);
+			put(&type, sizeof(type));
+			put(&out.width, sizeof(out.width));
+			put(&offset, sizeof(offset));
+			out.nulls.resize(static_cast<size_t>(nullBytes), 0);
+			offset += nullBytes + out.offsets.size() * sizeof(uint64_t) + Align8(out.values.size());
+		}
+		head.resize(static_cast<size_t>(Align8(head.size())), '\0');
+
+#ifdef _WIN32
+#pragma warning (disable:4996)
+#endif
+		FILE *file = fopen(path.c_str(), "wb");
+#ifdef _WIN32
+#pragma warning (default:4996)
+#endif
+		if (file == nullptr) throw std::runtime_error("MySqlSnapshot : can't open '" + path + "'");
+		static const char pad[8] = { 0 };
+		fwrite(head.data(), 1, head.size(), file);
+		for (const Out &out : outs)
+		{
+			fwrite(out.nulls.data(), 1, out.nulls.size(), file);
+			if (!out.offsets.empty()) fwrite(out.offsets.data(), sizeof(uint64_t), out.offsets.size(), file);
+			fwrite(out.values.data(), 1, out.values.size(), file);
+			fwrite(pad, 1, static_cast<size_t>(Align8(out.values.size()) - out.values.size()), file);
+		}
+		bool failed = ferror(file) != 0;
+		if ((fclose(file) != 0) || failed) throw std::runtime_error("MySqlSnapshot : can't write '" + path + "'");
+		return static_cast<size_t>(rows);
+	}
+
+	// `db`.`table` or `table`
+	static std::string QuoteTable(const std::string &table)
+	{
+		size_t dot = table.find('.');
+		if (dot == std::string::npos) return MySqlConnection::QuoteIdentifier(table);
+		return MySqlConnection::QuoteIdentifier(table.substr(0, dot)) + "." + MySqlConnection::QuoteIdentifier(table.substr(dot + 1));
+	}
+
+	std::string MySqlSnapshot::Freshness(MySqlConnection &conn, const std::vector<std::string> &tables, SnapshotCheck check)
+	{
+		std::string ret;
+		if (check == SnapshotCheck::Checksum)
+		{
+			std::string query = "CHECKSUM TABLE ";
+			for (size_t i = 0; i < tables.size(); i++)
+			{
+				if (i != 0) query += ", ";
+				query += QuoteTable(tables[i]);
+			}
+			ret = "C:";
+			MySqlDataReader rd = conn.ExecuteReader(query);
+			while (rd.Read())
+			{
+				if (rd.IsNull(1)) throw std::runtime_error("MySqlSnapshot : table '" + rd.GetFieldValue<std::string>(0) + "' not found");
+				ret += rd.GetFieldValue<std::string>(0) + "#" + std::to_string(rd.GetFieldValue<int64_t>(1)) + ";";
+			}
+			return ret;
+		}
+
+		// UPDATE_TIME has whole seconds: a write later in the same second would not change it.
+		// The comparison is an INT: cast to BIGINT for the 8-byte read
+		bool recent = false;
+		for (const std::string &table : tables)
+		{
+			size_t dot = table.find('.');
+			MySqlDataReader rd = (dot == std::string::npos)
+				? conn.ExecuteReader("SELECT UPDATE_TIME, CREATE_TIME, CAST(UPDATE_TIME >= NOW() - INTERVAL 1 SECOND AS SIGNED) FROM information_schema.TABLES WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = ?", table)
+				: conn.ExecuteReader("SELECT UPDATE_TIME, CREATE_TIME, CAST(UPDATE_TIME >= NOW() - INTERVAL 1 SECOND AS SIGNED) FROM information_schema.TABLES WHERE TABLE_SCHEMA = ? AND TABLE_NAME = ?", table.substr(0, dot), table.substr(dot + 1));
+			if (!rd.Read()) throw std::runtime_error("MySqlSnapshot : table '" + table + "' not found");
+			if (!rd.IsNull(2) && (rd.GetFieldValue<int64_t>(2) != 0)) recent = true;
+			ret += table + "@";
+			ret += rd.IsNull(0) ? std::string("-") : rd.GetFieldValue<TmDateTime>(0).ToString();
+			ret += "/";
+			ret += rd.IsNull(1) ? std::string("-") : rd.GetFieldValue<TmDateTime>(1).ToString();
+			ret += ";";
+		}
+		return (recent ? "U!:" : "U:") + ret;
+	}
+
+	MySqlSnapshot MySqlSnapshot::Load(MySqlConnection &conn, const std::string &path, const std::string &query,
+		const std::vector<std::string> &tables, SnapshotCheck check)
+	{
+		// taken before the query: a change in between makes the next Load refresh again
+		std::string version = Freshness(conn, tables, check);
+		try
+		{
+			MySqlSnapshot snap(path);
+			if ((snap.Version() == version) && (version.compare(0, 3, "U!:") != 0)) return snap;
+		}
+		catch (std::exception &)
+		{
+			// missing, damaged or of another format: rebuilt below
+		}
+
+		std::string tmp = path + ".tmp";
+		try
+		{
+			MySqlDataReader rd = conn.ExecuteReader(query);
+			Write(rd, tmp, version);
+		}
+		catch (...)
+		{
+			remove(tmp.c_str());
+			throw;
+		}
+#ifdef _WIN32
+		remove(path.c_str());
+#endif
+		if (rename(tmp.c_str(), path.c_str()) != 0)
+		{
+			remove(tmp.c_str());
+			throw std::runtime_error("MySqlSnapshot : can't replace '" + path + "'");
+		}
+		return MySqlSnapshot(path);
+	}
+}
@@ -0,0 +1,150 @@
+/*
+Site:		http://hlspx.ocry.com/mysqlconnestion/
+
+History:
+			VERSION
+			1.0.0.0
+Author:
+		Alexey Tretyakov	hlspx@mail.ru
+*/
+
+#pragma once
+
+#include "MySqlConnection.h"
+#include "MappedFile.h"
+
+#include <cstring>
+
+namespace Kiff {
+
+	// how MySqlSnapshot::Load decides that a snapshot is stale
+	enum class SnapshotCheck
+	{
+		UpdateTime,			// information_schema.TABLES update/create time: cheap, forgets InnoDB writes across a server restart;
+							// a table written within the last second is always re-read (the time has whole seconds)
+		Checksum			// CHECKSUM TABLE: exact, reads the tables
+	};
+
+	//////////////////////////////////////////////////////////////
+	// Query result saved as a columnar file and mapped back without parsing.
+	// Each column is a null bitmap followed by fixed-width values (MySqlDataReader buffer
+	// layout, zero padded) or by row offsets and bytes for strings, blobs and decimals.
+	// The file carries a version string used to check freshness against the server.
+	class MySqlSnapshot
+	{
+		struct Column
+		{
+			std::string name;
+			MySqlDbType type;
+			uint32_t width;					// 0 - variable length
+			const uint8_t *nulls;
+			const char *values;
+			const uint64_t *offsets;		// rows + 1, variable length only
+		};
+
+		MappedFile map;
+		std::string version;
+		std::vector<Column> columns;
+		uint64_t rowCount = 0;
+		uint64_t row = 0;					// current row + 1, 0 before the first Read
+
+		template<typename T>
+		void GetRefValue(uint32_t pos, T& value) const
+		{
+			value = GetFieldValue<T>(pos);
+		}
+
+		void GetRefValues(uint32_t) const {}
+
+		template<typename T, typename... Targs>
+		void GetRefValues(uint32_t pos, T&& val, Targs&& ... Fargs) const
+		{
+			GetRefValue(pos, val);
+			GetRefValues(++pos, Fargs...);
+		}
+
+		uint32_t PosFromName(const std::string &name) const;
+		const char *Value(uint32_t pos, uint32_t *olen) const;
+	public:
+		static const uint32_t FormatVersion = 1;
+
+		// maps the file and reads its directory; throws if it is not a snapshot of this format
+		explicit MySqlSnapshot(const std::string &path);
+
+		MySqlSnapshot(MySqlSnapshot &&other) = default;
+		MySqlSnapshot& operator=(MySqlSnapshot &&other) = default;
+
+		// remaining rows of rd to path, returns the row count
+		static size_t Write(MySqlDataReader &rd, const std::string &path, const std::string &version);
+
+		// version string of the tables ("db.table" or "table") as of now
+		static std::string Freshness(MySqlConnection &conn, const std::vector<std::string> &tables, SnapshotCheck check = SnapshotCheck::UpdateTime);
+
+		// the snapshot at path if its version matches the tables, otherwise runs query and replaces the file
+		static MySqlSnapshot Load(MySqlConnection &conn, const std::string &path, const std::string &query,
+			const std::vector<std::string> &tables, SnapshotCheck check = SnapshotCheck::UpdateTime);
+
+		const std::string &Version() const { return version; }
+		uint64_t RowCount() const { return rowCount; }
+		uint32_t FieldCount() const { return static_cast<uint32_t>(columns.size()); }
+
+		bool Read()
+		{
+			if (row >= rowCount) return false;
+			row++;
+			return true;
+		}
+
+		// back before the first row
+		void Rewind() { row = 0; }
+
+		bool IsNull(uint32_t pos) const
+		{
+			if (pos >= columns.size()) throw std::runtime_error("MySqlSnapshot:: Wrong param index '" + std::to_string(pos) + "' in IsNull");
+			if (row == 0) throw std::runtime_error("MySqlSnapshot : Read was not called");
+			uint64_t r = row - 1;
+			return (columns[pos].nulls[r / 8] >> (r % 8)) & 1;
+		}
+
+		bool IsNull(const std::string &name) const
+		{
+			return IsNull(PosFromName(name));
+		}
+
+		template<typename T>
+		T GetFieldValue(uint32_t pos) const
+		{
+			uint32_t len;
+			const char *p = Value(pos, &len);
+			T value = T();
+			memcpy(&value, p, (len < sizeof(T)) ? len : sizeof(T));
+			return value;
+		}
+
+		template<typename T>
+		T GetFieldValue(const std::string &name) const
+		{
+			return GetFieldValue<T>(PosFromName(name));
+		}
+
+		void GetFieldValue(uint32_t pos, const void **obuf, uint32_t *olen) const
+		{
+			*obuf = Value(pos, olen);
+		}
+
+		template<typename... Targs>
+		void GetValues(Targs&& ... Fargs) const
+		{
+			GetRefValues(0, Fargs...);
+		}
+	};
+
+	template<>
+	std::string MySqlSnapshot::GetFieldValue<std::string>(uint32_t pos) const;
+	template<>
+	std::vector<uint8_t> MySqlSnapshot::GetFieldValue<std::vector<uint8_t>>(uint32_t pos) const;
+	template<>
+	TmDateTime MySqlSnapshot::GetFieldValue<TmDateTime>(uint32_t pos) const;
+	template<>
+	Decimal MySqlSnapshot::GetFieldValue<Decimal>(uint32_t pos) const;
+}
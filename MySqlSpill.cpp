@@ -0,0 +1,159 @@
+#include "MySqlSpill.h"
+
+namespace Kiff {
+
+	ResultBudget &ResultBudget::Process()
+	{
+		static ResultBudget budget;
+		return budget;
+	}
+
+	bool ResultBudget::Take(uint64_t bytes)
+	{
+		uint64_t lim = limit;
+		uint64_t cur = used;
+		do
+		{
+			if ((lim != 0) && (cur + bytes > lim)) return false;
+		} while (!used.compare_exchange_weak(cur, cur + bytes));
+		return true;
+	}
+
+	///////////////////////////////////////////
+	RowSpool::RowSpool(uint32_t ifieldCount, std::shared_ptr<ResultBudget> ibudget)
+		:fieldCount(ifieldCount), budget(ibudget)
+	{
+	}
+
+	RowSpool::~RowSpool()
+	{
+		Release();
+		if (file != nullptr) fclose(file);
+	}
+
+	bool RowSpool::Reserve(uint64_t bytes)
+	{
+		if (held + bytes <= reserved) return true;
+		uint64_t n = held + bytes - reserved;
+		if (n < Chunk) n = Chunk;
+		if (!ResultBudget::Process().Take(n)) return false;
+		if (budget && !budget->Take(n))
+		{
+			ResultBudget::Process().Give(n);
+			return false;
+		}
+		reserved += n;
+		return true;
+	}
+
+	void RowSpool::Release()
+	{
+		ResultBudget::Process().Give(reserved);
+		if (budget) budget->Give(reserved);
+		reserved = 0;
+		held = 0;
+	}
+
+	void RowSpool::Append(const DataStore *stores)
+	{
+		if (file != nullptr)
+		{
+			Write(stores);
+			return;
+		}
+
+		uint64_t bytes = fieldCount * sizeof(RowBlock::Cell);
+		for (uint32_t i = 0; i < fieldCount; i++)
+			if (!stores[i].is_null) bytes += (stores[i].length < stores[i].buffer_length) ? stores[i].length : stores[i].buffer_length;
+		if (!Reserve(bytes))
+		{
+			Spill();
+			Write(stores);
+			return;
+		}
+
+		if (blocks.empty() || blocks.back().rows == BlockRows)
+		{
+			blocks.emplace_back();
+			blocks.back().cells.reserve(static_cast<size_t>(BlockRows) * fieldCount);
+		}
+		blocks.back().Append(stores, fieldCount);
+		held += bytes;
+	}
+
+	// the rows held so far go to the file first, later ones follow them
+	void RowSpool::Spill()
+	{
+#ifdef _WIN32
+#pragma warning (disable:4996)
+#endif
+		file = tmpfile();
+#ifdef _WIN32
+#pragma warning (default:4996)
+#endif
+		if (file == nullptr) throw std::runtime_error("RowSpool : can't create a temp file");
+		setvbuf(file, nullptr, _IOFBF, 256 * 1024);
+
+		for (const RowBlock &b : blocks)
+		{
+			for (const RowBlock::Cell &c : b.cells)
+			{
+				uint32_t len = c.is_null ? ~0u : c.length;
+				fwrite(&len, sizeof(len), 1, file);
+				if (!c.is_null) fwrite(b.data.data() + c.offset, 1, c.length, file);
+			}
+		}
+		std::vector<RowBlock>().swap(blocks);
+		Release();
+	}
+
+	void RowSpool::Write(const DataStore *stores)
+	{
+		for (uint32_t i = 0; i < fieldCount; i++)
+		{
+			const DataStore &ds = stores[i];
+			uint32_t len = ds.is_null ? ~0u : static_cast<uint32_t>((ds.length < ds.buffer_length) ? ds.length : ds.buffer_length);
+			fwrite(&len, sizeof(len), 1, file);
+			if (!ds.is_null) fwrite(ds.buffer, 1, len, file);
+		}
+	}
+
+	void RowSpool::Finish()
+	{
+		if (file == nullptr) return;
+		if (ferror(file)) throw std::runtime_error("RowSpool : can't write the temp file");
+		map = MappedFile(file);
+	}
+
+	bool RowSpool::Next(DataStore *results)
+	{
+		if (file != nullptr)
+		{
+			if (offset >= map.Size()) return false;
+			for (uint32_t i = 0; i < fieldCount; i++)
+			{
+				uint32_t len;
+				memcpy(&len, map.Data() + offset, sizeof(len));
+				offset += sizeof(len);
+				results[i].is_null = (len == ~0u);
+				if (results[i].is_null) continue;
+				results[i].length = len;
+				memcpy(results[i].buffer, map.Data() + offset, len);
+				offset += len;
+			}
+			return true;
+		}
+
+		while (block < blocks.size())
+		{
+			if (row < blocks[block].rows)
+			{
+				blocks[block].CopyRow(row++, results, fieldCount);
+				return true;
+			}
+			block++;
+			row = 0;
+		}
+		return false;
+	}
+}
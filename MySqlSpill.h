@@ -0,0 +1,76 @@
+/*
+Site:		http://hlspx.ocry.com/mysqlconnestion/
+
+History:
+			VERSION
+			1.0.0.0
+Author:
+		Alexey Tretyakov	hlspx@mail.ru
+*/
+
+#pragma once
+
+#include "MySqlPrefetch.h"
+#include "MappedFile.h"
+
+namespace Kiff {
+
+	// bytes of buffered result rows held in memory against a limit (0 - unlimited)
+	class ResultBudget
+	{
+		std::atomic<uint64_t> used{ 0 };
+		std::atomic<uint64_t> limit{ 0 };
+	public:
+		// all connections' readers together
+		static ResultBudget &Process();
+
+		void SetLimit(uint64_t bytes) { limit = bytes; }
+		uint64_t Limit() const { return limit; }
+		uint64_t Used() const { return used; }
+
+		// false, taking nothing, if it would go over the limit
+		bool Take(uint64_t bytes);
+		void Give(uint64_t bytes) { used -= bytes; }
+	};
+
+	//////////////////////////////////////////////////////////////
+	// Buffered result set with a memory ceiling: rows are kept in RowBlocks while both the
+	// connection's and the process budget allow, then everything goes to an unlinked temp file
+	// (per column: 32-bit length, ~0 for NULL, bytes) that is memory-mapped for reading.
+	class RowSpool
+	{
+		static const uint64_t Chunk = 64 * 1024;		// budget is taken in chunks, not per row
+		static const uint32_t BlockRows = 1024;
+
+		uint32_t fieldCount;
+		std::shared_ptr<ResultBudget> budget;			// connection's, may be null
+		uint64_t reserved = 0;							// taken from the budgets
+		uint64_t held = 0;								// used by blocks
+
+		std::vector<RowBlock> blocks;
+		size_t block = 0;								// read position in blocks
+		uint32_t row = 0;
+
+		FILE *file = nullptr;
+		MappedFile map;
+		size_t offset = 0;								// read position in map
+
+		RowSpool(const RowSpool&) = delete;
+		bool Reserve(uint64_t bytes);
+		void Release();
+		void Spill();
+		void Write(const DataStore *stores);
+	public:
+		RowSpool(uint32_t ifieldCount, std::shared_ptr<ResultBudget> ibudget);
+		~RowSpool();
+
+		// the current row of bound buffers
+		void Append(const DataStore *stores);
+
+		// after the last Append
+		void Finish();
+
+		bool Next(DataStore *results);
+		bool Spilled() const { return file != nullptr; }
+	};
+}
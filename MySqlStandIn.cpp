@@ -0,0 +1,745 @@
+#include "MySqlStandIn.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <map>
+#include <random>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+typedef SOCKET socket_t;
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int socket_t;
+#endif
+
+namespace Kiff {
+
+	// protocol constants, as in the server's mysql_com.h
+	static const uint8_t ComQuit = 0x01;
+	static const uint8_t ComInitDb = 0x02;
+	static const uint8_t ComQuery = 0x03;
+	static const uint8_t ComPing = 0x0e;
+	static const uint8_t ComStmtPrepare = 0x16;
+	static const uint8_t ComStmtExecute = 0x17;
+	static const uint8_t ComStmtSendLongData = 0x18;
+	static const uint8_t ComStmtClose = 0x19;
+	static const uint8_t ComStmtReset = 0x1a;
+	static const uint8_t ComSetOption = 0x1b;
+	static const uint8_t ComStmtFetch = 0x1c;
+
+	static const uint32_t Capabilities =
+		0x00000001 |		// CLIENT_LONG_PASSWORD (MySQL, not MariaDB extended capabilities)
+		0x00000002 |		// CLIENT_FOUND_ROWS
+		0x00000004 |		// CLIENT_LONG_FLAG
+		0x00000008 |		// CLIENT_CONNECT_WITH_DB
+		0x00000200 |		// CLIENT_PROTOCOL_41
+		0x00002000 |		// CLIENT_TRANSACTIONS
+		0x00008000 |		// CLIENT_SECURE_CONNECTION
+		0x00010000 |		// CLIENT_MULTI_STATEMENTS
+		0x00020000 |		// CLIENT_MULTI_RESULTS
+		0x00040000 |		// CLIENT_PS_MULTI_RESULTS
+		0x00080000 |		// CLIENT_PLUGIN_AUTH
+		0x00200000;			// CLIENT_PLUGIN_AUTH_LENENC_CLIENT_DATA
+
+	static const uint16_t StatusAutocommit = 0x0002;
+	static const uint16_t StatusCursorExists = 0x0040;
+	static const uint16_t StatusLastRowSent = 0x0080;
+	static const uint8_t CursorReadOnly = 0x01;
+	static const uint16_t UnsignedFlag = 0x0020;
+
+	static void CloseSocket(intptr_t sock)
+	{
+#ifdef _WIN32
+		closesocket(static_cast<socket_t>(sock));
+#else
+		close(static_cast<socket_t>(sock));
+#endif
+	}
+
+	static void ShutdownSocket(intptr_t sock)
+	{
+#ifdef _WIN32
+		shutdown(static_cast<socket_t>(sock), SD_BOTH);
+#else
+		shutdown(static_cast<socket_t>(sock), SHUT_RDWR);
+#endif
+	}
+
+	static void PutInt(std::string &p, uint64_t v, int bytes)
+	{
+		for (int i = 0; i < bytes; i++) p.push_back(static_cast<char>(v >> (i * 8)));
+	}
+
+	static void PutLenenc(std::string &p, uint64_t v)
+	{
+		if (v < 251) p.push_back(static_cast<char>(v));
+		else if (v < 0x10000) { p.push_back(static_cast<char>(0xfc)); PutInt(p, v, 2); }
+		else if (v < 0x1000000) { p.push_back(static_cast<char>(0xfd)); PutInt(p, v, 3); }
+		else { p.push_back(static_cast<char>(0xfe)); PutInt(p, v, 8); }
+	}
+
+	static void PutString(std::string &p, const std::string &s)
+	{
+		PutLenenc(p, s.length());
+		p.append(s);
+	}
+
+	static uint64_t GetInt(const std::string &p, size_t pos, int bytes)
+	{
+		uint64_t v = 0;
+		for (int i = 0; (i < bytes) && (pos + i < p.length()); i++) v |= static_cast<uint64_t>(static_cast<uint8_t>(p[pos + i])) << (i * 8);
+		return v;
+	}
+
+	static bool IsText(enum_field_types type)
+	{
+		switch (type)
+		{
+		case MYSQL_TYPE_VARCHAR:
+		case MYSQL_TYPE_VAR_STRING:
+		case MYSQL_TYPE_STRING:
+		case MYSQL_TYPE_TINY_BLOB:
+		case MYSQL_TYPE_MEDIUM_BLOB:
+		case MYSQL_TYPE_LONG_BLOB:
+		case MYSQL_TYPE_BLOB:
+		case MYSQL_TYPE_JSON:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	// the client sizes its string buffers by the column length
+	static uint32_t DefaultLength(enum_field_types type)
+	{
+		switch (type)
+		{
+		case MYSQL_TYPE_TINY: return 4;
+		case MYSQL_TYPE_SHORT: return 6;
+		case MYSQL_TYPE_INT24:
+		case MYSQL_TYPE_LONG: return 11;
+		case MYSQL_TYPE_LONGLONG: return 20;
+		case MYSQL_TYPE_FLOAT: return 12;
+		case MYSQL_TYPE_DOUBLE: return 22;
+		case MYSQL_TYPE_NEWDECIMAL:
+		case MYSQL_TYPE_DECIMAL: return 67;
+		case MYSQL_TYPE_DATE: return 10;
+		case MYSQL_TYPE_TIME: return 17;
+		case MYSQL_TYPE_DATETIME:
+		case MYSQL_TYPE_TIMESTAMP: return 26;
+		case MYSQL_TYPE_YEAR: return 4;
+		case MYSQL_TYPE_BLOB:
+		case MYSQL_TYPE_TINY_BLOB:
+		case MYSQL_TYPE_MEDIUM_BLOB:
+		case MYSQL_TYPE_LONG_BLOB: return 65535;
+		default: return 255;
+		}
+	}
+
+	// "2024-01-31 10:20:30.5" -> microseconds part "500000"
+	static uint32_t Micros(const std::string &text)
+	{
+		size_t dot = text.find('.');
+		if (dot == std::string::npos) return 0;
+		std::string frac = text.substr(dot + 1, 6);
+		frac.resize(6, '0');
+		return static_cast<uint32_t>(strtoul(frac.c_str(), nullptr, 10));
+	}
+
+	// binary protocol value of a text cell
+	static void PutBinary(std::string &p, const StandInColumn &col, const std::string &text)
+	{
+		bool isUnsigned = (col.flags & UnsignedFlag) != 0;
+		uint64_t n = isUnsigned ? strtoull(text.c_str(), nullptr, 10) : static_cast<uint64_t>(strtoll(text.c_str(), nullptr, 10));
+		switch (col.type)
+		{
+		case MYSQL_TYPE_TINY: PutInt(p, n, 1); return;
+		case MYSQL_TYPE_SHORT:
+		case MYSQL_TYPE_YEAR: PutInt(p, n, 2); return;
+		case MYSQL_TYPE_INT24:
+		case MYSQL_TYPE_LONG: PutInt(p, n, 4); return;
+		case MYSQL_TYPE_LONGLONG: PutInt(p, n, 8); return;
+		case MYSQL_TYPE_FLOAT:
+		{
+			float f = strtof(text.c_str(), nullptr);
+			p.append(reinterpret_cast<const char*>(&f), sizeof(f));
+			return;
+		}
+		case MYSQL_TYPE_DOUBLE:
+		{
+			double d = strtod(text.c_str(), nullptr);
+			p.append(reinterpret_cast<const char*>(&d), sizeof(d));
+			return;
+		}
+		case MYSQL_TYPE_DATE:
+		case MYSQL_TYPE_DATETIME:
+		case MYSQL_TYPE_TIMESTAMP:
+		{
+			unsigned y = 0, mo = 0, d = 0, h = 0, mi = 0, s = 0;
+			sscanf(text.c_str(), "%u-%u-%u %u:%u:%u", &y, &mo, &d, &h, &mi, &s);
+			p.push_back(11);
+			PutInt(p, y, 2);
+			p.push_back(static_cast<char>(mo));
+			p.push_back(static_cast<char>(d));
+			p.push_back(static_cast<char>(h));
+			p.push_back(static_cast<char>(mi));
+			p.push_back(static_cast<char>(s));
+			PutInt(p, Micros(text), 4);
+			return;
+		}
+		case MYSQL_TYPE_TIME:
+		{
+			bool neg = !text.empty() && (text[0] == '-');
+			unsigned h = 0, mi = 0, s = 0;
+			sscanf(text.c_str() + (neg ? 1 : 0), "%u:%u:%u", &h, &mi, &s);
+			p.push_back(12);
+			p.push_back(neg ? 1 : 0);
+			PutInt(p, h / 24, 4);
+			p.push_back(static_cast<char>(h % 24));
+			p.push_back(static_cast<char>(mi));
+			p.push_back(static_cast<char>(s));
+			PutInt(p, Micros(text), 4);
+			return;
+		}
+		default:
+			PutString(p, text);
+			return;
+		}
+	}
+
+	///////////////////////////////////////////
+	StandInResponse StandInResponse::Ok(uint64_t affected)
+	{
+		StandInResponse r;
+		r.affectedRows = affected;
+		return r;
+	}
+
+	StandInResponse StandInResponse::Error(uint16_t code, const std::string &sqlstate, const std::string &message)
+	{
+		StandInResponse r;
+		r.errorCode = code;
+		r.sqlstate = sqlstate;
+		r.message = message;
+		return r;
+	}
+
+	StandInResponse StandInResponse::Rows(const std::vector<StandInColumn> &columns, const std::vector<std::vector<Nullable<std::string>>> &rows)
+	{
+		std::shared_ptr<const std::vector<std::vector<Nullable<std::string>>>> data = std::make_shared<std::vector<std::vector<Nullable<std::string>>>>(rows);
+		return Generated(columns, rows.size(), [data](uint64_t row, uint32_t col) { return (*data)[static_cast<size_t>(row)][col]; });
+	}
+
+	StandInResponse StandInResponse::Generated(const std::vector<StandInColumn> &columns, uint64_t rowCount, CellFn cell)
+	{
+		StandInResponse r;
+		r.columns = columns;
+		r.rowCount = rowCount;
+		r.cell = std::move(cell);
+		return r;
+	}
+
+	//////////////////////////////////////////////////////////////
+	// one client connection: packets are buffered and released no earlier than the link allows
+	class MySqlStandIn::Session
+	{
+		struct Statement
+		{
+			std::string query;
+			uint16_t params = 0;
+			std::unique_ptr<StandInResponse> cursor;		// open read-only cursor
+			uint64_t next = 0;
+		};
+
+		MySqlStandIn &server;
+		socket_t sock;
+		uint32_t id;
+		std::mt19937 rng;
+		uint8_t seq = 0;
+		std::string out;
+		std::chrono::steady_clock::time_point due;
+		std::map<uint32_t, Statement> stmts;
+		uint32_t nextStmt = 1;
+
+		double Dice() { return (rng() >> 5) * (1.0 / 134217728.0); }
+
+		bool Receive(char *buf, size_t len)
+		{
+			while (len > 0)
+			{
+				int n = recv(sock, buf, static_cast<int>(len), 0);
+				if (n <= 0) return false;
+				buf += n;
+				len -= static_cast<size_t>(n);
+			}
+			return true;
+		}
+
+		bool ReadPacket(std::string &payload)
+		{
+			payload.clear();
+			for (;;)
+			{
+				char hdr[4];
+				if (!Receive(hdr, sizeof(hdr))) return false;
+				size_t len = static_cast<size_t>(GetInt(std::string(hdr, 3), 0, 3));
+				seq = static_cast<uint8_t>(hdr[3] + 1);
+				size_t pos = payload.size();
+				payload.resize(pos + len);
+				if ((len != 0) && !Receive(&payload[pos], len)) return false;
+				if (len < 0xffffff) return true;
+			}
+		}
+
+		void Flush()
+		{
+			size_t pos = 0;
+			while (pos < out.size())
+			{
+#ifdef _WIN32
+				int n = send(sock, out.data() + pos, static_cast<int>(out.size() - pos), 0);
+#else
+				int n = static_cast<int>(send(sock, out.data() + pos, out.size() - pos, MSG_NOSIGNAL));
+#endif
+				if (n <= 0) throw std::runtime_error("MySqlStandIn : send failed");
+				pos += static_cast<size_t>(n);
+			}
+			out.clear();
+		}
+
+		// the packet leaves after the link's per-packet delay and its transfer time
+		void Pace(size_t bytes)
+		{
+			const StandInLink &link = server.link;
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			if (due < now) due = now;
+			due += std::chrono::microseconds(link.packetMicroseconds);
+			if (link.bytesPerSecond != 0) due += std::chrono::nanoseconds(bytes * 1000000000ull / link.bytesPerSecond);
+			if (due > now)
+			{
+				Flush();
+				std::this_thread::sleep_until(due);
+			}
+			else if (out.size() >= 65536) Flush();
+		}
+
+		void Packet(const std::string &payload)
+		{
+			size_t pos = 0;
+			for (;;)
+			{
+				size_t n = payload.size() - pos;
+				if (n > 0xffffff) n = 0xffffff;
+				Pace(n + 4);
+				PutInt(out, n, 3);
+				out.push_back(static_cast<char>(seq++));
+				out.append(payload, pos, n);
+				pos += n;
+				if (n < 0xffffff) return;
+			}
+		}
+
+		void Ok(uint64_t affected = 0)
+		{
+			std::string p(1, '\0');
+			PutLenenc(p, affected);
+			PutLenenc(p, 0);
+			PutInt(p, StatusAutocommit, 2);
+			PutInt(p, 0, 2);
+			Packet(p);
+		}
+
+		void Eof(uint16_t status = StatusAutocommit)
+		{
+			std::string p(1, static_cast<char>(0xfe));
+			PutInt(p, 0, 2);
+			PutInt(p, status, 2);
+			Packet(p);
+		}
+
+		void Error(uint16_t code, const std::string &sqlstate, const std::string &message)
+		{
+			std::string p(1, static_cast<char>(0xff));
+			PutInt(p, code, 2);
+			p.push_back('#');
+			std::string state(sqlstate);
+			state.resize(5, '0');
+			p.append(state);
+			p.append(message);
+			Packet(p);
+		}
+
+		void Column(const StandInColumn &col)
+		{
+			std::string p;
+			PutString(p, "def");
+			PutString(p, "standin");
+			PutString(p, "");
+			PutString(p, "");
+			PutString(p, col.name);
+			PutString(p, col.name);
+			p.push_back(0x0c);
+			PutInt(p, IsText(col.type) ? 33 : 63, 2);
+			PutInt(p, (col.length != 0) ? col.length : DefaultLength(col.type), 4);
+			p.push_back(static_cast<char>(col.type));
+			PutInt(p, col.flags, 2);
+			p.push_back(((col.type == MYSQL_TYPE_FLOAT) || (col.type == MYSQL_TYPE_DOUBLE)) ? 31 : 0);
+			PutInt(p, 0, 2);
+			Packet(p);
+		}
+
+		void Columns(const StandInResponse &r, uint16_t status)
+		{
+			std::string p;
+			PutLenenc(p, r.columns.size());
+			Packet(p);
+			for (const StandInColumn &col : r.columns) Column(col);
+			Eof(status);
+		}
+
+		void Row(const StandInResponse &r, uint64_t row, bool binary)
+		{
+			uint32_t count = static_cast<uint32_t>(r.columns.size());
+			std::string p;
+			size_t bitmap = 0;
+			if (binary)
+			{
+				p.push_back(0);
+				bitmap = p.size();
+				p.append((count + 7 + 2) / 8, '\0');
+			}
+			for (uint32_t col = 0; col < count; col++)
+			{
+				Nullable<std::string> v = r.cell(row, col);
+				if (!v)
+				{
+					if (binary) p[bitmap + (col + 2) / 8] |= static_cast<char>(1 << ((col + 2) % 8));
+					else p.push_back(static_cast<char>(0xfb));
+				}
+				else if (binary) PutBinary(p, r.columns[col], *v);
+				else PutString(p, *v);
+			}
+			Packet(p);
+		}
+
+		// handler's answer with the link's failures; drop - close the connection part way
+		StandInResponse Respond(const std::string &query, bool &drop)
+		{
+			StandInResponse r = server.handler ? server.handler(query) : StandInResponse::Ok();
+			const StandInLink &link = server.link;
+			if ((link.errorRate > 0) && (Dice() < link.errorRate))
+				r = StandInResponse::Error(link.failCode, (link.failCode == 1213) ? "40001" : "HY000", "stand-in failure");
+			drop = (link.disconnectRate > 0) && (Dice() < link.disconnectRate);
+			due = std::chrono::steady_clock::now() + std::chrono::microseconds(r.delayMicroseconds);
+			return r;
+		}
+
+		// false if the connection is to be dropped
+		bool Answer(const StandInResponse &r, bool binary, bool drop)
+		{
+			if (drop && r.columns.empty()) return false;
+			if (r.errorCode != 0) Error(r.errorCode, r.sqlstate, r.message);
+			else if (r.columns.empty()) Ok(r.affectedRows);
+			else
+			{
+				Columns(r, StatusAutocommit);
+				for (uint64_t row = 0; row < r.rowCount; row++)
+				{
+					if (drop && (row == r.rowCount / 2)) return false;
+					Row(r, row, binary);
+				}
+				Eof();
+			}
+			return true;
+		}
+
+		bool Query(const std::string &query)
+		{
+			bool drop;
+			StandInResponse r = Respond(query, drop);
+			return Answer(r, false, drop);
+		}
+
+		void Prepare(const std::string &query)
+		{
+			StandInResponse r = server.handler ? server.handler(query) : StandInResponse::Ok();
+			if (r.errorCode != 0)
+			{
+				Error(r.errorCode, r.sqlstate, r.message);
+				return;
+			}
+
+			Statement st;
+			st.query = query;
+			bool quoted = false;
+			char quote = 0;
+			for (char c : query)
+			{
+				if (quoted) quoted = (c != quote);
+				else if ((c == '\'') || (c == '"') || (c == '`')) { quoted = true; quote = c; }
+				else if (c == '?') st.params++;
+			}
+			uint32_t sid = nextStmt++;
+
+			std::string p(1, '\0');
+			PutInt(p, sid, 4);
+			PutInt(p, r.columns.size(), 2);
+			PutInt(p, st.params, 2);
+			p.push_back(0);
+			PutInt(p, 0, 2);
+			Packet(p);
+			if (st.params != 0)
+			{
+				for (uint16_t i = 0; i < st.params; i++) Column(StandInColumn("?", MYSQL_TYPE_VAR_STRING));
+				Eof();
+			}
+			if (!r.columns.empty())
+			{
+				for (const StandInColumn &col : r.columns) Column(col);
+				Eof();
+			}
+			stmts[sid] = std::move(st);
+		}
+
+		bool Execute(const std::string &req)
+		{
+			auto it = stmts.find(static_cast<uint32_t>(GetInt(req, 1, 4)));
+			if (it == stmts.end())
+			{
+				Error(1243, "HY000", "Unknown prepared statement handler");
+				return true;
+			}
+			uint8_t flags = (req.size() > 5) ? static_cast<uint8_t>(req[5]) : 0;
+			Statement &st = it->second;
+			st.cursor.reset();
+
+			bool drop;
+			StandInResponse r = Respond(st.query, drop);
+			if (!(flags & CursorReadOnly) || (r.errorCode != 0) || r.columns.empty()) return Answer(r, true, drop);
+			if (drop) return false;
+
+			Columns(r, StatusAutocommit | StatusCursorExists);
+			st.cursor.reset(new StandInResponse(std::move(r)));
+			st.next = 0;
+			return true;
+		}
+
+		void Fetch(const std::string &req)
+		{
+			auto it = stmts.find(static_cast<uint32_t>(GetInt(req, 1, 4)));
+			if ((it == stmts.end()) || !it->second.cursor)
+			{
+				Error(1421, "HY000", "The statement has no open cursor");
+				return;
+			}
+			Statement &st = it->second;
+			uint64_t rows = GetInt(req, 5, 4);
+			due = std::chrono::steady_clock::now();
+			for (; (rows > 0) && (st.next < st.cursor->rowCount); rows--) Row(*st.cursor, st.next++, true);
+			Eof(StatusAutocommit | StatusCursorExists | ((st.next == st.cursor->rowCount) ? StatusLastRowSent : 0));
+		}
+
+		void Handshake()
+		{
+			std::string scramble;
+			for (int i = 0; i < 20; i++) scramble.push_back(static_cast<char>('!' + rng() % 90));
+
+			std::string p(1, 10);
+			p.append("5.7.99-standin");
+			p.push_back(0);
+			PutInt(p, id, 4);
+			p.append(scramble, 0, 8);
+			p.push_back(0);
+			PutInt(p, Capabilities & 0xffff, 2);
+			p.push_back(33);
+			PutInt(p, StatusAutocommit, 2);
+			PutInt(p, Capabilities >> 16, 2);
+			p.push_back(21);
+			p.append(10, '\0');
+			p.append(scramble, 8, 12);
+			p.push_back(0);
+			p.append("mysql_native_password");
+			p.push_back(0);
+			seq = 0;
+			Packet(p);
+			Flush();
+		}
+	public:
+		Session(MySqlStandIn &iserver, socket_t isock, uint32_t iid)
+			:server(iserver), sock(isock), id(iid), rng(iserver.link.seed + iid) {}
+
+		void Run()
+		{
+			Handshake();
+			std::string req;
+			if (!ReadPacket(req)) return;
+			Ok();
+			Flush();
+
+			while (ReadPacket(req) && !req.empty())
+			{
+				bool alive = true;
+				switch (static_cast<uint8_t>(req[0]))
+				{
+				case ComQuit:
+					return;
+				case ComInitDb:
+				case ComPing:
+					due = std::chrono::steady_clock::now();
+					Ok();
+					break;
+				case ComQuery:
+					alive = Query(req.substr(1));
+					break;
+				case ComStmtPrepare:
+					due = std::chrono::steady_clock::now();
+					Prepare(req.substr(1));
+					break;
+				case ComStmtExecute:
+					alive = Execute(req);
+					break;
+				case ComStmtFetch:
+					Fetch(req);
+					break;
+				case ComStmtClose:
+					stmts.erase(static_cast<uint32_t>(GetInt(req, 1, 4)));
+					continue;
+				case ComStmtSendLongData:
+					continue;
+				case ComStmtReset:
+				{
+					auto it = stmts.find(static_cast<uint32_t>(GetInt(req, 1, 4)));
+					if (it != stmts.end()) it->second.cursor.reset();
+					Ok();
+					break;
+				}
+				case ComSetOption:
+					Eof();
+					break;
+				default:
+					Error(1047, "08S01", "Unknown command");
+					break;
+				}
+				Flush();
+				if (!alive) return;
+			}
+		}
+	};
+
+	///////////////////////////////////////////
+	MySqlStandIn::MySqlStandIn(Handler ihandler, const StandInLink &ilink, uint16_t iport)
+		:handler(std::move(ihandler)), link(ilink)
+	{
+#ifdef _WIN32
+		WSADATA wsa;
+		if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) throw std::runtime_error("MySqlStandIn : WSAStartup failed");
+#endif
+		socket_t sock = socket(AF_INET, SOCK_STREAM, 0);
+#ifdef _WIN32
+		if (sock == INVALID_SOCKET) throw std::runtime_error("MySqlStandIn : socket failed");
+#else
+		if (sock < 0) throw std::runtime_error("MySqlStandIn : socket failed");
+#endif
+		int on = 1;
+		setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&on), sizeof(on));
+
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = htons(iport);
+		socklen_t len = sizeof(addr);
+		if ((bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) || (listen(sock, 64) != 0)
+			|| (getsockname(sock, reinterpret_cast<sockaddr*>(&addr), &len) != 0))
+		{
+			CloseSocket(static_cast<intptr_t>(sock));
+			throw std::runtime_error("MySqlStandIn : can't listen on port " + std::to_string(iport));
+		}
+		listener = static_cast<intptr_t>(sock);
+		port = ntohs(addr.sin_port);
+		acceptor = std::thread(&MySqlStandIn::Accept, this);
+	}
+
+	std::string MySqlStandIn::ConnectionString() const
+	{
+		return "host=127.0.0.1;port=" + std::to_string(port) + ";uid=standin;pwd=standin";
+	}
+
+	void MySqlStandIn::Accept()
+	{
+		for (;;)
+		{
+			socket_t sock = accept(static_cast<socket_t>(listener), nullptr, nullptr);
+			if (stopping)
+			{
+#ifdef _WIN32
+				if (sock != INVALID_SOCKET) CloseSocket(static_cast<intptr_t>(sock));
+#else
+				if (sock >= 0) CloseSocket(sock);
+#endif
+				return;
+			}
+#ifdef _WIN32
+			if (sock == INVALID_SOCKET) continue;
+#else
+			if (sock < 0) continue;
+#endif
+			int on = 1;
+			setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&on), sizeof(on));
+
+			std::lock_guard<std::mutex> lk(mtx);
+			sockets.push_back(static_cast<intptr_t>(sock));
+			sessions.emplace_back(&MySqlStandIn::Serve, this, static_cast<intptr_t>(sock), nextId++);
+		}
+	}
+
+	void MySqlStandIn::Serve(intptr_t sock, uint32_t id)
+	{
+		try
+		{
+			Session(*this, static_cast<socket_t>(sock), id).Run();
+		}
+		catch (std::exception &)
+		{
+			// client went away or the handler failed: the connection is closed
+		}
+		{
+			std::lock_guard<std::mutex> lk(mtx);
+			for (size_t i = 0; i < sockets.size(); i++)
+			{
+				if (sockets[i] != sock) continue;
+				sockets.erase(sockets.begin() + i);
+				break;
+			}
+		}
+		CloseSocket(sock);
+	}
+
+	void MySqlStandIn::Stop()
+	{
+		if (stopping.exchange(true)) return;
+		ShutdownSocket(listener);
+		CloseSocket(listener);
+		if (acceptor.joinable()) acceptor.join();
+
+		std::vector<std::thread> threads;
+		{
+			std::lock_guard<std::mutex> lk(mtx);
+			for (intptr_t sock : sockets) ShutdownSocket(sock);
+			threads.swap(sessions);
+		}
+		for (std::thread &t : threads) t.join();
+#ifdef _WIN32
+		WSACleanup();
+#endif
+	}
+}
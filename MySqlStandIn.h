@@ -0,0 +1,112 @@
+/*
+Site:		http://hlspx.ocry.com/mysqlconnestion/
+
+History:
+			VERSION
+			1.0.0.0
+Author:
+		Alexey Tretyakov	hlspx@mail.ru
+*/
+
+#pragma once
+
+#include "MySqlResult.h"
+
+#include <mariadb/mysql.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Kiff {
+
+	struct StandInColumn
+	{
+		std::string name;
+		enum_field_types type;
+		uint16_t flags;
+		uint32_t length;
+
+		StandInColumn(const std::string &iname, enum_field_types itype, uint16_t iflags = 0, uint32_t ilength = 0)
+			:name(iname), type(itype), flags(iflags), length(ilength) {}
+	};
+
+	//////////////////////////////////////////////////////////////
+	// What the stand-in server answers to one statement: OK, error or rows.
+	// Cells are text ("12", "2024-01-31 10:00:00.5", "abc"), converted for the binary protocol.
+	struct StandInResponse
+	{
+		typedef std::function<Nullable<std::string>(uint64_t row, uint32_t col)> CellFn;
+
+		std::vector<StandInColumn> columns;		// empty - OK or error packet
+		uint64_t rowCount = 0;
+		CellFn cell;
+		uint64_t affectedRows = 0;
+		uint16_t errorCode = 0;					// != 0 - error packet
+		std::string sqlstate;
+		std::string message;
+		uint32_t delayMicroseconds = 0;			// "execution time" before the first packet
+
+		static StandInResponse Ok(uint64_t affected = 0);
+		static StandInResponse Error(uint16_t code, const std::string &sqlstate, const std::string &message);
+		static StandInResponse Rows(const std::vector<StandInColumn> &columns, const std::vector<std::vector<Nullable<std::string>>> &rows);
+
+		// rows produced on the fly, nothing is kept in memory
+		static StandInResponse Generated(const std::vector<StandInColumn> &columns, uint64_t rowCount, CellFn cell);
+	};
+
+	// link and failure model of the stand-in server, applied per connection
+	struct StandInLink
+	{
+		uint32_t packetMicroseconds = 0;		// added to every packet sent
+		uint64_t bytesPerSecond = 0;			// 0 - unlimited
+		double errorRate = 0;					// share of statements answered with failCode
+		uint16_t failCode = 1213;				// ER_LOCK_DEADLOCK
+		double disconnectRate = 0;				// share of statements dropping the connection mid-response
+		uint32_t seed = 1;						// failures are reproducible for a seed and connection order
+	};
+
+	//////////////////////////////////////////////////////////////
+	// Localhost server speaking enough of the MySQL protocol for MySqlConnection: handshake
+	// (any user and password), COM_QUERY, COM_STMT_PREPARE/EXECUTE/FETCH/CLOSE/RESET, COM_PING,
+	// COM_INIT_DB. Statements are answered by the handler, one thread per client connection.
+	// For client-side benchmarks without a database; no SQL is parsed.
+	class MySqlStandIn
+	{
+	public:
+		typedef std::function<StandInResponse(const std::string &query)> Handler;
+	private:
+		class Session;
+
+		Handler handler;
+		StandInLink link;
+		intptr_t listener = -1;
+		uint16_t port = 0;
+		std::thread acceptor;
+		std::atomic<bool> stopping{ false };
+		std::atomic<uint32_t> nextId{ 1 };
+
+		std::mutex mtx;
+		std::vector<std::thread> sessions;
+		std::vector<intptr_t> sockets;			// open client sockets, shut down by Stop
+
+		MySqlStandIn(const MySqlStandIn&) = delete;
+		void Accept();
+		void Serve(intptr_t sock, uint32_t id);
+	public:
+		// port 0 - any free port
+		MySqlStandIn(Handler ihandler, const StandInLink &ilink = StandInLink(), uint16_t iport = 0);
+		~MySqlStandIn() { Stop(); }
+
+		uint16_t Port() const { return port; }
+
+		// for MySqlConnection
+		std::string ConnectionString() const;
+
+		void Stop();
+	};
+}
@@ -0,0 +1,169 @@
+#include "MySqlWatchdog.h"
+#include <mariadb/mysqld_error.h>
+
+namespace Kiff {
+
+	MySqlWatchdog &MySqlWatchdog::Instance()
+	{
+		static MySqlWatchdog watchdog;
+		return watchdog;
+	}
+
+	MySqlWatchdog::~MySqlWatchdog()
+	{
+		{
+			std::lock_guard<std::mutex> lk(mtx);
+			stop = true;
+		}
+		cv.notify_all();
+		if (thr.joinable()) thr.join();
+	}
+
+	// caller holds mtx; the thread starts with the first deadline or cancel
+	void MySqlWatchdog::Wake()
+	{
+		if (!thr.joinable()) thr = std::thread(&MySqlWatchdog::Run, this);
+		cv.notify_one();
+	}
+
+	const uint64_t MySqlWatchdog::Claimed;
+
+	// caller holds mtx
+	uint64_t MySqlWatchdog::Register(const std::string &connStr, unsigned long threadId, std::chrono::steady_clock::time_point deadline, bool cancelled)
+	{
+		uint64_t id = nextId;
+		nextId += 2;
+		Ticket &tk = tickets[id];
+		tk.connStr = connStr;
+		tk.threadId = threadId;
+		tk.deadline = deadline;
+		tk.state = State::Running;
+		tk.cancelled = cancelled;
+		return id;
+	}
+
+	uint64_t MySqlWatchdog::Arm(const std::string &connStr, unsigned long threadId, std::chrono::milliseconds timeout)
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		if (timeout.count() == 0) return Register(connStr, threadId, std::chrono::steady_clock::time_point::max(), false);
+		uint64_t id = Register(connStr, threadId, std::chrono::steady_clock::now() + timeout, false);
+		Wake();
+		return id;
+	}
+
+	MySqlWatchdog::Outcome MySqlWatchdog::Disarm(uint64_t ticket)
+	{
+		std::unique_lock<std::mutex> lk(mtx);
+		auto it = tickets.find(ticket);
+		if (it == tickets.end()) return Outcome::Completed;
+		killed.wait(lk, [it] { return it->second.state != State::Killing; });
+
+		Outcome ret = Outcome::Completed;
+		if (it->second.state == State::Killed) ret = it->second.cancelled ? Outcome::Cancelled : Outcome::TimedOut;
+		tickets.erase(it);
+		return ret;
+	}
+
+	bool MySqlWatchdog::Cancel(uint64_t ticket)
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		auto it = tickets.find(ticket);
+		if ((it == tickets.end()) || (it->second.state != State::Running)) return false;
+		it->second.cancelled = true;
+		it->second.deadline = std::chrono::steady_clock::now();
+		Wake();
+		return true;
+	}
+
+	bool MySqlWatchdog::Cancel(WatchdogSlot &slot, const std::string &connStr)
+	{
+		uint64_t tk = slot.ticket.load();
+		if ((tk == 0) || (tk == Claimed)) return false;
+		if ((tk & 1) == 0) return Cancel(tk);
+
+		// the run number in tk keeps the claim from landing on the slot's next statement
+		unsigned long threadId = slot.threadId.load();
+		if (!slot.ticket.compare_exchange_strong(tk, Claimed)) return false;
+		{
+			std::lock_guard<std::mutex> lk(mtx);
+			tk = Register(connStr, threadId, std::chrono::steady_clock::now(), true);
+			Wake();
+		}
+		slot.ticket = tk;
+		return true;
+	}
+
+	MySqlWatchdog::Outcome MySqlWatchdog::Disarm(WatchdogSlot &slot)
+	{
+		uint64_t tk = slot.ticket.load();
+		for (;;)
+		{
+			if (tk == Claimed)
+			{
+				std::this_thread::yield();
+				tk = slot.ticket.load();
+			}
+			else if (slot.ticket.compare_exchange_weak(tk, 0)) break;
+		}
+		return ((tk & 1) != 0) ? Outcome::Completed : Instance().Disarm(tk);
+	}
+
+	void MySqlWatchdog::Run()
+	{
+		std::unique_lock<std::mutex> lk(mtx);
+		while (!stop)
+		{
+			auto now = std::chrono::steady_clock::now();
+			auto next = std::chrono::steady_clock::time_point::max();
+			Ticket *due = nullptr;
+			for (auto &kvp : tickets)
+			{
+				Ticket &tk = kvp.second;
+				if (tk.state != State::Running) continue;
+				if (tk.deadline <= now)
+				{
+					due = &tk;
+					break;
+				}
+				if (tk.deadline < next) next = tk.deadline;
+			}
+
+			if (due == nullptr)
+			{
+				if (next == std::chrono::steady_clock::time_point::max()) cv.wait(lk);
+				else cv.wait_until(lk, next);
+				continue;
+			}
+
+			// the ticket stays in the map while Killing: Disarm waits for it
+			due->state = State::Killing;
+			std::string connStr = due->connStr;
+			unsigned long threadId = due->threadId;
+			lk.unlock();
+			Kill(connStr, threadId);
+			lk.lock();
+			due->state = State::Killed;
+			killed.notify_all();
+		}
+	}
+
+	void MySqlWatchdog::Kill(const std::string &connStr, unsigned long threadId)
+	{
+		std::string query = "KILL QUERY " + std::to_string(threadId);
+		for (int attempt = 0; attempt < 2; attempt++)
+		{
+			try
+			{
+				std::unique_ptr<MySqlConnection> &side = sides[connStr];
+				if (!side) side.reset(new MySqlConnection(connStr));
+				if (mysql_real_query(side->mysql, query.data(), static_cast<unsigned long>(query.length())) == 0) return;
+				if (mysql_errno(side->mysql) == ER_NO_SUCH_THREAD) return;		// connection already gone
+				side.reset();
+			}
+			catch (std::exception &)
+			{
+				sides.erase(connStr);
+			}
+		}
+	}
+}
@@ -0,0 +1,108 @@
+/*
+Site:		http://hlspx.ocry.com/mysqlconnestion/
+
+History:
+			VERSION
+			1.0.0.0
+Author:
+		Alexey Tretyakov	hlspx@mail.ru
+*/
+
+#pragma once
+
+#include "MySqlConnection.h"
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace Kiff {
+
+	//////////////////////////////////////////////////////////////
+	// Process-wide deadline keeper: a statement with a deadline holds a ticket; when the
+	// deadline passes or Cancel is called, KILL QUERY <thread id> is sent on a side
+	// connection opened with the same connection string. A statement without a deadline
+	// only marks its WatchdogSlot, Cancel registers a ticket for it. Thread safe.
+	class MySqlWatchdog
+	{
+		enum class State { Running, Killing, Killed };
+
+		struct Ticket
+		{
+			std::string connStr;
+			unsigned long threadId;
+			std::chrono::steady_clock::time_point deadline;
+			State state;
+			bool cancelled;
+		};
+
+		std::mutex mtx;
+		std::condition_variable cv;			// watchdog thread
+		std::condition_variable killed;		// Disarm waiting for a KILL in progress
+		std::map<uint64_t, Ticket> tickets;
+		uint64_t nextId = 2;				// even, odd slot values are unarmed statements
+		bool stop = false;
+		std::thread thr;
+
+		std::map<std::string, std::unique_ptr<MySqlConnection>> sides;		// watchdog thread only
+
+		MySqlWatchdog() {}
+		MySqlWatchdog(const MySqlWatchdog&) = delete;
+		void Run();
+		void Kill(const std::string &connStr, unsigned long threadId);
+		void Wake();
+		uint64_t Register(const std::string &connStr, unsigned long threadId, std::chrono::steady_clock::time_point deadline, bool cancelled);
+	public:
+		enum class Outcome { Completed, Cancelled, TimedOut };
+
+		static const uint64_t Claimed = ~1ull;		// slot value while Cancel registers a ticket
+
+		~MySqlWatchdog();
+
+		static MySqlWatchdog &Instance();
+
+		// timeout 0 - no deadline, the statement can still be cancelled
+		uint64_t Arm(const std::string &connStr, unsigned long threadId, std::chrono::milliseconds timeout);
+
+		// statement returned; waits for a KILL in flight so it can't hit the next statement
+		Outcome Disarm(uint64_t ticket);
+
+		// from any thread; false if the ticket is no longer running
+		bool Cancel(uint64_t ticket);
+
+		// from any thread: the statement running in slot on a connection of connStr
+		bool Cancel(WatchdogSlot &slot, const std::string &connStr);
+
+		// the slot's statement returned; the watchdog is only involved if it holds a ticket
+		static Outcome Disarm(WatchdogSlot &slot);
+	};
+
+	// one running statement, published in its slot for Cancel from other threads;
+	// only a deadline takes the watchdog's lock
+	class WatchdogTicket
+	{
+		WatchdogSlot *slot = nullptr;
+
+		WatchdogTicket(const WatchdogTicket&) = delete;
+	public:
+		WatchdogTicket() {}
+		~WatchdogTicket() { Disarm(); }
+
+		void Arm(WatchdogSlot &islot, const std::string &connStr, unsigned long threadId, std::chrono::milliseconds timeout)
+		{
+			slot = &islot;
+			slot->threadId = threadId;
+			if (timeout.count() == 0) slot->ticket = (++slot->runs << 1) | 1;
+			else slot->ticket = MySqlWatchdog::Instance().Arm(connStr, threadId, timeout);
+		}
+
+		MySqlWatchdog::Outcome Disarm()
+		{
+			if (slot == nullptr) return MySqlWatchdog::Outcome::Completed;
+			WatchdogSlot *s = slot;
+			slot = nullptr;
+			return MySqlWatchdog::Disarm(*s);
+		}
+	};
+}
@@ -0,0 +1,313 @@
+#include "MySqlWorkload.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <thread>
+
+namespace Kiff {
+
+	static const char Magic[8] = { 'K', 'I', 'F', 'F', 'W', 'K', 'L', 'D' };
+
+	static void PutVarint(std::string &out, uint64_t v)
+	{
+		while (v >= 0x80)
+		{
+			out.push_back(static_cast<char>(v | 0x80));
+			v >>= 7;
+		}
+		out.push_back(static_cast<char>(v));
+	}
+
+	static uint64_t GetVarint(const uint8_t *&p, const uint8_t *end)
+	{
+		uint64_t v = 0;
+		for (int shift = 0; ; shift += 7)
+		{
+			if ((p == end) || (shift > 63)) throw std::runtime_error("WorkloadLog : truncated file");
+			uint8_t b = *p++;
+			v |= static_cast<uint64_t>(b & 0x7f) << shift;
+			if ((b & 0x80) == 0) return v;
+		}
+	}
+
+	static uint64_t Micros(std::chrono::steady_clock::duration d)
+	{
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(d).count());
+	}
+
+	///////////////////////////////////////////
+	WorkloadCapture::WorkloadCapture(const std::string &path)
+		:origin(std::chrono::steady_clock::now())
+	{
+		if (!(file = fopen(path.c_str(), "wb"))) throw std::runtime_error("WorkloadCapture : can't create '" + path + "'");
+		buf.append(Magic, sizeof(Magic));
+		for (int i = 0; i < 4; i++) buf.push_back(static_cast<char>(FormatVersion >> (i * 8)));
+	}
+
+	WorkloadCapture::~WorkloadCapture()
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		Write();
+		fclose(file);
+	}
+
+	// write errors surface in Flush, Record must not fail the statement
+	void WorkloadCapture::Write()
+	{
+		if (!buf.empty()) fwrite(buf.data(), 1, buf.size(), file);
+		buf.clear();
+	}
+
+	void WorkloadCapture::Flush()
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		Write();
+		if ((fflush(file) != 0) || ferror(file)) throw std::runtime_error("WorkloadCapture : write failed");
+	}
+
+	uint64_t WorkloadCapture::Events()
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		return events;
+	}
+
+	void WorkloadCapture::Record(uint32_t session, const std::string &query, const DataStore *bindings, uint32_t paramCount,
+		std::chrono::steady_clock::time_point start, bool failed)
+	{
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+		// the event's tail is built outside the lock
+		std::string rec;
+		PutVarint(rec, Micros(end - start));
+		rec.push_back(static_cast<char>(((bindings != nullptr) ? 1 : 0) | (failed ? 2 : 0)));
+		PutVarint(rec, paramCount);
+		for (uint32_t i = 0; i < paramCount; i++)
+		{
+			const DataStore &ds = bindings[i];
+			PutVarint(rec, static_cast<uint64_t>(ds.buffer_type));
+			if (ds.is_null || (ds.buffer == nullptr))
+			{
+				PutVarint(rec, 0);
+				continue;
+			}
+			PutVarint(rec, static_cast<uint64_t>(ds.length) + 1);
+			rec.append(static_cast<const char*>(ds.buffer), ds.length);
+		}
+
+		std::lock_guard<std::mutex> lk(mtx);
+		auto it = statements.find(query);
+		if (it == statements.end())
+		{
+			it = statements.emplace(query, static_cast<uint32_t>(statements.size())).first;
+			buf.push_back('S');
+			PutVarint(buf, it->second);
+			PutVarint(buf, query.length());
+			buf.append(query);
+		}
+		buf.push_back('E');
+		PutVarint(buf, session);
+		PutVarint(buf, it->second);
+		PutVarint(buf, Micros(start - origin));
+		buf.append(rec);
+		events++;
+		if (buf.size() >= BufferSize) Write();
+	}
+
+	///////////////////////////////////////////
+	WorkloadLog WorkloadLog::Load(const std::string &path)
+	{
+		MappedFile map(path);
+		const uint8_t *p = reinterpret_cast<const uint8_t*>(map.Data());
+		const uint8_t *end = p + map.Size();
+		if ((map.Size() < sizeof(Magic) + 4) || (memcmp(p, Magic, sizeof(Magic)) != 0))
+			throw std::runtime_error("WorkloadLog : '" + path + "' is not a workload capture");
+		p += sizeof(Magic);
+		uint32_t version = p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+		if (version != WorkloadCapture::FormatVersion) throw std::runtime_error("WorkloadLog : unsupported version " + std::to_string(version));
+		p += 4;
+
+		WorkloadLog log;
+		while (p != end)
+		{
+			char tag = static_cast<char>(*p++);
+			if (tag == 'S')
+			{
+				uint64_t id = GetVarint(p, end);
+				uint64_t len = GetVarint(p, end);
+				if ((id != log.statements.size()) || (len > static_cast<uint64_t>(end - p))) throw std::runtime_error("WorkloadLog : corrupt statement record");
+				log.statements.emplace_back(reinterpret_cast<const char*>(p), static_cast<size_t>(len));
+				p += len;
+			}
+			else if (tag == 'E')
+			{
+				WorkloadEvent ev;
+				ev.session = static_cast<uint32_t>(GetVarint(p, end));
+				ev.statement = static_cast<uint32_t>(GetVarint(p, end));
+				ev.start = std::chrono::microseconds(GetVarint(p, end));
+				ev.duration = std::chrono::microseconds(GetVarint(p, end));
+				if ((p == end) || (ev.statement >= log.statements.size())) throw std::runtime_error("WorkloadLog : corrupt event record");
+				uint8_t flags = *p++;
+				ev.prepared = (flags & 1) != 0;
+				ev.failed = (flags & 2) != 0;
+				ev.params.resize(static_cast<size_t>(GetVarint(p, end)));
+				for (WorkloadParam &prm : ev.params)
+				{
+					prm.type = static_cast<MySqlDbType>(GetVarint(p, end));
+					uint64_t len = GetVarint(p, end);
+					prm.isNull = (len == 0);
+					if (prm.isNull) continue;
+					if (len - 1 > static_cast<uint64_t>(end - p)) throw std::runtime_error("WorkloadLog : corrupt event record");
+					prm.bytes.assign(reinterpret_cast<const char*>(p), static_cast<size_t>(len - 1));
+					p += len - 1;
+				}
+				log.events.push_back(std::move(ev));
+			}
+			else throw std::runtime_error("WorkloadLog : unknown record");
+		}
+
+		// records are written as statements finish
+		std::stable_sort(log.events.begin(), log.events.end(), [](const WorkloadEvent &a, const WorkloadEvent &b) { return a.start < b.start; });
+		return log;
+	}
+
+	///////////////////////////////////////////
+	struct ReplaySample
+	{
+		uint32_t statement;
+		std::chrono::microseconds latency;
+		bool failed;
+	};
+
+	// nearest-rank percentiles
+	static WorkloadLatency Summarize(const std::string &query, std::vector<std::chrono::microseconds> &latencies, uint64_t errors)
+	{
+		WorkloadLatency lat;
+		lat.query = query;
+		lat.count = latencies.size();
+		lat.errors = errors;
+		if (latencies.empty()) return lat;
+
+		std::sort(latencies.begin(), latencies.end());
+		std::chrono::microseconds sum(0);
+		for (std::chrono::microseconds l : latencies) sum += l;
+		auto rank = [&](double q) { return latencies[static_cast<size_t>(q * (latencies.size() - 1) + 0.5)]; };
+		lat.mean = sum / static_cast<int64_t>(latencies.size());
+		lat.p50 = rank(0.50);
+		lat.p90 = rank(0.90);
+		lat.p99 = rank(0.99);
+		lat.max = latencies.back();
+		return lat;
+	}
+
+	WorkloadReport WorkloadReplay::Run(const std::string &connStr, double speed)
+	{
+		std::map<uint32_t, std::vector<const WorkloadEvent*>> bySession;
+		for (const WorkloadEvent &ev : log.events) bySession[ev.session].push_back(&ev);
+
+		std::vector<const std::vector<const WorkloadEvent*>*> sessions;
+		std::vector<std::unique_ptr<MySqlConnection>> conns;
+		for (const auto &s : bySession)
+		{
+			sessions.push_back(&s.second);
+			conns.emplace_back(new MySqlConnection(connStr));		// before the clock starts
+		}
+
+		std::vector<std::vector<ReplaySample>> samples(sessions.size());
+		std::vector<std::chrono::microseconds> lags(sessions.size(), std::chrono::microseconds(0));
+		std::chrono::steady_clock::time_point base = std::chrono::steady_clock::now();
+
+		auto run = [&](size_t idx)
+		{
+			MySqlConnection &conn = *conns[idx];
+			std::map<uint32_t, MySqlCommand> commands;
+			for (const WorkloadEvent *ev : *sessions[idx])
+			{
+				if (speed > 0)
+				{
+					std::chrono::steady_clock::time_point due = base + std::chrono::microseconds(static_cast<int64_t>(ev->start.count() / speed));
+					std::this_thread::sleep_until(due);
+					std::chrono::microseconds lag = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - due);
+					if (lag > lags[idx]) lags[idx] = lag;
+				}
+
+				const std::string &query = log.statements[ev->statement];
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				bool failed = true;
+				try
+				{
+					if (!ev->prepared) failed = !conn.TryExecuteNonQuery(query);
+					else
+					{
+						auto it = commands.find(ev->statement);
+						if (it == commands.end())
+						{
+							MySqlResult<MySqlCommand> cmd = conn.TryCreateCommand(query);
+							if (cmd) it = commands.emplace(ev->statement, std::move(cmd.Value())).first;
+						}
+						if (it != commands.end())
+						{
+							MySqlCommand &cmd = it->second;
+							for (uint32_t i = 0; i < ev->params.size(); i++)
+							{
+								const WorkloadParam &prm = ev->params[i];
+								if (prm.isNull)
+								{
+									cmd.SetNull(i);
+									continue;
+								}
+								cmd.BindParam(i, prm.type);
+								cmd.SetValue(i, prm.bytes.data(), prm.bytes.length());
+							}
+							failed = !cmd.TryExecuteNonQuery();
+						}
+					}
+				}
+				catch (std::exception &)
+				{
+					failed = true;
+				}
+				samples[idx].push_back(ReplaySample{ ev->statement, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start), failed });
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (size_t i = 1; i < sessions.size(); i++) threads.emplace_back(run, i);
+		if (!sessions.empty()) run(0);
+		for (std::thread &t : threads) t.join();
+
+		WorkloadReport report;
+		report.elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - base);
+		for (std::chrono::microseconds lag : lags) report.maxLag = std::max(report.maxLag, lag);
+
+		std::vector<std::vector<std::chrono::microseconds>> perStatement(log.statements.size());
+		std::vector<uint64_t> errors(log.statements.size(), 0);
+		std::vector<std::chrono::microseconds> all;
+		uint64_t allErrors = 0;
+		for (const std::vector<ReplaySample> &ss : samples)
+		{
+			for (const ReplaySample &s : ss)
+			{
+				perStatement[s.statement].push_back(s.latency);
+				all.push_back(s.latency);
+				if (s.failed)
+				{
+					errors[s.statement]++;
+					allErrors++;
+				}
+			}
+		}
+
+		report.total = Summarize(std::string(), all, allErrors);
+		for (size_t i = 0; i < perStatement.size(); i++)
+		{
+			if (!perStatement[i].empty()) report.statements.push_back(Summarize(log.statements[i], perStatement[i], errors[i]));
+		}
+		std::sort(report.statements.begin(), report.statements.end(), [](const WorkloadLatency &a, const WorkloadLatency &b)
+		{
+			return a.mean * static_cast<int64_t>(a.count) > b.mean * static_cast<int64_t>(b.count);
+		});
+		return report;
+	}
+}
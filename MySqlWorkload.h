@@ -0,0 +1,121 @@
+/*
+Site:		http://hlspx.ocry.com/mysqlconnestion/
+
+History:
+			VERSION
+			1.0.0.0
+Author:
+		Alexey Tretyakov	hlspx@mail.ru
+*/
+
+#pragma once
+
+#include "MySqlConnection.h"
+
+#include <cstdio>
+#include <mutex>
+#include <unordered_map>
+
+namespace Kiff {
+
+	struct WorkloadParam
+	{
+		MySqlDbType type;
+		bool isNull;
+		std::string bytes;
+	};
+
+	struct WorkloadEvent
+	{
+		uint32_t session;						// capturing MySqlConnection
+		uint32_t statement;						// index in WorkloadLog::statements
+		bool prepared;							// MySqlCommand, else text query
+		bool failed;
+		std::chrono::microseconds start;		// since the capture began
+		std::chrono::microseconds duration;
+		std::vector<WorkloadParam> params;
+	};
+
+	//////////////////////////////////////////////////////////////
+	// Statement log for load tests: every statement of the attached connections with its bound
+	// parameter bytes, connection, start and duration. Attach with MySqlConnection::SetWorkloadCapture;
+	// thread safe. Transaction control through the C API (BeginTransaction, Commit) is not seen.
+	//
+	// File: "KIFFWKLD" + version, then records of LEB128 varints:
+	//   'S' id length text					- statement text, once
+	//   'E' session id start duration flags count {type length+1 bytes | type 0}
+	class WorkloadCapture
+	{
+		static const size_t BufferSize = 65536;
+
+		FILE *file = nullptr;
+		std::chrono::steady_clock::time_point origin;
+		std::atomic<uint32_t> sessions{ 0 };
+
+		std::mutex mtx;
+		std::string buf;
+		std::unordered_map<std::string, uint32_t> statements;
+		uint64_t events = 0;
+
+		WorkloadCapture(const WorkloadCapture&) = delete;
+		void Write();
+	public:
+		static const uint32_t FormatVersion = 1;
+
+		explicit WorkloadCapture(const std::string &path);
+		~WorkloadCapture();
+
+		// new connection id
+		uint32_t Session() { return ++sessions; }
+
+		void Record(uint32_t session, const std::string &query, const DataStore *bindings, uint32_t paramCount,
+			std::chrono::steady_clock::time_point start, bool failed);
+
+		uint64_t Events();
+
+		// write the buffered records
+		void Flush();
+	};
+
+	// a captured file, events in start order
+	struct WorkloadLog
+	{
+		std::vector<std::string> statements;
+		std::vector<WorkloadEvent> events;
+
+		static WorkloadLog Load(const std::string &path);
+	};
+
+	struct WorkloadLatency
+	{
+		std::string query;						// empty for the total
+		uint64_t count = 0;
+		uint64_t errors = 0;
+		std::chrono::microseconds mean{ 0 };
+		std::chrono::microseconds p50{ 0 };
+		std::chrono::microseconds p90{ 0 };
+		std::chrono::microseconds p99{ 0 };
+		std::chrono::microseconds max{ 0 };
+	};
+
+	struct WorkloadReport
+	{
+		std::chrono::microseconds elapsed{ 0 };
+		std::chrono::microseconds maxLag{ 0 };		// worst start behind schedule
+		WorkloadLatency total;
+		std::vector<WorkloadLatency> statements;	// by total time, descending
+	};
+
+	//////////////////////////////////////////////////////////////
+	// Re-drives a log: one connection and thread per captured session, each statement
+	// started at its captured offset divided by speed (0 - back to back), prepared
+	// statements with the captured parameters. Errors are counted, not thrown.
+	class WorkloadReplay
+	{
+		const WorkloadLog &log;
+	public:
+		explicit WorkloadReplay(const WorkloadLog &ilog) :log(ilog) {}
+
+		WorkloadReport Run(const std::string &connStr, double speed = 1.0);
+	};
+}
@@ -0,0 +1,261 @@
+/*
+Site:		http://hlspx.ocry.com/mysqlconnestion/
+
+History:
+			VERSION
+			1.0.0.0
+Author:
+		Alexey Tretyakov	hlspx@mail.ru
+*/
+
+#pragma once
+
+#include "MySqlInsertBuilder.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <tuple>
+
+namespace Kiff {
+
+	//////////////////////////////////////////////////////////////
+	// Fire-and-forget INSERTs (audit, metrics): Push copies a typed row into a bounded
+	// lock-free ring and returns; a writer thread on its own connection sends the rows as
+	// multi-row INSERTs (MultiRowInsertBuilder), up to maxRows per transaction, committed
+	// when the ring runs dry or maxDelay after the batch's first row.
+	//
+	// The ring holds capacity rows (rounded up to a power of two): Push blocks while it is
+	// full, TryPush gives up. A failed batch is rolled back and handed to onError with its
+	// rows on the writer thread (without onError they are dropped). The destructor writes
+	// everything pushed before it; Push must not race with it.
+	template<typename... Args>
+	class WriteBehindQueue
+	{
+	public:
+		typedef std::tuple<Args...> Row;
+		typedef std::function<void(const std::string &error, std::vector<Row> &rows)> ErrorFn;
+	private:
+		struct Cell
+		{
+			std::atomic<size_t> seq;
+			Row row;
+		};
+
+		MySqlConnection conn;
+		MultiRowInsertBuilder builder;
+		size_t maxRows;
+		std::chrono::milliseconds maxDelay;
+		ErrorFn onError;
+
+		std::unique_ptr<Cell[]> ring;
+		size_t mask;
+		std::atomic<size_t> tail{ 0 };			// next cell to claim, producers
+		size_t head = 0;						// next cell to take, writer thread
+		std::atomic<bool> idle{ false };		// writer is waiting for rows
+		std::atomic<uint32_t> blocked{ 0 };		// producers waiting for room
+
+		std::mutex mtx;
+		std::condition_variable notEmpty;
+		std::condition_variable notFull;
+		std::condition_variable written;
+		uint64_t done = 0;						// rows written or failed
+		uint64_t failed = 0;
+		bool stop = false;
+		std::thread thr;
+
+		WriteBehindQueue(const WriteBehindQueue&) = delete;
+
+		// bounded MPMC queue (D. Vyukov): a cell's seq says whose turn it is
+		bool Enqueue(Row &&row)
+		{
+			size_t pos = tail.load(std::memory_order_relaxed);
+			Cell *cell;
+			for (;;)
+			{
+				cell = &ring[pos & mask];
+				intptr_t dif = static_cast<intptr_t>(cell->seq.load(std::memory_order_acquire)) - static_cast<intptr_t>(pos);
+				if (dif == 0)
+				{
+					if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+				}
+				else if (dif < 0) return false;
+				else pos = tail.load(std::memory_order_relaxed);
+			}
+			cell->row = std::move(row);
+			cell->seq.store(pos + 1, std::memory_order_release);
+
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (idle.load(std::memory_order_relaxed))
+			{
+				std::lock_guard<std::mutex> lk(mtx);
+				notEmpty.notify_one();
+			}
+			return true;
+		}
+
+		bool Dequeue(Row &row)
+		{
+			Cell &cell = ring[head & mask];
+			if (cell.seq.load(std::memory_order_acquire) != head + 1) return false;
+			row = std::move(cell.row);
+			cell.seq.store(head + mask + 1, std::memory_order_release);
+			head++;
+			return true;
+		}
+
+		template<size_t... I>
+		void Add(Row &row, std::index_sequence<I...>)
+		{
+			builder.AddRow(std::get<I>(row)...);
+		}
+
+		void Write(std::vector<Row> &batch)
+		{
+			std::string error;
+			bool batchFailed = false;
+			try
+			{
+				MySqlTransaction trans = conn.BeginTransaction();
+				for (Row &row : batch) Add(row, std::index_sequence_for<Args...>());
+				builder.Flush();
+				trans.Commit();
+			}
+			catch (std::exception &ex)
+			{
+				builder.Clear();		// rows of the batch added before the failure
+				batchFailed = true;
+				error = ex.what();
+			}
+
+			if (batchFailed && onError)
+			{
+				try
+				{
+					onError(error, batch);
+				}
+				catch (...)
+				{
+				}
+			}
+			std::lock_guard<std::mutex> lk(mtx);
+			done += batch.size();
+			if (batchFailed) failed += batch.size();
+			written.notify_all();
+		}
+
+		// waits for a row until the deadline; false when there is none
+		bool Take(Row &row, std::chrono::steady_clock::time_point deadline)
+		{
+			for (;;)
+			{
+				if (Dequeue(row))
+				{
+					if (blocked.load() != 0)
+					{
+						std::lock_guard<std::mutex> lk(mtx);
+						notFull.notify_all();
+					}
+					return true;
+				}
+				std::unique_lock<std::mutex> lk(mtx);
+				if (stop || (std::chrono::steady_clock::now() >= deadline)) return Dequeue(row);
+				idle = true;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (ring[head & mask].seq.load(std::memory_order_acquire) != head + 1)
+					notEmpty.wait_until(lk, deadline);
+				idle = false;
+			}
+		}
+
+		void Run()
+		{
+			std::vector<Row> batch;
+			Row row;
+			for (;;)
+			{
+				if (!Take(row, std::chrono::steady_clock::now() + std::chrono::seconds(1)))
+				{
+					std::lock_guard<std::mutex> lk(mtx);
+					if (stop) return;
+					continue;
+				}
+
+				std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + maxDelay;
+				batch.push_back(std::move(row));
+				while ((batch.size() < maxRows) && Take(row, deadline)) batch.push_back(std::move(row));
+				Write(batch);
+				batch.clear();
+			}
+		}
+	public:
+		WriteBehindQueue(const std::string &connStr, const std::string &table, const std::vector<std::string> &columns,
+			size_t capacity = 65536, size_t imaxRows = 1000, uint32_t maxMilliseconds = 100, ErrorFn ionError = nullptr)
+			:conn(connStr), builder(conn, table, columns), maxRows(imaxRows == 0 ? 1 : imaxRows), maxDelay(maxMilliseconds), onError(std::move(ionError))
+		{
+			if (columns.size() != sizeof...(Args))
+				throw std::runtime_error("WriteBehindQueue : " + std::to_string(columns.size()) + " columns for " + std::to_string(sizeof...(Args)) + " values");
+			size_t size = 2;
+			while (size < capacity) size *= 2;
+			ring.reset(new Cell[size]);
+			mask = size - 1;
+			for (size_t i = 0; i < size; i++) ring[i].seq.store(i, std::memory_order_relaxed);
+			thr = std::thread(&WriteBehindQueue::Run, this);
+		}
+
+		~WriteBehindQueue()
+		{
+			{
+				std::lock_guard<std::mutex> lk(mtx);
+				stop = true;
+			}
+			notEmpty.notify_all();
+			thr.join();
+		}
+
+		// false if the ring is full
+		bool TryPush(Args... values)
+		{
+			return Enqueue(Row(std::move(values)...));
+		}
+
+		// waits while the ring is full
+		void Push(Args... values)
+		{
+			Row row(std::move(values)...);
+			if (Enqueue(std::move(row))) return;
+
+			blocked++;
+			while (!Enqueue(std::move(row)))
+			{
+				std::unique_lock<std::mutex> lk(mtx);
+				notFull.wait_for(lk, std::chrono::milliseconds(1));
+			}
+			blocked--;
+		}
+
+		// waits until the rows pushed so far are committed or failed
+		void Flush()
+		{
+			uint64_t target = tail.load();
+			std::unique_lock<std::mutex> lk(mtx);
+			notEmpty.notify_one();
+			written.wait(lk, [&] { return done >= target; });
+		}
+
+		// rows pushed and not yet written
+		uint64_t Pending()
+		{
+			std::lock_guard<std::mutex> lk(mtx);
+			return tail.load() - done;
+		}
+
+		// rows of failed batches
+		uint64_t Failed()
+		{
+			std::lock_guard<std::mutex> lk(mtx);
+			return failed;
+		}
+	};
+}
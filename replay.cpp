@@ -0,0 +1,39 @@
+#include <cstdlib>
+#include <iostream>
+#include "MySqlWorkload.h"
+
+using namespace Kiff;
+
+static void Print(const WorkloadLatency &lat)
+{
+	std::cout << lat.count << "\t" << lat.errors << "\t" << lat.mean.count() << "\t" << lat.p50.count() << "\t"
+		<< lat.p90.count() << "\t" << lat.p99.count() << "\t" << lat.max.count() << "\t" << (lat.query.empty() ? "(total)" : lat.query) << std::endl;
+}
+
+// replay <capture file> <connection string> [speed]
+int main(int argc, char *argv[])
+{
+	if (argc < 3)
+	{
+		std::cerr << "usage: replay <capture file> <connection string> [speed, 0 - back to back]" << std::endl;
+		return 2;
+	}
+
+	try
+	{
+		WorkloadLog log = WorkloadLog::Load(argv[1]);
+		double speed = (argc > 3) ? atof(argv[3]) : 1.0;
+		WorkloadReport report = WorkloadReplay(log).Run(argv[2], speed);
+
+		std::cout << log.events.size() << " statements, elapsed " << report.elapsed.count() << " us, max lag " << report.maxLag.count() << " us" << std::endl;
+		std::cout << "count\terrors\tmean\tp50\tp90\tp99\tmax (us)" << std::endl;
+		Print(report.total);
+		for (const WorkloadLatency &lat : report.statements) Print(lat);
+	}
+	catch (std::exception &ex)
+	{
+		std::cerr << ex.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
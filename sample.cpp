@@ -22,11 +22,10 @@ int main()
 	std::string nm;
 	double wg;
 
-	MySqlDataReader *rd = conn.ExecuteReader("select name,weight from person where age > ?", minage);
-	while (rd->Read())
+	MySqlDataReader rd = conn.ExecuteReader("select name,weight from person where age > ?", minage);
+	while (rd.Read())
 	{
-		rd->GetValues(nm, wg);
+		rd.GetValues(nm, wg);
 		std::cout << nm << " " << wg << std::endl;
 	}
-	delete rd;
 }
\ No newline at end of file